@@ -0,0 +1,13 @@
+include(../../opencv.pri)
+
+QT       += testlib
+
+TARGET = tst_benchcvmatandimage
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+SOURCES += \
+    tst_benchcvmatandimage.cpp
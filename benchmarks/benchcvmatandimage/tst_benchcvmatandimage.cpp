@@ -0,0 +1,570 @@
+#include "cvmatandqimage.h"
+
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include <QDebug>
+
+#include <opencv2/core/core.hpp>
+
+using namespace QtOcv;
+
+Q_DECLARE_METATYPE(QImage::Format)
+Q_DECLARE_METATYPE(MatColorOrder)
+
+namespace {
+
+struct FormatName
+{
+    QImage::Format format;
+    const char *name;
+};
+
+const FormatName formatNames[] = {
+    {QImage::Format_Mono, "Mono"},
+    {QImage::Format_MonoLSB, "MonoLSB"},
+    {QImage::Format_Indexed8, "Indexed8"},
+    {QImage::Format_RGB32, "RGB32"},
+    {QImage::Format_ARGB32, "ARGB32"},
+    {QImage::Format_ARGB32_Premultiplied, "ARGB32_Premultiplied"},
+#if QT_VERSION >= 0x040400
+    {QImage::Format_RGB16, "RGB16"},
+    {QImage::Format_ARGB8565_Premultiplied, "ARGB8565_Premultiplied"},
+    {QImage::Format_RGB666, "RGB666"},
+    {QImage::Format_ARGB6666_Premultiplied, "ARGB6666_Premultiplied"},
+    {QImage::Format_RGB555, "RGB555"},
+    {QImage::Format_ARGB8555_Premultiplied, "ARGB8555_Premultiplied"},
+    {QImage::Format_RGB888, "RGB888"},
+    {QImage::Format_RGB444, "RGB444"},
+    {QImage::Format_ARGB4444_Premultiplied, "ARGB4444_Premultiplied"},
+#endif
+#if QT_VERSION >= 0x050200
+    {QImage::Format_RGBX8888, "RGBX8888"},
+    {QImage::Format_RGBA8888, "RGBA8888"},
+    {QImage::Format_RGBA8888_Premultiplied, "RGBA8888_Premultiplied"},
+#endif
+#if QT_VERSION >= 0x050400
+    {QImage::Format_BGR30, "BGR30"},
+    {QImage::Format_A2BGR30_Premultiplied, "A2BGR30_Premultiplied"},
+    {QImage::Format_RGB30, "RGB30"},
+    {QImage::Format_A2RGB30_Premultiplied, "A2RGB30_Premultiplied"},
+#endif
+#if QT_VERSION >= 0x050500
+    {QImage::Format_Alpha8, "Alpha8"},
+    {QImage::Format_Grayscale8, "Grayscale8"},
+#endif
+#if QT_VERSION >= 0x050C00
+    {QImage::Format_RGBX64, "RGBX64"},
+    {QImage::Format_RGBA64, "RGBA64"},
+    {QImage::Format_RGBA64_Premultiplied, "RGBA64_Premultiplied"},
+#endif
+#if QT_VERSION >= 0x050D00
+    {QImage::Format_Grayscale16, "Grayscale16"},
+#endif
+#if QT_VERSION >= 0x050E00
+    {QImage::Format_BGR888, "BGR888"},
+#endif
+#if QT_VERSION >= 0x060200
+    {QImage::Format_RGBX16FPx4, "RGBX16FPx4"},
+    {QImage::Format_RGBA16FPx4, "RGBA16FPx4"},
+    {QImage::Format_RGBA16FPx4_Premultiplied, "RGBA16FPx4_Premultiplied"},
+    {QImage::Format_RGBX32FPx4, "RGBX32FPx4"},
+    {QImage::Format_RGBA32FPx4, "RGBA32FPx4"},
+    {QImage::Format_RGBA32FPx4_Premultiplied, "RGBA32FPx4_Premultiplied"},
+#endif
+};
+
+const int formatCount = sizeof(formatNames) / sizeof(formatNames[0]);
+
+const int matTypes[] = {
+    CV_8UC1, CV_8UC3, CV_8UC4,
+    CV_16UC1, CV_16UC3, CV_16UC4,
+    CV_32FC1, CV_32FC3, CV_32FC4
+};
+
+const int matTypeCount = sizeof(matTypes) / sizeof(matTypes[0]);
+
+/*
+ * The (type, format) pairs which mat2Image_shared() accepts,
+ * Format_Invalid lets it choose the format.
+ */
+struct SharedFormat
+{
+    int matType;
+    QImage::Format format;
+};
+
+const SharedFormat sharedFormats[] = {
+    {CV_8UC1, QImage::Format_Invalid},
+    {CV_8UC1, QImage::Format_Indexed8},
+#if QT_VERSION >= 0x050500
+    {CV_8UC1, QImage::Format_Alpha8},
+    {CV_8UC1, QImage::Format_Grayscale8},
+#endif
+    {CV_8UC3, QImage::Format_Invalid},
+    {CV_8UC3, QImage::Format_RGB888},
+#if QT_VERSION >= 0x050E00
+    {CV_8UC3, QImage::Format_BGR888},
+#endif
+    {CV_8UC4, QImage::Format_Invalid},
+    {CV_8UC4, QImage::Format_RGB32},
+    {CV_8UC4, QImage::Format_ARGB32},
+    {CV_8UC4, QImage::Format_ARGB32_Premultiplied},
+#if QT_VERSION >= 0x050200
+    {CV_8UC4, QImage::Format_RGBX8888},
+    {CV_8UC4, QImage::Format_RGBA8888},
+    {CV_8UC4, QImage::Format_RGBA8888_Premultiplied},
+#endif
+#if QT_VERSION >= 0x050D00
+    {CV_16UC1, QImage::Format_Invalid},
+    {CV_16UC1, QImage::Format_Grayscale16},
+#endif
+#if QT_VERSION >= 0x050C00
+    {CV_16UC4, QImage::Format_Invalid},
+    {CV_16UC4, QImage::Format_RGBX64},
+    {CV_16UC4, QImage::Format_RGBA64},
+    {CV_16UC4, QImage::Format_RGBA64_Premultiplied},
+#endif
+#if QT_VERSION >= 0x060200
+    {CV_32FC4, QImage::Format_Invalid},
+    {CV_32FC4, QImage::Format_RGBX32FPx4},
+    {CV_32FC4, QImage::Format_RGBA32FPx4},
+    {CV_32FC4, QImage::Format_RGBA32FPx4_Premultiplied},
+#endif
+};
+
+const int sharedFormatCount = sizeof(sharedFormats) / sizeof(sharedFormats[0]);
+
+QString formatName(QImage::Format format)
+{
+    if (format == QImage::Format_Invalid)
+        return QLatin1String("Auto");
+    for (int i = 0; i < formatCount; ++i) {
+        if (formatNames[i].format == format)
+            return QLatin1String(formatNames[i].name);
+    }
+    return QString::number(int(format));
+}
+
+QString matTypeName(int type)
+{
+    const int depth = CV_MAT_DEPTH(type);
+    QString name = depth == CV_8U ? QLatin1String("8U") : (depth == CV_16U ? QLatin1String("16U") : QLatin1String("32F"));
+    return name + QLatin1String("C") + QString::number(CV_MAT_CN(type));
+}
+
+QString orderName(MatColorOrder order)
+{
+    switch (order) {
+    case MCO_RGB:
+        return QLatin1String("RGB");
+    case MCO_ARGB:
+        return QLatin1String("ARGB");
+    default:
+        return QLatin1String("BGR");
+    }
+}
+
+/*
+ * The orders which make sense for a mat of the given channels.
+ */
+QList<MatColorOrder> ordersOf(int channels)
+{
+    QList<MatColorOrder> orders;
+    orders.append(MCO_BGR);
+    if (channels >= 3)
+        orders.append(MCO_RGB);
+    if (channels == 4)
+        orders.append(MCO_ARGB);
+    return orders;
+}
+
+/*
+ * Sizes from a thumbnail to 8K. QTOCV_BENCH_SIZES="64x64,1920x1080"
+ * can be used to run a subset of them, or other sizes.
+ */
+QList<QSize> benchmarkSizes()
+{
+    QList<QSize> sizes;
+    const QString env = QString::fromLocal8Bit(qgetenv("QTOCV_BENCH_SIZES"));
+    const QStringList items = env.split(QLatin1Char(','));
+    for (int i = 0; i < items.size(); ++i) {
+        const QStringList wh = items[i].trimmed().split(QLatin1Char('x'));
+        if (wh.size() == 2 && wh[0].toInt() > 0 && wh[1].toInt() > 0)
+            sizes.append(QSize(wh[0].toInt(), wh[1].toInt()));
+    }
+    if (sizes.isEmpty()) {
+        sizes.append(QSize(64, 64));
+        sizes.append(QSize(640, 480));
+        sizes.append(QSize(1920, 1080));
+        sizes.append(QSize(3840, 2160));
+        sizes.append(QSize(7680, 4320));
+    }
+    return sizes;
+}
+
+QString sizeName(const QSize &size)
+{
+    return QString::fromLatin1("%1x%2").arg(size.width()).arg(size.height());
+}
+
+qint64 imageBytes(const QImage &image)
+{
+#if QT_VERSION >= 0x050A00
+    return image.sizeInBytes();
+#else
+    return image.byteCount();
+#endif
+}
+
+/*
+ * The source images and mats are created on demand, only the
+ * last one is kept, so that 8K rows don't stay in memory.
+ */
+QImage testImage(QImage::Format format, const QSize &size)
+{
+    static QImage cachedImage;
+    if (cachedImage.size() == size && cachedImage.format() == format)
+        return cachedImage;
+
+    QImage image(size, QImage::Format_ARGB32);
+    for (int row = 0; row < size.height(); ++row) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(row));
+        for (int col = 0; col < size.width(); ++col)
+            line[col] = qRgba(col * 7, row * 3, (col + row) * 5, 128 + (col & 127));
+    }
+    cachedImage = format == QImage::Format_ARGB32 ? image : image.convertToFormat(format);
+    return cachedImage;
+}
+
+cv::Mat testMat(int type, const QSize &size)
+{
+    static cv::Mat cachedMat;
+    if (cachedMat.cols == size.width() && cachedMat.rows == size.height() && cachedMat.type() == type)
+        return cachedMat;
+
+    cachedMat = image2Mat(testImage(QImage::Format_ARGB32, size), type, MCO_BGRA);
+    return cachedMat;
+}
+
+/*
+ * Time and allocations of the calls made inside one QBENCHMARK loop.
+ */
+class Measurement
+{
+public:
+    Measurement() : iterations(0), nsecs(0), bytes(0) {}
+
+    void start() { timer.start(); }
+    void stop() { nsecs += timer.nsecsElapsed(); ++iterations; }
+    void allocated(qint64 n) { bytes += n; }
+
+    qint64 iterations;
+    qint64 nsecs;
+    qint64 bytes;
+
+private:
+    QElapsedTimer timer;
+};
+
+struct BenchmarkResult
+{
+    QString function;
+    QString tag;
+    QSize size;
+    qint64 iterations;
+    double nsecsPerCall;
+    double mpixPerSecond;
+    qint64 bytesPerCall;
+    QString cpuLevel;
+};
+
+QList<BenchmarkResult> benchmarkResults;
+
+void report(const QSize &size, const Measurement &m)
+{
+    if (!m.iterations)
+        return;
+
+    BenchmarkResult result;
+    result.function = QString::fromLatin1(QTest::currentTestFunction());
+    result.tag = QString::fromLatin1(QTest::currentDataTag());
+    result.size = size;
+    result.iterations = m.iterations;
+    result.nsecsPerCall = double(m.nsecs) / m.iterations;
+    result.mpixPerSecond = result.nsecsPerCall > 0 ? 1000.0 * size.width() * size.height() / result.nsecsPerCall : 0.0;
+    result.bytesPerCall = m.bytes / m.iterations;
+    result.cpuLevel = QString::fromLatin1(cpuLevelName(cpuLevel()));
+    benchmarkResults.append(result);
+
+    qDebug("%.1f MPix/s, %lld bytes allocated per call", result.mpixPerSecond, result.bytesPerCall);
+}
+
+QString jsonString(const QString &s)
+{
+    QString escaped = s;
+    escaped.replace(QLatin1Char('\\'), QLatin1String("\\\\"));
+    escaped.replace(QLatin1Char('"'), QLatin1String("\\\""));
+    return QLatin1Char('"') + escaped + QLatin1Char('"');
+}
+
+bool writeResults(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return false;
+
+    QTextStream out(&file);
+    const bool json = fileName.endsWith(QLatin1String(".json"), Qt::CaseInsensitive);
+    if (json)
+        out << "[\n";
+    else
+        out << "function,tag,width,height,iterations,nsPerCall,mpixPerSecond,bytesPerCall,cpuLevel\n";
+
+    for (int i = 0; i < benchmarkResults.size(); ++i) {
+        const BenchmarkResult &r = benchmarkResults[i];
+        if (json) {
+            out << "  {\"function\": " << jsonString(r.function)
+                << ", \"tag\": " << jsonString(r.tag)
+                << ", \"width\": " << r.size.width()
+                << ", \"height\": " << r.size.height()
+                << ", \"iterations\": " << r.iterations
+                << ", \"nsPerCall\": " << QString::number(r.nsecsPerCall, 'f', 1)
+                << ", \"mpixPerSecond\": " << QString::number(r.mpixPerSecond, 'f', 2)
+                << ", \"bytesPerCall\": " << r.bytesPerCall
+                << ", \"cpuLevel\": " << jsonString(r.cpuLevel)
+                << (i + 1 < benchmarkResults.size() ? "},\n" : "}\n");
+        } else {
+            out << r.function << ',' << '"' << r.tag << '"' << ','
+                << r.size.width() << ',' << r.size.height() << ','
+                << r.iterations << ','
+                << QString::number(r.nsecsPerCall, 'f', 1) << ','
+                << QString::number(r.mpixPerSecond, 'f', 2) << ','
+                << r.bytesPerCall << ',' << r.cpuLevel << '\n';
+        }
+    }
+    if (json)
+        out << "]\n";
+    return true;
+}
+
+} // namespace
+
+class BenchCvMatAndImage : public QObject
+{
+    Q_OBJECT
+
+public:
+    BenchCvMatAndImage();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void image2Mat_data();
+    void image2Mat();
+
+    void mat2Image_data();
+    void mat2Image();
+
+    void image2Mat_shared_data();
+    void image2Mat_shared();
+
+    void mat2Image_shared_data();
+    void mat2Image_shared();
+};
+
+BenchCvMatAndImage::BenchCvMatAndImage()
+{
+}
+
+/*
+ * The kernels of the level are measured, QTOCV_CPU_LEVEL can force
+ * a lower one to compare them.
+ */
+void BenchCvMatAndImage::initTestCase()
+{
+    qDebug("CPU level: %s", cpuLevelName(cpuLevel()));
+}
+
+/*
+ * The results are written to the file given by QTOCV_BENCH_OUTPUT,
+ * as JSON when its suffix is .json, as CSV otherwise.
+ */
+void BenchCvMatAndImage::cleanupTestCase()
+{
+    const QString fileName = QString::fromLocal8Bit(qgetenv("QTOCV_BENCH_OUTPUT"));
+    if (fileName.isEmpty())
+        return;
+    if (!writeResults(fileName))
+        qWarning("Can not write the benchmark results to %s", qPrintable(fileName));
+}
+
+void BenchCvMatAndImage::image2Mat_data()
+{
+    QTest::addColumn<QImage::Format>("format");
+    QTest::addColumn<int>("matType");
+    QTest::addColumn<MatColorOrder>("order");
+    QTest::addColumn<QSize>("size");
+
+    const QList<QSize> sizes = benchmarkSizes();
+    for (int s = 0; s < sizes.size(); ++s) {
+        const QSize &size = sizes[s];
+        for (int f = 0; f < formatCount; ++f) {
+            for (int t = 0; t < matTypeCount; ++t) {
+                const QList<MatColorOrder> orders = ordersOf(CV_MAT_CN(matTypes[t]));
+                for (int o = 0; o < orders.size(); ++o) {
+                    const MatColorOrder order = orders[o];
+                    const QString tag = QString::fromLatin1("%1 -> %2 %3 %4")
+                            .arg(QLatin1String(formatNames[f].name), matTypeName(matTypes[t]),
+                                 orderName(order), sizeName(size));
+                    QTest::newRow(tag.toLatin1().constData()) << formatNames[f].format << matTypes[t] << order << size;
+                }
+            }
+        }
+    }
+}
+
+void BenchCvMatAndImage::image2Mat()
+{
+    QFETCH(QImage::Format, format);
+    QFETCH(int, matType);
+    QFETCH(MatColorOrder, order);
+    QFETCH(QSize, size);
+
+    const QImage image = testImage(format, size);
+    cv::Mat mat;
+    Measurement m;
+    QBENCHMARK {
+        const uchar *data = mat.data;
+        m.start();
+        QtOcv::image2Mat(image, mat, matType, order);
+        m.stop();
+        if (mat.data != data)
+            m.allocated(qint64(mat.total() * mat.elemSize()));
+    }
+    report(size, m);
+}
+
+void BenchCvMatAndImage::mat2Image_data()
+{
+    QTest::addColumn<int>("matType");
+    QTest::addColumn<MatColorOrder>("order");
+    QTest::addColumn<QImage::Format>("formatHint");
+    QTest::addColumn<QSize>("size");
+
+    const QList<QSize> sizes = benchmarkSizes();
+    for (int s = 0; s < sizes.size(); ++s) {
+        const QSize &size = sizes[s];
+        for (int t = 0; t < matTypeCount; ++t) {
+            const QList<MatColorOrder> orders = ordersOf(CV_MAT_CN(matTypes[t]));
+            for (int o = 0; o < orders.size(); ++o) {
+                const MatColorOrder order = orders[o];
+                for (int f = -1; f < formatCount; ++f) {
+                    const QImage::Format hint = f < 0 ? QImage::Format_Invalid : formatNames[f].format;
+                    const QString tag = QString::fromLatin1("%1 %2 -> %3 %4")
+                            .arg(matTypeName(matTypes[t]), orderName(order),
+                                 formatName(hint), sizeName(size));
+                    QTest::newRow(tag.toLatin1().constData()) << matTypes[t] << order << hint << size;
+                }
+            }
+        }
+    }
+}
+
+void BenchCvMatAndImage::mat2Image()
+{
+    QFETCH(int, matType);
+    QFETCH(MatColorOrder, order);
+    QFETCH(QImage::Format, formatHint);
+    QFETCH(QSize, size);
+
+    const cv::Mat mat = testMat(matType, size);
+    QImage image;
+    Measurement m;
+    QBENCHMARK {
+        const uchar *data = image.constBits();
+        m.start();
+        QtOcv::mat2Image(mat, image, order, formatHint);
+        m.stop();
+        if (image.constBits() != data)
+            m.allocated(imageBytes(image));
+    }
+    report(size, m);
+}
+
+void BenchCvMatAndImage::image2Mat_shared_data()
+{
+    QTest::addColumn<QImage::Format>("format");
+    QTest::addColumn<QSize>("size");
+
+    const QList<QSize> sizes = benchmarkSizes();
+    for (int s = 0; s < sizes.size(); ++s) {
+        const QSize &size = sizes[s];
+        for (int f = 0; f < formatCount; ++f) {
+            //Only the formats which can be shared.
+            if (QtOcv::image2Mat_shared(QImage(1, 1, formatNames[f].format)).empty())
+                continue;
+            const QString tag = QString::fromLatin1("%1 %2").arg(QLatin1String(formatNames[f].name), sizeName(size));
+            QTest::newRow(tag.toLatin1().constData()) << formatNames[f].format << size;
+        }
+    }
+}
+
+void BenchCvMatAndImage::image2Mat_shared()
+{
+    QFETCH(QImage::Format, format);
+    QFETCH(QSize, size);
+
+    const QImage image = testImage(format, size);
+    Measurement m;
+    QBENCHMARK {
+        m.start();
+        cv::Mat mat = QtOcv::image2Mat_shared(image);
+        m.stop();
+        if (mat.data != image.constBits())
+            m.allocated(qint64(mat.total() * mat.elemSize()));
+    }
+    report(size, m);
+}
+
+void BenchCvMatAndImage::mat2Image_shared_data()
+{
+    QTest::addColumn<int>("matType");
+    QTest::addColumn<QImage::Format>("formatHint");
+    QTest::addColumn<QSize>("size");
+
+    const QList<QSize> sizes = benchmarkSizes();
+    for (int s = 0; s < sizes.size(); ++s) {
+        const QSize &size = sizes[s];
+        for (int i = 0; i < sharedFormatCount; ++i) {
+            const SharedFormat &shared = sharedFormats[i];
+            const QString tag = QString::fromLatin1("%1 -> %2 %3")
+                    .arg(matTypeName(shared.matType), formatName(shared.format), sizeName(size));
+            QTest::newRow(tag.toLatin1().constData()) << shared.matType << shared.format << size;
+        }
+    }
+}
+
+void BenchCvMatAndImage::mat2Image_shared()
+{
+    QFETCH(int, matType);
+    QFETCH(QImage::Format, formatHint);
+    QFETCH(QSize, size);
+
+    const cv::Mat mat = testMat(matType, size);
+    Measurement m;
+    QBENCHMARK {
+        m.start();
+        QImage image = QtOcv::mat2Image_shared(mat, formatHint);
+        m.stop();
+        if (image.constBits() != mat.data)
+            m.allocated(imageBytes(image));
+    }
+    report(size, m);
+}
+
+QTEST_MAIN(BenchCvMatAndImage)
+
+#include "tst_benchcvmatandimage.moc"
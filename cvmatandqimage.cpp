@@ -27,54 +27,45 @@
 #include <QImage>
 #include <QSysInfo>
 #include <QDebug>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QAtomicPointer>
+#ifdef QT_CONCURRENT_LIB
+#include <QtConcurrentMap>
+#endif
 #include <cstring>
+#include <climits>
+#include <cfloat>
 #include "opencv2/core/core.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
+#if CV_MAJOR_VERSION >= 3
+#include "opencv2/core/hal/intrin.hpp"
+#endif
 
-namespace QtOcv {
-namespace {
-
-/*ARGB <==> BGRA
- */
-cv::Mat argb2bgra(const cv::Mat &mat)
-{
-    Q_ASSERT(mat.channels()==4);
-
-    cv::Mat newMat(mat.rows, mat.cols, mat.type());
-    int from_to[] = {0,3, 1,2, 2,1, 3,0};
-    cv::mixChannels(&mat, 1, &newMat, 1, from_to, 4);
-    return newMat;
-}
-
-cv::Mat adjustChannelsOrder(const cv::Mat &srcMat, MatColorOrder srcOrder, MatColorOrder targetOrder)
-{
-    Q_ASSERT(srcMat.channels()==4);
-
-    if (srcOrder == targetOrder)
-        return srcMat.clone();
+//Kernels which are compiled for the instruction sets chosen at run time
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QTOCV_X86_KERNELS
+#define QTOCV_TARGET(isa) __attribute__((target(isa)))
+#define QTOCV_FLATTEN __attribute__((flatten))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define QTOCV_X86_KERNELS
+#define QTOCV_TARGET(isa)
+#define QTOCV_FLATTEN
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define QTOCV_NEON_KERNELS
+#endif
 
-    cv::Mat desMat;
+#if defined(QTOCV_X86_KERNELS)
+#include <immintrin.h>
+#elif defined(QTOCV_NEON_KERNELS)
+#include <arm_neon.h>
+#endif
 
-    if ((srcOrder == MCO_ARGB && targetOrder == MCO_BGRA)
-            ||(srcOrder == MCO_BGRA && targetOrder == MCO_ARGB)) {
-        //ARGB <==> BGRA
-        desMat = argb2bgra(srcMat);
-    } else if (srcOrder == MCO_ARGB && targetOrder == MCO_RGBA) {
-        //ARGB ==> RGBA
-        desMat = cv::Mat(srcMat.rows, srcMat.cols, srcMat.type());
-        int from_to[] = {0,3, 1,0, 2,1, 3,2};
-        cv::mixChannels(&srcMat, 1, &desMat, 1, from_to, 4);
-    } else if (srcOrder == MCO_RGBA && targetOrder == MCO_ARGB) {
-        //RGBA ==> ARGB
-        desMat = cv::Mat(srcMat.rows, srcMat.cols, srcMat.type());
-        int from_to[] = {0,1, 1,2, 2,3, 3,0};
-        cv::mixChannels(&srcMat, 1, &desMat, 1, from_to, 4);
-    } else {
-        //BGRA <==> RBGA
-        cv::cvtColor(srcMat, desMat, CV_BGRA2RGBA);
-    }
-    return desMat;
-}
+namespace QtOcv {
+namespace {
 
 QImage::Format findClosestFormat(QImage::Format formatHint)
 {
@@ -95,9 +86,41 @@ QImage::Format findClosestFormat(QImage::Format formatHint)
 #if QT_VERSION >= 0x050500
     case QImage::Format_Alpha8:
     case QImage::Format_Grayscale8:
+#endif
+#if QT_VERSION >= 0x050C00
+    case QImage::Format_RGBX64:
+    case QImage::Format_RGBA64:
+    case QImage::Format_RGBA64_Premultiplied:
+#endif
+#if QT_VERSION >= 0x050D00
+    case QImage::Format_Grayscale16:
+#endif
+#if QT_VERSION >= 0x050E00
+    case QImage::Format_BGR888:
+#endif
+#if QT_VERSION >= 0x060200
+    case QImage::Format_RGBX32FPx4:
+    case QImage::Format_RGBA32FPx4:
+    case QImage::Format_RGBA32FPx4_Premultiplied:
+#ifdef CV_16F
+    case QImage::Format_RGBX16FPx4:
+    case QImage::Format_RGBA16FPx4:
+    case QImage::Format_RGBA16FPx4_Premultiplied:
+#endif
 #endif
         format = formatHint;
         break;
+#if QT_VERSION >= 0x060200 && !defined(CV_16F)
+    case QImage::Format_RGBX16FPx4:
+        format = QImage::Format_RGBX32FPx4;
+        break;
+    case QImage::Format_RGBA16FPx4:
+        format = QImage::Format_RGBA32FPx4;
+        break;
+    case QImage::Format_RGBA16FPx4_Premultiplied:
+        format = QImage::Format_RGBA32FPx4_Premultiplied;
+        break;
+#endif
     case QImage::Format_Mono:
     case QImage::Format_MonoLSB:
         format = QImage::Format_Indexed8;
@@ -125,6 +148,73 @@ QImage::Format findClosestFormat(QImage::Format formatHint)
     return format;
 }
 
+bool isPremultipliedFormat(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_ARGB32_Premultiplied:
+#if QT_VERSION >= 0x050200
+    case QImage::Format_RGBA8888_Premultiplied:
+#endif
+#if QT_VERSION >= 0x050C00
+    case QImage::Format_RGBA64_Premultiplied:
+#endif
+#if QT_VERSION >= 0x060200
+    case QImage::Format_RGBA32FPx4_Premultiplied:
+    case QImage::Format_RGBA16FPx4_Premultiplied:
+#endif
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* The format of the same layout whose colors are premultiplied, or not,
+ * by alpha. QImage::Format_Invalid for the formats which have no such one.
+ */
+QImage::Format alphaCounterpartFormat(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_ARGB32:
+        return QImage::Format_ARGB32_Premultiplied;
+    case QImage::Format_ARGB32_Premultiplied:
+        return QImage::Format_ARGB32;
+#if QT_VERSION >= 0x050200
+    case QImage::Format_RGBA8888:
+        return QImage::Format_RGBA8888_Premultiplied;
+    case QImage::Format_RGBA8888_Premultiplied:
+        return QImage::Format_RGBA8888;
+#endif
+#if QT_VERSION >= 0x050C00
+    case QImage::Format_RGBA64:
+        return QImage::Format_RGBA64_Premultiplied;
+    case QImage::Format_RGBA64_Premultiplied:
+        return QImage::Format_RGBA64;
+#endif
+#if QT_VERSION >= 0x060200
+    case QImage::Format_RGBA32FPx4:
+        return QImage::Format_RGBA32FPx4_Premultiplied;
+    case QImage::Format_RGBA32FPx4_Premultiplied:
+        return QImage::Format_RGBA32FPx4;
+    case QImage::Format_RGBA16FPx4:
+        return QImage::Format_RGBA16FPx4_Premultiplied;
+    case QImage::Format_RGBA16FPx4_Premultiplied:
+        return QImage::Format_RGBA16FPx4;
+#endif
+    default:
+        return QImage::Format_Invalid;
+    }
+}
+
+/* Should the colors be premultiplied or unpremultiplied between the
+ * pixels of the format and the mat of the alpha mode?
+ */
+bool convertsAlpha(QImage::Format format, AlphaMode mode)
+{
+    if (mode == AM_Raw || alphaCounterpartFormat(format) == QImage::Format_Invalid)
+        return false;
+    return isPremultipliedFormat(format) != (mode == AM_Premultiplied);
+}
+
 MatColorOrder getColorOrderOfRGB32Format()
 {
 #if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
@@ -133,286 +223,4562 @@ MatColorOrder getColorOrderOfRGB32Format()
         return MCO_ARGB;
 #endif
 }
-} //namespace
 
+/* Fused pixel kernels
+ *
+ * Each kernel reads a row of source pixels once, and writes the
+ * pixels of the target depth and channels order directly.
+ *
+ * - map[i] is the source channel used by the target channel i,
+ *   -1 means that the target channel is an alpha channel which
+ *   does not exist in the source.
+ * - For gray targets, map holds the source channels of (R G B).
+ */
+typedef void (*RowKernel)(const uchar *src, uchar *dst, int width, const int *map, double scale, double alpha);
 
-/* Convert QImage to cv::Mat
+/* Row kernel compiled for the instruction sets of the CPU level. The kernel
+ * and the functions it calls are inlined into run(), so the universal
+ * intrinsics and the scalar loops are compiled for the level too. FMA isn't
+ * enabled, so the float results are the same at every level.
  */
-cv::Mat image2Mat(const QImage &img, int requiredMatType, MatColorOrder requriedOrder)
+template<int level>
+struct LevelKernel
 {
-    int targetDepth = CV_MAT_DEPTH(requiredMatType);
-    int targetChannels = CV_MAT_CN(requiredMatType);
-    Q_ASSERT(targetChannels==CV_CN_MAX || targetChannels==1 || targetChannels==3 || targetChannels==4);
-    Q_ASSERT(targetDepth==CV_8U || targetDepth==CV_16U || targetDepth==CV_32F);
-
-    if (img.isNull())
-        return cv::Mat();
+    template<RowKernel kernel>
+    static void run(const uchar *src, uchar *dst, int width, const int *map, double scale, double alpha)
+    {
+        kernel(src, dst, width, map, scale, alpha);
+    }
+};
 
-    //Find the closest image format that can be used in image2Mat_shared()
-    QImage::Format format = findClosestFormat(img.format());
-    QImage image = (format==img.format()) ? img : img.convertToFormat(format);
+#ifdef QTOCV_X86_KERNELS
+template<>
+struct LevelKernel<CPU_SSSE3>
+{
+    template<RowKernel kernel>
+    QTOCV_TARGET("ssse3") QTOCV_FLATTEN
+    static void run(const uchar *src, uchar *dst, int width, const int *map, double scale, double alpha)
+    {
+        kernel(src, dst, width, map, scale, alpha);
+    }
+};
 
-    MatColorOrder srcOrder;
-    cv::Mat mat0 = image2Mat_shared(image, &srcOrder);
-
-    //Adjust mat channells if needed.
-    cv::Mat mat_adjustCn;
-    const float maxAlpha = targetDepth==CV_8U ? 255 : (targetDepth==CV_16U ? 65535 : 1.0);
-    if (targetChannels == CV_CN_MAX)
-        targetChannels = mat0.channels();
-    switch(targetChannels) {
-    case 1:
-        if (mat0.channels() == 3) {
-            cv::cvtColor(mat0, mat_adjustCn, CV_RGB2GRAY);
-        } else if (mat0.channels() == 4) {
-            if (srcOrder == MCO_BGRA)
-                cv::cvtColor(mat0, mat_adjustCn, CV_BGRA2GRAY);
-            else if (srcOrder == MCO_RGBA)
-                cv::cvtColor(mat0, mat_adjustCn, CV_RGBA2GRAY);
-            else//MCO_ARGB
-                cv::cvtColor(argb2bgra(mat0), mat_adjustCn, CV_BGRA2GRAY);
-        }
-        break;
-    case 3:
-        if (mat0.channels() == 1) {
-            cv::cvtColor(mat0, mat_adjustCn, requriedOrder == MCO_BGR ? CV_GRAY2BGR : CV_GRAY2RGB);
-        } else if (mat0.channels() == 3) {
-            if (requriedOrder != srcOrder)
-                cv::cvtColor(mat0, mat_adjustCn, CV_RGB2BGR);
-        } else if (mat0.channels() == 4) {
-            if (srcOrder == MCO_ARGB) {
-                mat_adjustCn = cv::Mat(mat0.rows, mat0.cols, CV_MAKE_TYPE(mat0.type(), 3));
-                int ARGB2RGB[] = {1,0, 2,1, 3,2};
-                int ARGB2BGR[] = {1,2, 2,1, 3,0};
-                cv::mixChannels(&mat0, 1, &mat_adjustCn, 1, requriedOrder == MCO_BGR ? ARGB2BGR : ARGB2RGB, 3);
-            } else if (srcOrder == MCO_BGRA) {
-                cv::cvtColor(mat0, mat_adjustCn, requriedOrder == MCO_BGR ? CV_BGRA2BGR : CV_BGRA2RGB);
-            } else {//RGBA
-                cv::cvtColor(mat0, mat_adjustCn, requriedOrder == MCO_BGR ? CV_RGBA2BGR : CV_RGBA2RGB);
-            }
-        }
-        break;
-    case 4:
-        if (mat0.channels() == 1) {
-            if (requriedOrder == MCO_ARGB) {
-                cv::Mat alphaMat(mat0.rows, mat0.cols, CV_MAKE_TYPE(mat0.type(), 1), cv::Scalar(maxAlpha));
-                mat_adjustCn = cv::Mat(mat0.rows, mat0.cols, CV_MAKE_TYPE(mat0.type(), 4));
-                cv::Mat in[] = {alphaMat, mat0};
-                int from_to[] = {0,0, 1,1, 1,2, 1,3};
-                cv::mixChannels(in, 2, &mat_adjustCn, 1, from_to, 4);
-            } else if (requriedOrder == MCO_RGBA) {
-                cv::cvtColor(mat0, mat_adjustCn, CV_GRAY2RGBA);
-            } else {//MCO_BGRA
-                cv::cvtColor(mat0, mat_adjustCn, CV_GRAY2BGRA);
-            }
-        } else if (mat0.channels() == 3) {
-            if (requriedOrder == MCO_ARGB) {
-                cv::Mat alphaMat(mat0.rows, mat0.cols, CV_MAKE_TYPE(mat0.type(), 1), cv::Scalar(maxAlpha));
-                mat_adjustCn = cv::Mat(mat0.rows, mat0.cols, CV_MAKE_TYPE(mat0.type(), 4));
-                cv::Mat in[] = {alphaMat, mat0};
-                int from_to[] = {0,0, 1,1, 2,2, 3,3};
-                cv::mixChannels(in, 2, &mat_adjustCn, 1, from_to, 4);
-            } else if (requriedOrder == MCO_RGBA) {
-                cv::cvtColor(mat0, mat_adjustCn, CV_RGB2RGBA);
-            } else {//MCO_BGRA
-                cv::cvtColor(mat0, mat_adjustCn, CV_RGB2BGRA);
-            }
-        } else if (mat0.channels() == 4) {
-            if (srcOrder != requriedOrder)
-                mat_adjustCn = adjustChannelsOrder(mat0, srcOrder, requriedOrder);
-        }
-        break;
-    default:
-        break;
+template<>
+struct LevelKernel<CPU_AVX2>
+{
+    template<RowKernel kernel>
+    QTOCV_TARGET("avx2") QTOCV_FLATTEN
+    static void run(const uchar *src, uchar *dst, int width, const int *map, double scale, double alpha)
+    {
+        kernel(src, dst, width, map, scale, alpha);
     }
+};
+#endif
+
+enum ChannelRole {
+    CR_Red,
+    CR_Green,
+    CR_Blue,
+    CR_Alpha
+};
 
-    //Adjust depth if needed.
-    if (targetDepth == CV_8U)
-        return mat_adjustCn.empty() ? mat0.clone() : mat_adjustCn;
+/* Roles of the channels of a 3 or 4 channels cv::Mat
+ */
+void channelRoles(int channels, MatColorOrder order, int *roles)
+{
+    static const int bgra[] = {CR_Blue, CR_Green, CR_Red, CR_Alpha};
+    static const int rgba[] = {CR_Red, CR_Green, CR_Blue, CR_Alpha};
+    static const int argb[] = {CR_Alpha, CR_Red, CR_Green, CR_Blue};
 
-    if (mat_adjustCn.empty())
-        mat_adjustCn = mat0;
-    cv::Mat mat_adjustDepth;
-    mat_adjustCn.convertTo(mat_adjustDepth, CV_MAKE_TYPE(targetDepth, mat_adjustCn.channels()), targetDepth == CV_16U ? 255.0 : 1/255.0);
-    return mat_adjustDepth;
+    const int *src = rgba;
+    if (order == MCO_BGR)
+        src = bgra;
+    else if (order == MCO_ARGB && channels == 4)
+        src = argb;
+    for (int i=0; i<channels; ++i)
+        roles[i] = src[i];
 }
 
-/* Convert cv::Mat to QImage
+/* Build the channel map used by the kernels.
  */
-QImage mat2Image(const cv::Mat &mat, MatColorOrder order, QImage::Format formatHint)
+void buildChannelMap(int srcChannels, MatColorOrder srcOrder, int dstChannels, MatColorOrder dstOrder, int *map)
 {
-    Q_ASSERT(mat.channels()==1 || mat.channels()==3 || mat.channels()==4);
-    Q_ASSERT(mat.depth()==CV_8U || mat.depth()==CV_16U || mat.depth()==CV_32F);
+    //Where are (R G B A) in the source pixel.
+    int srcIndex[4] = {0, 0, 0, -1};
+    if (srcChannels != 1) {
+        int roles[4];
+        channelRoles(srcChannels, srcOrder, roles);
+        for (int i=0; i<srcChannels; ++i)
+            srcIndex[roles[i]] = i;
+    }
 
-    if (mat.empty())
-        return QImage();
+    if (dstChannels == 1) {
+        map[0] = srcIndex[CR_Red];
+        map[1] = srcIndex[CR_Green];
+        map[2] = srcIndex[CR_Blue];
+        return;
+    }
 
-    //Adjust mat channels if needed, and find proper QImage format.
-    QImage::Format format;
-    cv::Mat mat_adjustCn;
-    if (mat.channels() == 1) {
-        format = formatHint;
-        if (formatHint != QImage::Format_Indexed8
-        #if QT_VERSION >= 0x050500
-                && formatHint != QImage::Format_Alpha8
-                && formatHint != QImage::Format_Grayscale8
-        #endif
-                ) {
-            format = QImage::Format_Indexed8;
-        }
-    } else if (mat.channels() == 3) {
-#if QT_VERSION >= 0x040400
-        format = QImage::Format_RGB888;
-        if (order == MCO_BGR)
-            cv::cvtColor(mat, mat_adjustCn, CV_BGR2RGB);
-#else
-        format = QImage::Format_RGB32;
-        cv::Mat mat_tmp;
-        cv::cvtColor(mat, mat_tmp, order == MCO_BGR ? CV_BGR2BGRA : CV_RGB2BGRA);
-#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
-        mat_adjustCn = mat_tmp;
-#else
-        mat_adjustCn = argb2bgra(mat_tmp);
-#endif
+    int roles[4];
+    channelRoles(dstChannels, dstOrder, roles);
+    for (int i=0; i<dstChannels; ++i)
+        map[i] = srcIndex[roles[i]];
+}
 
-#endif
-    } else if (mat.channels() == 4) {
-        //Find best format if the formatHint can not be applied.
-        format = findClosestFormat(formatHint);
-        if (format != QImage::Format_RGB32
-                && format != QImage::Format_ARGB32
-                && format != QImage::Format_ARGB32_Premultiplied
-        #if QT_VERSION >= 0x050200
-                && format != QImage::Format_RGBX8888
-                && format != QImage::Format_RGBA8888
-                && format != QImage::Format_RGBA8888_Premultiplied
-        #endif
-                ) {
-#if QT_VERSION >= 0x050200
-            format = order == MCO_RGBA ? QImage::Format_RGBA8888 : QImage::Format_ARGB32;
-#else
-            format = QImage::Format_ARGB32;
-#endif
-        }
+bool isIdentityMap(const int *map, int channels)
+{
+    for (int i=0; i<channels; ++i) {
+        if (map[i] != i)
+            return false;
+    }
+    return true;
+}
 
-        //Channel order requried by the target QImage
-        MatColorOrder requiredOrder = getColorOrderOfRGB32Format();
-#if QT_VERSION >= 0x050200
-        if (formatHint == QImage::Format_RGBX8888
-                || formatHint == QImage::Format_RGBA8888
-                || formatHint == QImage::Format_RGBA8888_Premultiplied) {
-            requiredOrder = MCO_RGBA;
-        }
-#endif
+/* Value ranges used by QtOcv:
+ *   CV_8U [0, 255], CV_16U [0, 65535], CV_32F [0, 1.0]
+ *
+ * 255 * 257 == 65535, so 8 bits and 16 bits colors and alpha use the
+ * full range, just as QImage::Format_RGBA64 does.
+ */
+double depthUnit(int depth)
+{
+    return depth == CV_8U ? 1.0 : (depth == CV_16U ? 257.0 : 1/255.0);
+}
 
-        if (order != requiredOrder)
-            mat_adjustCn = adjustChannelsOrder(mat, order, requiredOrder);
-    }
+/* Value of an opaque alpha channel
+ */
+double opaqueAlpha(int depth)
+{
+    return depth == CV_8U ? 255.0 : (depth == CV_16U ? 65535.0 : 1.0);
+}
+
+double depthScale(int srcDepth, int dstDepth)
+{
+    return depthUnit(dstDepth) / depthUnit(srcDepth);
+}
 
-    if (mat_adjustCn.empty())
-        mat_adjustCn = mat;
+/* Vectorized part of the row kernels, return the number of pixels processed.
+ */
+template<typename ST, typename DT, int scn, int dcn>
+struct RowSimd
+{
+    static int run(const ST *, DT *, int, const int *, DT) { return 0; }
+};
 
-    //Adjust mat depth if needed.
-    cv::Mat mat_adjustDepth = mat_adjustCn;
-    if (mat.depth() != CV_8U)
-        mat_adjustCn.convertTo(mat_adjustDepth, CV_8UC(mat_adjustCn.channels()), mat.depth() == CV_16U ? 1/255.0 : 255.0);
+#if defined(CV_SIMD128) && CV_SIMD128
+/* Universal intrinsics vector of the channels of type T
+ */
+template<typename T> struct SimdVector;
+template<> struct SimdVector<uchar>
+{
+    typedef cv::v_uint8x16 type;
+    static type setall(uchar v) { return cv::v_setall_u8(v); }
+};
+template<> struct SimdVector<ushort>
+{
+    typedef cv::v_uint16x8 type;
+    static type setall(ushort v) { return cv::v_setall_u16(v); }
+};
+template<> struct SimdVector<float>
+{
+    typedef cv::v_float32x4 type;
+    static type setall(float v) { return cv::v_setall_f32(v); }
+};
 
-    //Should we convert the image to the format specified by formatHint?
-    QImage image = mat2Image_shared(mat_adjustDepth, format);
-    if (format == formatHint || formatHint == QImage::Format_Invalid)
-        return image.copy();
+/* Load / store the channels of a vector of pixels
+ */
+template<int cn, typename T, typename VT>
+inline void loadChannels(const T *src, VT *v)
+{
+    if (cn == 1)
+        v[0] = cv::v_load(src);
+    else if (cn == 3)
+        cv::v_load_deinterleave(src, v[0], v[1], v[2]);
     else
-        return image.convertToFormat(formatHint);
+        cv::v_load_deinterleave(src, v[0], v[1], v[2], v[3]);
 }
 
-/* Convert QImage to cv::Mat without data copy
- */
-cv::Mat image2Mat_shared(const QImage &img, MatColorOrder *order)
+template<int cn, typename T, typename VT>
+inline void storeChannels(T *dst, const VT *v)
 {
-    if (img.isNull())
-        return cv::Mat();
+    if (cn == 1)
+        cv::v_store(dst, v[0]);
+    else if (cn == 3)
+        cv::v_store_interleave(dst, v[0], v[1], v[2]);
+    else
+        cv::v_store_interleave(dst, v[0], v[1], v[2], v[3]);
+}
 
-    switch (img.format()) {
-    case QImage::Format_Indexed8:
-        break;
-#if QT_VERSION >= 0x040400
-    case QImage::Format_RGB888:
-        if (order)
-            *order = MCO_RGB;
-        break;
-#endif
-    case QImage::Format_RGB32:
-    case QImage::Format_ARGB32:
-    case QImage::Format_ARGB32_Premultiplied:
-        if (order)
-            *order = getColorOrderOfRGB32Format();
-        break;
-#if QT_VERSION >= 0x050200
-    case QImage::Format_RGBX8888:
-    case QImage::Format_RGBA8888:
-    case QImage::Format_RGBA8888_Premultiplied:
-        if (order)
-            *order = MCO_RGBA;
-        break;
-#endif
-#if QT_VERSION >= 0x050500
-    case QImage::Format_Alpha8:
-    case QImage::Format_Grayscale8:
-        break;
-#endif
-    default:
-        return cv::Mat();
+/* Reorder / expand / drop channels of the same depth, a vector of
+ * pixels is loaded before it is stored, so src and dst can be the same.
+ */
+template<typename T, int scn, int dcn>
+struct ChannelsSimd
+{
+    static int run(const T *src, T *dst, int width, const int *map, T alpha)
+    {
+        typedef typename SimdVector<T>::type VT;
+        const int lanes = VT::nlanes;
+        const VT va = SimdVector<T>::setall(alpha);
+        VT s[4], d[4];
+        int x = 0;
+        for (; x <= width - lanes; x += lanes, src += lanes*scn, dst += lanes*dcn) {
+            loadChannels<scn>(src, s);
+            for (int c=0; c<dcn; ++c)
+                d[c] = map[c] < 0 ? va : s[map[c]];
+            storeChannels<dcn>(dst, d);
+        }
+        return x;
     }
-    return cv::Mat(img.height(), img.width(), CV_8UC(img.depth()/8), (uchar*)img.bits(), img.bytesPerLine());
-}
+};
 
-/* Convert  cv::Mat to QImage without data copy
+template<int scn, int dcn>
+struct RowSimd<uchar, uchar, scn, dcn> : ChannelsSimd<uchar, scn, dcn> {};
+template<int scn, int dcn>
+struct RowSimd<ushort, ushort, scn, dcn> : ChannelsSimd<ushort, scn, dcn> {};
+template<int scn, int dcn>
+struct RowSimd<float, float, scn, dcn> : ChannelsSimd<float, scn, dcn> {};
+
+/* Vectors of T to / from float vectors, rounded and saturated as
+ * cv::saturate_cast() does.
  */
-QImage mat2Image_shared(const cv::Mat &mat, QImage::Format formatHint)
+template<typename T> struct SimdFloat;
+template<> struct SimdFloat<uchar>
 {
-    Q_ASSERT(mat.type() == CV_8UC1 || mat.type() == CV_8UC3 || mat.type() == CV_8UC4);
+    enum { floats = 4 };
 
-    if (mat.empty())
-        return QImage();
+    static void expand(const cv::v_uint8x16 &v, cv::v_float32x4 *f)
+    {
+        cv::v_uint16x8 h[2];
+        cv::v_expand(v, h[0], h[1]);
+        for (int i=0; i<2; ++i) {
+            cv::v_uint32x4 q0, q1;
+            cv::v_expand(h[i], q0, q1);
+            f[2*i] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(q0));
+            f[2*i+1] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(q1));
+        }
+    }
 
-    //Adjust formatHint if needed.
-    if (mat.type() == CV_8UC1) {
-        if (formatHint != QImage::Format_Indexed8
-        #if QT_VERSION >= 0x050500
-                && formatHint != QImage::Format_Alpha8
-                && formatHint != QImage::Format_Grayscale8
-        #endif
-                ) {
-            formatHint = QImage::Format_Indexed8;
+    static cv::v_uint8x16 pack(const cv::v_float32x4 *f)
+    {
+        return cv::v_pack_u(cv::v_pack(cv::v_round(f[0]), cv::v_round(f[1])),
+                            cv::v_pack(cv::v_round(f[2]), cv::v_round(f[3])));
+    }
+};
+template<> struct SimdFloat<ushort>
+{
+    enum { floats = 2 };
+
+    static void expand(const cv::v_uint16x8 &v, cv::v_float32x4 *f)
+    {
+        cv::v_uint32x4 q0, q1;
+        cv::v_expand(v, q0, q1);
+        f[0] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(q0));
+        f[1] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(q1));
+    }
+
+    static cv::v_uint16x8 pack(const cv::v_float32x4 *f)
+    {
+        return cv::v_pack_u(cv::v_round(f[0]), cv::v_round(f[1]));
+    }
+};
+template<> struct SimdFloat<float>
+{
+    enum { floats = 1 };
+
+    static void expand(const cv::v_float32x4 &v, cv::v_float32x4 *f) { f[0] = v; }
+    static cv::v_float32x4 pack(const cv::v_float32x4 *f) { return f[0]; }
+};
+
+/* Block of pixels converted through float vectors, which fills whole
+ * vectors of both ST and DT, f[channel][vector] holds the channels.
+ */
+template<typename ST, typename DT>
+struct FloatBlock
+{
+    typedef typename SimdVector<ST>::type SVT;
+    typedef typename SimdVector<DT>::type DVT;
+    enum {
+        srcFloats = SimdFloat<ST>::floats,
+        dstFloats = SimdFloat<DT>::floats,
+        floats = int(srcFloats) > int(dstFloats) ? int(srcFloats) : int(dstFloats),
+        pixels = floats * 4
+    };
+
+    template<int cn>
+    void load(const ST *src)
+    {
+        SVT v[4];
+        for (int i=0; i<floats/srcFloats; ++i, src += SVT::nlanes*cn) {
+            loadChannels<cn>(src, v);
+            for (int c=0; c<cn; ++c)
+                SimdFloat<ST>::expand(v[c], &f[c][i*srcFloats]);
         }
-#if QT_VERSION >= 0x040400
-    } else if (mat.type() == CV_8UC3) {
-        formatHint = QImage::Format_RGB888;
-#endif
-    } else if (mat.type() == CV_8UC4) {
-        if (formatHint != QImage::Format_RGB32
-                && formatHint != QImage::Format_ARGB32
-                && formatHint != QImage::Format_ARGB32_Premultiplied
-        #if QT_VERSION >= 0x050200
-                && formatHint != QImage::Format_RGBX8888
-                && formatHint != QImage::Format_RGBA8888
-                && formatHint != QImage::Format_RGBA8888_Premultiplied
-        #endif
-                ) {
-            formatHint = QImage::Format_ARGB32;
+    }
+
+    cv::v_float32x4 f[4][floats];
+};
+
+/* (x*scale) of any depths
+ */
+template<typename ST, typename DT, int scn, int dcn>
+struct FloatScaleSimd
+{
+    static int run(const ST *src, DT *dst, int width, const int *map, DT alpha, float scale)
+    {
+        typedef FloatBlock<ST, DT> Block;
+        typedef typename Block::DVT DVT;
+        const int pixels = Block::pixels;
+        const cv::v_float32x4 vs = cv::v_setall_f32(scale);
+        const DVT va = SimdVector<DT>::setall(alpha);
+        Block block;
+        DVT d[4];
+        int x = 0;
+        for (; x <= width - pixels; x += pixels, src += pixels*scn) {
+            block.template load<scn>(src);
+            for (int c=0; c<scn; ++c) {
+                for (int i=0; i<Block::floats; ++i)
+                    block.f[c][i] = block.f[c][i] * vs;
+            }
+            for (int i=0; i<Block::floats/Block::dstFloats; ++i, dst += DVT::nlanes*dcn) {
+                for (int c=0; c<dcn; ++c)
+                    d[c] = map[c] < 0 ? va : SimdFloat<DT>::pack(&block.f[map[c]][i*Block::dstFloats]);
+                storeChannels<dcn>(dst, d);
+            }
         }
+        return x;
+    }
+};
+
+/* Vectorized part of the row kernels which scale the values
+ */
+template<typename ST, typename DT, int scn, int dcn>
+struct ScaleSimd
+{
+    static int run(const ST *src, DT *dst, int width, const int *map, DT alpha, double scale)
+    {
+        return FloatScaleSimd<ST, DT, scn, dcn>::run(src, dst, width, map, alpha, static_cast<float>(scale));
     }
+};
 
-    QImage img(mat.data, mat.cols, mat.rows, mat.step, formatHint);
+/* 8 bits ==> 16 bits, 255 * 257 == 65535 so the byte is repeated.
+ */
+template<int scn, int dcn>
+struct ScaleSimd<uchar, ushort, scn, dcn>
+{
+    static int run(const uchar *src, ushort *dst, int width, const int *map, ushort alpha, double scale)
+    {
+        if (scale != 257.0)
+            return FloatScaleSimd<uchar, ushort, scn, dcn>::run(src, dst, width, map, alpha, static_cast<float>(scale));
 
-    //Should we add directly support for user-customed-colorTable?
-    if (formatHint == QImage::Format_Indexed8) {
-        QVector<QRgb> colorTable;
-        for (int i=0; i<256; ++i)
-            colorTable.append(qRgb(i,i,i));
-        img.setColorTable(colorTable);
+        const int lanes = cv::v_uint8x16::nlanes;
+        const cv::v_uint16x8 va = cv::v_setall_u16(alpha);
+        cv::v_uint8x16 s[4];
+        cv::v_uint16x8 d0[4], d1[4];
+        int x = 0;
+        for (; x <= width - lanes; x += lanes, src += lanes*scn, dst += lanes*dcn) {
+            loadChannels<scn>(src, s);
+            for (int c=0; c<dcn; ++c) {
+                if (map[c] < 0) {
+                    d0[c] = d1[c] = va;
+                } else {
+                    cv::v_expand(s[map[c]], d0[c], d1[c]);
+                    d0[c] = (d0[c] << 8) | d0[c];
+                    d1[c] = (d1[c] << 8) | d1[c];
+                }
+            }
+            storeChannels<dcn>(dst, d0);
+            storeChannels<dcn>(dst + lanes/2*dcn, d1);
+        }
+        return x;
     }
-    return img;
+};
+
+/* 16 bits ==> 8 bits, (x + 128) / 257 is the rounded x / 257, and is
+ * (t - (t >> 8)) >> 8 with t = x + 128, saturated at 65535.
+ */
+template<int scn, int dcn>
+struct ScaleSimd<ushort, uchar, scn, dcn>
+{
+    static cv::v_uint16x8 divide(const cv::v_uint16x8 &v)
+    {
+        const cv::v_uint16x8 t = v + cv::v_setall_u16(128);
+        return (t - (t >> 8)) >> 8;
+    }
+
+    static int run(const ushort *src, uchar *dst, int width, const int *map, uchar alpha, double scale)
+    {
+        if (scale != 1/257.0)
+            return FloatScaleSimd<ushort, uchar, scn, dcn>::run(src, dst, width, map, alpha, static_cast<float>(scale));
+
+        const int lanes = cv::v_uint8x16::nlanes;
+        const cv::v_uint8x16 va = cv::v_setall_u8(alpha);
+        cv::v_uint16x8 s0[4], s1[4];
+        cv::v_uint8x16 d[4];
+        int x = 0;
+        for (; x <= width - lanes; x += lanes, src += lanes*scn, dst += lanes*dcn) {
+            loadChannels<scn>(src, s0);
+            loadChannels<scn>(src + lanes/2*scn, s1);
+            for (int c=0; c<dcn; ++c)
+                d[c] = map[c] < 0 ? va : cv::v_pack(divide(s0[map[c]]), divide(s1[map[c]]));
+            storeChannels<dcn>(dst, d);
+        }
+        return x;
+    }
+};
+
+/* Vectorized part of the gray row kernels, in the order of convertRowToGray()
+ */
+template<typename ST, typename DT, int scn>
+struct GraySimd
+{
+    static int run(const ST *src, DT *dst, int width, const int *map, float wr, float wg, float wb)
+    {
+        typedef FloatBlock<ST, DT> Block;
+        const int pixels = Block::pixels;
+        const cv::v_float32x4 vr = cv::v_setall_f32(wr);
+        const cv::v_float32x4 vg = cv::v_setall_f32(wg);
+        const cv::v_float32x4 vb = cv::v_setall_f32(wb);
+        const int r = map[0], g = map[1], b = map[2];
+        Block block;
+        cv::v_float32x4 gray[Block::floats];
+        int x = 0;
+        for (; x <= width - pixels; x += pixels, src += pixels*scn) {
+            block.template load<scn>(src);
+            for (int i=0; i<Block::floats; ++i)
+                gray[i] = block.f[r][i] * vr + block.f[g][i] * vg + block.f[b][i] * vb;
+            for (int i=0; i<Block::floats/Block::dstFloats; ++i, dst += Block::DVT::nlanes)
+                cv::v_store(dst, SimdFloat<DT>::pack(&gray[i*Block::dstFloats]));
+        }
+        return x;
+    }
+};
+#else
+template<typename ST, typename DT, int scn, int dcn>
+struct ScaleSimd
+{
+    static int run(const ST *, DT *, int, const int *, DT, double) { return 0; }
+};
+
+template<typename ST, typename DT, int scn>
+struct GraySimd
+{
+    static int run(const ST *, DT *, int, const int *, float, float, float) { return 0; }
+};
+#endif
+
+/* Kernels of detail::reorderChannelsSimd(), which is used by the
+ * row converters of the header.
+ */
+typedef int (*ReorderSimdKernel)(const void *src, void *dst, int width, const int *map);
+
+template<typename T, int scn, int dcn>
+int reorderChannels(const void *src, void *dst, int width, const int *map)
+{
+    return RowSimd<T, T, scn, dcn>::run(static_cast<const T *>(src), static_cast<T *>(dst), width, map,
+                                        detail::DepthTraits<T>::opaque());
+}
+
+#define QTOCV_REORDER_SIMD_KERNELS(T) \
+    { { &reorderChannels<T, 1, 1>, &reorderChannels<T, 1, 3>, &reorderChannels<T, 1, 4> }, \
+      { &reorderChannels<T, 3, 1>, &reorderChannels<T, 3, 3>, &reorderChannels<T, 3, 4> }, \
+      { &reorderChannels<T, 4, 1>, &reorderChannels<T, 4, 3>, &reorderChannels<T, 4, 4> } }
+
+/* Kernel table, indexed by [depth: CV_8U, CV_16U, CV_32F][srcChannels][dstChannels]
+ */
+const ReorderSimdKernel reorderSimdKernels[3][3][3] = {
+    QTOCV_REORDER_SIMD_KERNELS(uchar),
+    QTOCV_REORDER_SIMD_KERNELS(ushort),
+    QTOCV_REORDER_SIMD_KERNELS(float)
+};
+
+#undef QTOCV_REORDER_SIMD_KERNELS
+
+/* Reorder / expand / drop channels, and convert depth in one pass.
+ */
+template<typename ST, typename DT, int scn, int dcn>
+void convertRow(const uchar *srcRow, uchar *dstRow, int width, const int *map, double scale, double alpha)
+{
+    const ST *src = reinterpret_cast<const ST *>(srcRow);
+    DT *dst = reinterpret_cast<DT *>(dstRow);
+    const DT a = cv::saturate_cast<DT>(alpha);
+    const float s = static_cast<float>(scale);
+    int m[dcn];
+    for (int c=0; c<dcn; ++c)
+        m[c] = map[c];
+
+    int x = 0;
+    if (scale == 1.0) {
+        x = RowSimd<ST, DT, scn, dcn>::run(src, dst, width, m, a);
+        src += x*scn;
+        dst += x*dcn;
+        for (; x<width; ++x, src += scn, dst += dcn) {
+            for (int c=0; c<dcn; ++c)
+                dst[c] = m[c] < 0 ? a : cv::saturate_cast<DT>(src[m[c]]);
+        }
+    } else {
+        x = ScaleSimd<ST, DT, scn, dcn>::run(src, dst, width, m, a, scale);
+        src += x*scn;
+        dst += x*dcn;
+        for (; x<width; ++x, src += scn, dst += dcn) {
+            for (int c=0; c<dcn; ++c)
+                dst[c] = m[c] < 0 ? a : cv::saturate_cast<DT>(src[m[c]] * s);
+        }
+    }
+}
+
+/* Weighted (R G B) ==> Gray, and convert depth in one pass.
+ */
+template<typename ST, typename DT, int scn>
+void convertRowToGray(const uchar *srcRow, uchar *dstRow, int width, const int *map, double scale, double)
+{
+    const ST *src = reinterpret_cast<const ST *>(srcRow);
+    DT *dst = reinterpret_cast<DT *>(dstRow);
+    const float wr = static_cast<float>(0.299 * scale);
+    const float wg = static_cast<float>(0.587 * scale);
+    const float wb = static_cast<float>(0.114 * scale);
+    const int r = map[0], g = map[1], b = map[2];
+    int x = GraySimd<ST, DT, scn>::run(src, dst, width, map, wr, wg, wb);
+    src += x*scn;
+    for (; x<width; ++x, src += scn)
+        dst[x] = cv::saturate_cast<DT>(src[r]*wr + src[g]*wg + src[b]*wb);
+}
+
+#define QTOCV_ROW_KERNELS(level, ST, DT) \
+    { { &LevelKernel<level>::run<&convertRow<ST, DT, 1, 1> >, \
+        &LevelKernel<level>::run<&convertRow<ST, DT, 1, 3> >, \
+        &LevelKernel<level>::run<&convertRow<ST, DT, 1, 4> > }, \
+      { &LevelKernel<level>::run<&convertRowToGray<ST, DT, 3> >, \
+        &LevelKernel<level>::run<&convertRow<ST, DT, 3, 3> >, \
+        &LevelKernel<level>::run<&convertRow<ST, DT, 3, 4> > }, \
+      { &LevelKernel<level>::run<&convertRowToGray<ST, DT, 4> >, \
+        &LevelKernel<level>::run<&convertRow<ST, DT, 4, 3> >, \
+        &LevelKernel<level>::run<&convertRow<ST, DT, 4, 4> > } }
+#define QTOCV_LEVEL_ROW_KERNELS(level) \
+    { { QTOCV_ROW_KERNELS(level, uchar, uchar), QTOCV_ROW_KERNELS(level, uchar, ushort), QTOCV_ROW_KERNELS(level, uchar, float) }, \
+      { QTOCV_ROW_KERNELS(level, ushort, uchar), QTOCV_ROW_KERNELS(level, ushort, ushort), QTOCV_ROW_KERNELS(level, ushort, float) }, \
+      { QTOCV_ROW_KERNELS(level, float, uchar), QTOCV_ROW_KERNELS(level, float, ushort), QTOCV_ROW_KERNELS(level, float, float) } }
+
+/* Kernel table, indexed by [CPU level][srcDepth][dstDepth][srcChannels][dstChannels]
+ */
+const RowKernel rowKernels[CPU_NEON + 1][3][3][3][3] = {
+    QTOCV_LEVEL_ROW_KERNELS(CPU_Baseline),
+    QTOCV_LEVEL_ROW_KERNELS(CPU_SSSE3),
+    QTOCV_LEVEL_ROW_KERNELS(CPU_AVX2),
+    QTOCV_LEVEL_ROW_KERNELS(CPU_NEON)
+};
+
+#undef QTOCV_LEVEL_ROW_KERNELS
+#undef QTOCV_ROW_KERNELS
+
+/* 8 bits kernels with the channels orders resolved at compile time
+ */
+template<int scn, int srcOrder, int dcn, int dstOrder>
+void convertFixedRow(const uchar *src, uchar *dst, int width, const int *, double, double)
+{
+    detail::RowConverter<uchar, uchar, scn, srcOrder, dcn, dstOrder>::run(src, dst, width);
+}
+
+#define QTOCV_FIXED_ROW_KERNELS(scn, srcOrder, dcn) \
+    { &convertFixedRow<scn, srcOrder, dcn, MCO_BGR>, \
+      &convertFixedRow<scn, srcOrder, dcn, MCO_RGB>, \
+      &convertFixedRow<scn, srcOrder, dcn, MCO_ARGB> }
+#define QTOCV_FIXED_ROW_KERNELS_OF(scn, srcOrder) \
+    { QTOCV_FIXED_ROW_KERNELS(scn, srcOrder, 1), \
+      QTOCV_FIXED_ROW_KERNELS(scn, srcOrder, 3), \
+      QTOCV_FIXED_ROW_KERNELS(scn, srcOrder, 4) }
+#define QTOCV_FIXED_ROW_KERNELS_FROM(scn) \
+    { QTOCV_FIXED_ROW_KERNELS_OF(scn, MCO_BGR), \
+      QTOCV_FIXED_ROW_KERNELS_OF(scn, MCO_RGB), \
+      QTOCV_FIXED_ROW_KERNELS_OF(scn, MCO_ARGB) }
+
+/* Kernel table, indexed by [srcChannels][srcOrder][dstChannels][dstOrder]
+ */
+Q_DECL_CONSTEXPR const RowKernel fixedRowKernels[3][3][3][3] = {
+    QTOCV_FIXED_ROW_KERNELS_FROM(1), QTOCV_FIXED_ROW_KERNELS_FROM(3), QTOCV_FIXED_ROW_KERNELS_FROM(4)
+};
+
+#undef QTOCV_FIXED_ROW_KERNELS_FROM
+#undef QTOCV_FIXED_ROW_KERNELS_OF
+#undef QTOCV_FIXED_ROW_KERNELS
+
+/* Multiply or divide the 8 bits colors by alpha, rounded to nearest.
+ */
+inline uchar premultiplyChannel(int v, int a)
+{
+    const int t = v * a + 128;
+    return uchar((t + (t >> 8)) >> 8);
+}
+
+inline uchar unpremultiplyChannel(int v, int a)
+{
+    return a == 0 ? 0 : cv::saturate_cast<uchar>(v * (255.0f / a));
+}
+
+#if defined(CV_SIMD128) && CV_SIMD128
+/* Vectorized colors of 16 pixels multiplied or divided by their alpha,
+ * the same as premultiplyChannel() and unpremultiplyChannel().
+ */
+template<bool premultiply>
+struct AlphaChannels
+{
+    explicit AlphaChannels(const cv::v_uint8x16 &a)
+    {
+        cv::v_expand(a, a0, a1);
+    }
+
+    cv::v_uint8x16 apply(const cv::v_uint8x16 &v) const
+    {
+        const cv::v_uint16x8 half = cv::v_setall_u16(128);
+        cv::v_uint16x8 v0, v1;
+        cv::v_expand(v, v0, v1);
+        v0 = v0 * a0 + half;
+        v1 = v1 * a1 + half;
+        return cv::v_pack((v0 + (v0 >> 8)) >> 8, (v1 + (v1 >> 8)) >> 8);
+    }
+
+    cv::v_uint16x8 a0, a1;
+};
+
+template<>
+struct AlphaChannels<false>
+{
+    explicit AlphaChannels(const cv::v_uint8x16 &a)
+    {
+        const cv::v_float32x4 zero = cv::v_setall_f32(0.0f);
+        const cv::v_float32x4 full = cv::v_setall_f32(255.0f);
+        SimdFloat<uchar>::expand(a, factors);
+        for (int i=0; i<4; ++i)
+            factors[i] = cv::v_select(factors[i] == zero, zero, full / factors[i]);
+    }
+
+    cv::v_uint8x16 apply(const cv::v_uint8x16 &v) const
+    {
+        cv::v_float32x4 f[4];
+        SimdFloat<uchar>::expand(v, f);
+        cv::v_int32x4 r[4];
+        for (int i=0; i<4; ++i)
+            r[i] = cv::v_round(f[i] * factors[i]);
+        return cv::v_pack_u(cv::v_pack(r[0], r[1]), cv::v_pack(r[2], r[3]));
+    }
+
+    cv::v_float32x4 factors[4];
+};
+
+template<int srcAlpha, int dcn, bool premultiply>
+struct AlphaSimd
+{
+    static int run(const uchar *src, uchar *dst, int width, const int *map)
+    {
+        const int lanes = cv::v_uint8x16::nlanes;
+        cv::v_uint8x16 s[4], d[4];
+        int x = 0;
+        for (; x <= width - lanes; x += lanes, src += lanes*4, dst += lanes*dcn) {
+            cv::v_load_deinterleave(src, s[0], s[1], s[2], s[3]);
+            const AlphaChannels<premultiply> alpha(s[srcAlpha]);
+            for (int c=0; c<dcn; ++c)
+                d[c] = map[c] == srcAlpha ? s[srcAlpha] : alpha.apply(s[map[c]]);
+
+            if (dcn == 3)
+                cv::v_store_interleave(dst, d[0], d[1], d[2]);
+            else
+                cv::v_store_interleave(dst, d[0], d[1], d[2], d[3]);
+        }
+        return x;
+    }
+};
+#else
+template<int srcAlpha, int dcn, bool premultiply>
+struct AlphaSimd
+{
+    static int run(const uchar *, uchar *, int, const int *) { return 0; }
+};
+#endif
+
+/* Premultiply or unpremultiply the colors of 8 bits pixels with alpha,
+ * and reorder / drop channels in the same pass. srcAlpha is the index
+ * of the alpha channel in the source pixel.
+ */
+template<int srcAlpha, int dcn, bool premultiply>
+void alphaRow(const uchar *src, uchar *dst, int width, const int *map, double, double)
+{
+    int m[dcn];
+    for (int c=0; c<dcn; ++c)
+        m[c] = map[c];
+
+    const int x = AlphaSimd<srcAlpha, dcn, premultiply>::run(src, dst, width, m);
+    src += x*4;
+    dst += x*dcn;
+    for (int i=x; i<width; ++i, src += 4, dst += dcn) {
+        const int a = src[srcAlpha];
+        for (int c=0; c<dcn; ++c) {
+            if (m[c] == srcAlpha)
+                dst[c] = uchar(a);
+            else
+                dst[c] = premultiply ? premultiplyChannel(src[m[c]], a) : unpremultiplyChannel(src[m[c]], a);
+        }
+    }
+}
+
+#define QTOCV_ALPHA_ROW_KERNELS(level, premultiply) \
+    { { &LevelKernel<level>::run<&alphaRow<3, 3, premultiply> >, &LevelKernel<level>::run<&alphaRow<3, 4, premultiply> > }, \
+      { &LevelKernel<level>::run<&alphaRow<0, 3, premultiply> >, &LevelKernel<level>::run<&alphaRow<0, 4, premultiply> > } }
+#define QTOCV_LEVEL_ALPHA_ROW_KERNELS(level) \
+    { QTOCV_ALPHA_ROW_KERNELS(level, true), QTOCV_ALPHA_ROW_KERNELS(level, false) }
+
+/* Kernel table, indexed by [CPU level][unpremultiply][alpha first: MCO_ARGB][dstChannels: 3, 4]
+ */
+const RowKernel alphaRowKernels[CPU_NEON + 1][2][2][2] = {
+    QTOCV_LEVEL_ALPHA_ROW_KERNELS(CPU_Baseline),
+    QTOCV_LEVEL_ALPHA_ROW_KERNELS(CPU_SSSE3),
+    QTOCV_LEVEL_ALPHA_ROW_KERNELS(CPU_AVX2),
+    QTOCV_LEVEL_ALPHA_ROW_KERNELS(CPU_NEON)
+};
+
+#undef QTOCV_LEVEL_ALPHA_ROW_KERNELS
+#undef QTOCV_ALPHA_ROW_KERNELS
+
+int depthIndex(int depth)
+{
+    switch (depth) {
+    case CV_8U:
+        return 0;
+    case CV_16U:
+        return 1;
+    case CV_32F:
+        return 2;
+    default:
+        return -1;
+    }
+}
+
+int channelsIndex(int channels)
+{
+    switch (channels) {
+    case 1:
+        return 0;
+    case 3:
+        return 1;
+    case 4:
+        return 2;
+    default:
+        return -1;
+    }
+}
+
+RowKernel findRowKernel(int srcType, int dstType, int level)
+{
+    const int sd = depthIndex(CV_MAT_DEPTH(srcType));
+    const int dd = depthIndex(CV_MAT_DEPTH(dstType));
+    const int sc = channelsIndex(CV_MAT_CN(srcType));
+    const int dc = channelsIndex(CV_MAT_CN(dstType));
+    if (sd < 0 || dd < 0 || sc < 0 || dc < 0)
+        return 0;
+    return rowKernels[level][sd][dd][sc][dc];
+}
+
+/* Channel of the packed 16 bits pixels, expanded to 8 bits
+ */
+template<int shift, int width>
+struct PackedChannel
+{
+    static uchar unpack(quint16 p)
+    {
+        const int v = (p >> shift) & ((1 << width) - 1);
+        return uchar((v << (8 - width)) | (v >> (2*width - 8)));
+    }
+#if defined(CV_SIMD128) && CV_SIMD128
+    static cv::v_uint16x8 unpack(const cv::v_uint16x8 &p)
+    {
+        const cv::v_uint16x8 v = cv::v_shr<shift>(p) & cv::v_setall_u16((1 << width) - 1);
+        return cv::v_shl<8 - width>(v) | cv::v_shr<2*width - 8>(v);
+    }
+#endif
+};
+
+template<int shift>
+struct PackedChannel<shift, 0>
+{
+    static uchar unpack(quint16) { return 255; }
+#if defined(CV_SIMD128) && CV_SIMD128
+    static cv::v_uint16x8 unpack(const cv::v_uint16x8 &) { return cv::v_setall_u16(255); }
+#endif
+};
+
+/* Layout of the packed 16 bits formats, unpacked to (R G B) or (R G B A)
+ */
+template<int rs, int rw, int gs, int gw, int bs, int bw, int as, int aw>
+struct PackedLayout
+{
+    enum { channels = aw ? 4 : 3 };
+
+    static void unpack(quint16 p, uchar *rgba)
+    {
+        rgba[0] = PackedChannel<rs, rw>::unpack(p);
+        rgba[1] = PackedChannel<gs, gw>::unpack(p);
+        rgba[2] = PackedChannel<bs, bw>::unpack(p);
+        rgba[3] = PackedChannel<as, aw>::unpack(p);
+    }
+#if defined(CV_SIMD128) && CV_SIMD128
+    static void unpack(const cv::v_uint16x8 &p, cv::v_uint16x8 *rgba)
+    {
+        rgba[0] = PackedChannel<rs, rw>::unpack(p);
+        rgba[1] = PackedChannel<gs, gw>::unpack(p);
+        rgba[2] = PackedChannel<bs, bw>::unpack(p);
+        rgba[3] = PackedChannel<as, aw>::unpack(p);
+    }
+#endif
+};
+
+typedef PackedLayout<11, 5, 5, 6, 0, 5, 0, 0> PackedRGB16;
+typedef PackedLayout<10, 5, 5, 5, 0, 5, 0, 0> PackedRGB555;
+typedef PackedLayout<8, 4, 4, 4, 0, 4, 0, 0> PackedRGB444;
+typedef PackedLayout<8, 4, 4, 4, 0, 4, 12, 4> PackedARGB4444;
+
+/* Vectorized part of the packed kernels, return the number of pixels processed.
+ */
+template<typename Layout, typename DT, int dcn>
+struct PackedSimd
+{
+    static int run(const quint16 *, DT *, int, const int *, DT) { return 0; }
+};
+
+#if defined(CV_SIMD128) && CV_SIMD128
+template<typename Layout, int dcn>
+struct PackedSimd<Layout, uchar, dcn>
+{
+    static int run(const quint16 *src, uchar *dst, int width, const int *map, uchar alpha)
+    {
+        if (dcn == 1)
+            return 0;
+
+        const int lanes = cv::v_uint8x16::nlanes;
+        const cv::v_uint8x16 va = cv::v_setall_u8(alpha);
+        cv::v_uint16x8 lo[4], hi[4];
+        cv::v_uint8x16 s[4], d[4];
+        int x = 0;
+        for (; x <= width - lanes; x += lanes, src += lanes, dst += lanes*dcn) {
+            Layout::unpack(cv::v_load(src), lo);
+            Layout::unpack(cv::v_load(src + lanes/2), hi);
+            for (int c=0; c<Layout::channels; ++c)
+                s[c] = cv::v_pack(lo[c], hi[c]);
+
+            for (int c=0; c<dcn; ++c)
+                d[c] = map[c] < 0 ? va : s[map[c]];
+
+            if (dcn == 3)
+                cv::v_store_interleave(dst, d[0], d[1], d[2]);
+            else
+                cv::v_store_interleave(dst, d[0], d[1], d[2], d[3]);
+        }
+        return x;
+    }
+};
+#endif
+
+/* Unpack a row of packed 16 bits pixels, and convert them to
+ * the target depth and channels order in one pass.
+ */
+template<typename Layout, typename DT, int dcn>
+void convertPackedRow(const uchar *srcRow, uchar *dstRow, int width, const int *map, double scale, double alpha)
+{
+    const quint16 *src = reinterpret_cast<const quint16 *>(srcRow);
+    DT *dst = reinterpret_cast<DT *>(dstRow);
+    const DT a = cv::saturate_cast<DT>(alpha);
+    const float s = static_cast<float>(scale);
+    uchar rgba[4];
+
+    int x = PackedSimd<Layout, DT, dcn>::run(src, dst, width, map, a);
+    src += x;
+    dst += x*dcn;
+    for (; x<width; ++x, ++src, dst += dcn) {
+        Layout::unpack(*src, rgba);
+        if (dcn == 1) {
+            dst[0] = cv::saturate_cast<DT>((rgba[map[0]]*0.299f + rgba[map[1]]*0.587f + rgba[map[2]]*0.114f) * s);
+        } else {
+            for (int c=0; c<dcn; ++c)
+                dst[c] = map[c] < 0 ? a : cv::saturate_cast<DT>(rgba[map[c]] * s);
+        }
+    }
+}
+
+#define QTOCV_PACKED_ROW_KERNELS(Layout, DT) \
+    { &convertPackedRow<Layout, DT, 1>, &convertPackedRow<Layout, DT, 3>, &convertPackedRow<Layout, DT, 4> }
+#define QTOCV_PACKED_FORMAT_KERNELS(Layout) \
+    { QTOCV_PACKED_ROW_KERNELS(Layout, uchar), \
+      QTOCV_PACKED_ROW_KERNELS(Layout, ushort), \
+      QTOCV_PACKED_ROW_KERNELS(Layout, float) }
+
+/* Kernel table, indexed by [packedFormat][dstDepth][dstChannels]
+ */
+const RowKernel packedRowKernels[4][3][3] = {
+    QTOCV_PACKED_FORMAT_KERNELS(PackedRGB16),
+    QTOCV_PACKED_FORMAT_KERNELS(PackedRGB555),
+    QTOCV_PACKED_FORMAT_KERNELS(PackedRGB444),
+    QTOCV_PACKED_FORMAT_KERNELS(PackedARGB4444)
+};
+
+#undef QTOCV_PACKED_FORMAT_KERNELS
+#undef QTOCV_PACKED_ROW_KERNELS
+
+/* Index of the packed 16 bits format in packedRowKernels, and the
+ * number of channels it is unpacked to.
+ */
+int packedFormatIndex(QImage::Format format, int *channels)
+{
+    *channels = 3;
+    switch (format) {
+    case QImage::Format_RGB16:
+        return 0;
+#if QT_VERSION >= 0x040400
+    case QImage::Format_RGB555:
+        return 1;
+    case QImage::Format_RGB444:
+        return 2;
+    case QImage::Format_ARGB4444_Premultiplied:
+        *channels = 4;
+        return 3;
+#endif
+    default:
+        return -1;
+    }
+}
+
+/* Row kernels of the 1 bit and indexed formats
+ *
+ * colors holds the 8 bits target pixels of the color indices,
+ * it is not used by the kernels which pack pixels.
+ */
+typedef void (*TableRowKernel)(const uchar *src, uchar *dst, int width, const uchar *colors);
+
+/* Masks of the 8 pixels of a byte of the 1 bit formats, and
+ * the bits reversed bytes used to pack the pixels of Format_Mono.
+ */
+struct BitTables
+{
+    uchar msbMasks[256][8];
+    uchar lsbMasks[256][8];
+    uchar reversed[256];
+
+    BitTables()
+    {
+        for (int v=0; v<256; ++v) {
+            reversed[v] = 0;
+            for (int i=0; i<8; ++i) {
+                const bool set = (v >> i) & 1;
+                lsbMasks[v][i] = set ? 0xff : 0;
+                msbMasks[v][7-i] = set ? 0xff : 0;
+                if (set)
+                    reversed[v] |= 0x80 >> i;
+            }
+        }
+    }
+};
+
+const BitTables bitTables;
+
+/* Expand a row of 1 bit pixels, colors holds the dcn channels
+ * of the pixels of bit 0 and bit 1.
+ */
+template<int dcn, bool lsb>
+void expandBitsRow(const uchar *src, uchar *dst, int width, const uchar *colors)
+{
+    const uchar (*masks)[8] = lsb ? bitTables.lsbMasks : bitTables.msbMasks;
+    int x = 0;
+#if defined(CV_SIMD128) && CV_SIMD128
+    cv::v_uint8x16 c0[4], c1[4];
+    for (int c=0; c<dcn; ++c) {
+        c0[c] = cv::v_setall_u8(colors[c]);
+        c1[c] = cv::v_setall_u8(colors[dcn + c]);
+    }
+    for (; x <= width - 16; x += 16, dst += 16*dcn) {
+        const cv::v_uint8x16 mask = cv::v_load_halves(masks[src[x >> 3]], masks[src[(x >> 3) + 1]]);
+        if (dcn == 1) {
+            cv::v_store(dst, cv::v_select(mask, c1[0], c0[0]));
+        } else if (dcn == 3) {
+            cv::v_store_interleave(dst, cv::v_select(mask, c1[0], c0[0]), cv::v_select(mask, c1[1], c0[1]),
+                                   cv::v_select(mask, c1[2], c0[2]));
+        } else {
+            cv::v_store_interleave(dst, cv::v_select(mask, c1[0], c0[0]), cv::v_select(mask, c1[1], c0[1]),
+                                   cv::v_select(mask, c1[2], c0[2]), cv::v_select(mask, c1[3], c0[3]));
+        }
+    }
+#endif
+    for (; x<width; ++x, dst += dcn) {
+        const uchar *color = masks[src[x >> 3]][x & 7] ? colors + dcn : colors;
+        for (int c=0; c<dcn; ++c)
+            dst[c] = color[c];
+    }
+}
+
+/* Pack a row of 8 bits gray pixels to 1 bit pixels,
+ * the pixels of 128 or more are set.
+ */
+template<bool lsb>
+void packBitsRow(const uchar *src, uchar *dst, int width, const uchar *)
+{
+    int x = 0;
+#if defined(CV_SIMD128) && CV_SIMD128
+    for (; x <= width - 16; x += 16, dst += 2) {
+        const int bits = cv::v_signmask(cv::v_load(src + x));
+        dst[0] = lsb ? uchar(bits) : bitTables.reversed[bits & 0xff];
+        dst[1] = lsb ? uchar(bits >> 8) : bitTables.reversed[(bits >> 8) & 0xff];
+    }
+#endif
+    for (; x<width; x += 8, ++dst) {
+        uchar byte = 0;
+        const int n = qMin(8, width - x);
+        for (int i=0; i<n; ++i) {
+            if (src[x + i] & 0x80)
+                byte |= lsb ? (1 << i) : (0x80 >> i);
+        }
+        *dst = byte;
+    }
+}
+
+/* Kernel table, indexed by [isMonoLSB][dstChannels]
+ */
+const TableRowKernel expandBitsRowKernels[2][3] = {
+    { &expandBitsRow<1, false>, &expandBitsRow<3, false>, &expandBitsRow<4, false> },
+    { &expandBitsRow<1, true>, &expandBitsRow<3, true>, &expandBitsRow<4, true> }
+};
+
+/* Look up a row of color indices in the colors table, which holds
+ * the dcn channels of 256 colors.
+ *
+ * There is no byte gather in the universal intrinsics, the loop is
+ * unrolled instead, the 4 channels pixels are written as 32 bits.
+ */
+template<int dcn>
+void lookupColorsRow(const uchar *src, uchar *dst, int width, const uchar *colors)
+{
+    int x = 0;
+    for (; x <= width - 4; x += 4, dst += 4*dcn) {
+        if (dcn == 1) {
+            dst[0] = colors[src[x]];
+            dst[1] = colors[src[x + 1]];
+            dst[2] = colors[src[x + 2]];
+            dst[3] = colors[src[x + 3]];
+        } else {
+            memcpy(dst, colors + src[x]*dcn, dcn);
+            memcpy(dst + dcn, colors + src[x + 1]*dcn, dcn);
+            memcpy(dst + 2*dcn, colors + src[x + 2]*dcn, dcn);
+            memcpy(dst + 3*dcn, colors + src[x + 3]*dcn, dcn);
+        }
+    }
+    for (; x<width; ++x, dst += dcn)
+        memcpy(dst, colors + src[x]*dcn, dcn);
+}
+
+/* Kernel table, indexed by [dstChannels]
+ */
+const TableRowKernel lookupColorsRowKernels[3] = {
+    &lookupColorsRow<1>, &lookupColorsRow<3>, &lookupColorsRow<4>
+};
+
+/* Vectorized part of the window kernels, return the number of pixels processed.
+ */
+template<typename ST, int scn, int dcn>
+struct WindowSimd
+{
+    static int run(const ST *, uchar *, int, float, float) { return 0; }
+};
+
+#if defined(CV_SIMD128) && CV_SIMD128
+inline cv::v_int32x4 windowValues(const cv::v_float32x4 &v, const cv::v_float32x4 &scale, const cv::v_float32x4 &offset)
+{
+    return cv::v_round(v * scale + offset);
+}
+
+template<>
+struct WindowSimd<ushort, 1, 1>
+{
+    static int run(const ushort *src, uchar *dst, int width, float scale, float offset)
+    {
+        const cv::v_float32x4 vs = cv::v_setall_f32(scale);
+        const cv::v_float32x4 vo = cv::v_setall_f32(offset);
+        cv::v_uint32x4 v[4];
+        int x = 0;
+        for (; x <= width - 16; x += 16) {
+            cv::v_expand(cv::v_load(src + x), v[0], v[1]);
+            cv::v_expand(cv::v_load(src + x + 8), v[2], v[3]);
+            const cv::v_int16x8 lo = cv::v_pack(windowValues(cv::v_cvt_f32(cv::v_reinterpret_as_s32(v[0])), vs, vo),
+                                                windowValues(cv::v_cvt_f32(cv::v_reinterpret_as_s32(v[1])), vs, vo));
+            const cv::v_int16x8 hi = cv::v_pack(windowValues(cv::v_cvt_f32(cv::v_reinterpret_as_s32(v[2])), vs, vo),
+                                                windowValues(cv::v_cvt_f32(cv::v_reinterpret_as_s32(v[3])), vs, vo));
+            cv::v_store(dst + x, cv::v_pack_u(lo, hi));
+        }
+        return x;
+    }
+};
+
+template<>
+struct WindowSimd<float, 1, 1>
+{
+    static int run(const float *src, uchar *dst, int width, float scale, float offset)
+    {
+        const cv::v_float32x4 vs = cv::v_setall_f32(scale);
+        const cv::v_float32x4 vo = cv::v_setall_f32(offset);
+        int x = 0;
+        for (; x <= width - 16; x += 16) {
+            const cv::v_int16x8 lo = cv::v_pack(windowValues(cv::v_load(src + x), vs, vo),
+                                                windowValues(cv::v_load(src + x + 4), vs, vo));
+            const cv::v_int16x8 hi = cv::v_pack(windowValues(cv::v_load(src + x + 8), vs, vo),
+                                                windowValues(cv::v_load(src + x + 12), vs, vo));
+            cv::v_store(dst + x, cv::v_pack_u(lo, hi));
+        }
+        return x;
+    }
+};
+#endif
+
+/* Map the values of the display window to [0, 255], and reorder
+ * the channels in one pass. The target is always 8 bits.
+ *
+ * - map[0..3] is the channels map, map[4+i] is 1 when the target
+ *   channel i is the alpha channel of the source, which is not
+ *   windowed but converted to 8 bits as usual.
+ * - scale and low define the window, the value is (v - low) * scale.
+ */
+template<typename ST, int scn, int dcn>
+void windowRow(const uchar *srcRow, uchar *dst, int width, const int *map, double scale, double low)
+{
+    const ST *src = reinterpret_cast<const ST *>(srcRow);
+    const float s = static_cast<float>(scale);
+    const float o = static_cast<float>(-low * scale);
+    const float alphaScale = static_cast<float>(depthScale(cv::DataType<ST>::depth, CV_8U));
+
+    int x = WindowSimd<ST, scn, dcn>::run(src, dst, width, s, o);
+    src += x*scn;
+    dst += x*dcn;
+    for (; x<width; ++x, src += scn, dst += dcn) {
+        if (dcn == 1) {
+            const float v = scn == 1 ? float(src[0])
+                                     : src[map[0]]*0.299f + src[map[1]]*0.587f + src[map[2]]*0.114f;
+            dst[0] = cv::saturate_cast<uchar>(v * s + o);
+            continue;
+        }
+        for (int c=0; c<dcn; ++c) {
+            if (map[c] < 0)
+                dst[c] = 255;
+            else if (map[4 + c])
+                dst[c] = cv::saturate_cast<uchar>(src[map[c]] * alphaScale);
+            else
+                dst[c] = cv::saturate_cast<uchar>(src[map[c]] * s + o);
+        }
+    }
+}
+
+#define QTOCV_WINDOW_ROW_KERNELS(level, ST, scn) \
+    { &LevelKernel<level>::run<&windowRow<ST, scn, 1> >, \
+      &LevelKernel<level>::run<&windowRow<ST, scn, 3> >, \
+      &LevelKernel<level>::run<&windowRow<ST, scn, 4> > }
+#define QTOCV_WINDOW_DEPTH_KERNELS(level, ST) \
+    { QTOCV_WINDOW_ROW_KERNELS(level, ST, 1), QTOCV_WINDOW_ROW_KERNELS(level, ST, 3), QTOCV_WINDOW_ROW_KERNELS(level, ST, 4) }
+#define QTOCV_LEVEL_WINDOW_ROW_KERNELS(level) \
+    { QTOCV_WINDOW_DEPTH_KERNELS(level, uchar), \
+      QTOCV_WINDOW_DEPTH_KERNELS(level, ushort), \
+      QTOCV_WINDOW_DEPTH_KERNELS(level, float) }
+
+/* Kernel table, indexed by [CPU level][srcDepth][srcChannels][dstChannels]
+ */
+const RowKernel windowRowKernels[CPU_NEON + 1][3][3][3] = {
+    QTOCV_LEVEL_WINDOW_ROW_KERNELS(CPU_Baseline),
+    QTOCV_LEVEL_WINDOW_ROW_KERNELS(CPU_SSSE3),
+    QTOCV_LEVEL_WINDOW_ROW_KERNELS(CPU_AVX2),
+    QTOCV_LEVEL_WINDOW_ROW_KERNELS(CPU_NEON)
+};
+
+#undef QTOCV_LEVEL_WINDOW_ROW_KERNELS
+#undef QTOCV_WINDOW_DEPTH_KERNELS
+#undef QTOCV_WINDOW_ROW_KERNELS
+
+bool isMonoFormat(QImage::Format format)
+{
+    return format == QImage::Format_Mono || format == QImage::Format_MonoLSB;
+}
+
+/* Color table of the 1 bit image, missing colors are
+ * black and white, same as Qt.
+ */
+QVector<QRgb> monoColorTable(const QImage &img)
+{
+    QVector<QRgb> colorTable = img.colorTable();
+    if (colorTable.size() < 1)
+        colorTable.append(qRgb(0, 0, 0));
+    if (colorTable.size() < 2)
+        colorTable.append(qRgb(255, 255, 255));
+    return colorTable;
+}
+
+/* Color table of the indexed image, padded to 256 colors. The
+ * indices without colors are gray, same as the images without
+ * color table.
+ */
+QVector<QRgb> indexedColorTable(const QImage &img)
+{
+    QVector<QRgb> colorTable = img.colorTable();
+    for (int i=colorTable.size(); i<256; ++i)
+        colorTable.append(qRgb(i, i, i));
+    return colorTable;
+}
+
+/* Map colors to the indices of the closest colors of a color table
+ *
+ * The result of each color is cached, as an image has much less
+ * colors than pixels.
+ */
+class ColorQuantizer
+{
+public:
+    explicit ColorQuantizer(const QVector<QRgb> &colorTable)
+        : colorTable(colorTable.constData()), count(qMin(colorTable.size(), 256))
+    {
+        //All the indices are -1, nothing is cached.
+        memset(cachedColors, 0, sizeof(cachedColors));
+        memset(cachedIndices, 0xff, sizeof(cachedIndices));
+    }
+
+    uchar index(QRgb rgb)
+    {
+        const quint32 slot = (rgb * 2654435761u) >> (32 - cacheBits);
+        if (cachedIndices[slot] < 0 || cachedColors[slot] != rgb) {
+            cachedColors[slot] = rgb;
+            cachedIndices[slot] = closestIndex(rgb);
+        }
+        return uchar(cachedIndices[slot]);
+    }
+
+private:
+    int closestIndex(QRgb rgb) const
+    {
+        int index = 0;
+        int minDistance = INT_MAX;
+        for (int i=0; i<count && minDistance; ++i) {
+            const int dr = qRed(rgb) - qRed(colorTable[i]);
+            const int dg = qGreen(rgb) - qGreen(colorTable[i]);
+            const int db = qBlue(rgb) - qBlue(colorTable[i]);
+            const int da = qAlpha(rgb) - qAlpha(colorTable[i]);
+            const int distance = dr*dr + dg*dg + db*db + da*da;
+            if (distance < minDistance) {
+                minDistance = distance;
+                index = i;
+            }
+        }
+        return index;
+    }
+
+    enum { cacheBits = 12, cacheSize = 1 << cacheBits };
+
+    const QRgb *colorTable;
+    int count;
+    QRgb cachedColors[cacheSize];
+    int cachedIndices[cacheSize];
+};
+
+/* Convert the colors of the color table to 8 bits pixels of
+ * the channels and channels order used by the table kernels.
+ */
+void buildTableColors(const QVector<QRgb> &colorTable, int count, int channels, MatColorOrder order, uchar *colors)
+{
+    int roles[4];
+    if (channels != 1)
+        channelRoles(channels, order, roles);
+    for (int i=0; i<count; ++i, colors += channels) {
+        const QRgb rgb = colorTable.at(i);
+        if (channels == 1) {
+            colors[0] = cv::saturate_cast<uchar>(qRed(rgb)*0.299f + qGreen(rgb)*0.587f + qBlue(rgb)*0.114f);
+            continue;
+        }
+        const int values[4] = {qRed(rgb), qGreen(rgb), qBlue(rgb), qAlpha(rgb)};
+        for (int c=0; c<channels; ++c)
+            colors[c] = uchar(values[roles[c]]);
+    }
+}
+
+bool convertPixels(const cv::Mat &srcMat, MatColorOrder srcOrder, cv::Mat &dstMat, MatColorOrder dstOrder);
+
+/* Settings of the row parallel conversion
+ */
+QAtomicInt parallelThresholdSetting(1024*1024);
+QAtomicInt maxParallelThreadsSetting(0);
+
+int loadAtomic(const QAtomicInt &value)
+{
+#if QT_VERSION >= 0x050E00
+    return value.loadRelaxed();
+#elif QT_VERSION >= 0x050000
+    return value.load();
+#else
+    return value;
+#endif
+}
+
+/* Number of row stripes used to convert a rows x cols mat
+ */
+int parallelStripes(int rows, int cols)
+{
+    const int threshold = loadAtomic(parallelThresholdSetting);
+    if (threshold <= 0 || rows < 2 || double(rows) * cols < threshold)
+        return 1;
+    const int maxThreads = loadAtomic(maxParallelThreadsSetting);
+    const int stripes = maxThreads > 0 ? maxThreads : cv::getNumThreads();
+    return qMin(stripes, rows);
+}
+
+/* Level of the kernels, see setCpuLevel(), -1 until it is
+ * chosen by the first conversion.
+ */
+QAtomicInt cpuLevelSetting(-1);
+const int highestCpuLevel = CPU_NEON;
+
+bool isCpuLevelSupported(int level)
+{
+    switch (level) {
+    case CPU_Baseline:
+        return true;
+#if defined(QTOCV_X86_KERNELS) && defined(CV_CPU_SSSE3)
+    case CPU_SSSE3:
+        return cv::checkHardwareSupport(CV_CPU_SSSE3);
+#endif
+#if defined(QTOCV_X86_KERNELS) && defined(CV_CPU_AVX2)
+    case CPU_AVX2:
+        return cv::checkHardwareSupport(CV_CPU_AVX2);
+#endif
+#ifdef QTOCV_NEON_KERNELS
+    case CPU_NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+/* The best level supported by the CPU, which is not above level
+ */
+int supportedCpuLevel(int level)
+{
+    while (level > CPU_Baseline && !isCpuLevelSupported(level))
+        --level;
+    return level;
+}
+
+int cpuLevelFromEnvironment()
+{
+    const QByteArray name = qgetenv("QTOCV_CPU_LEVEL").trimmed().toLower();
+    if (name.isEmpty())
+        return highestCpuLevel;
+    for (int level=CPU_Baseline; level<=highestCpuLevel; ++level) {
+        if (name == cpuLevelName(CpuLevel(level)))
+            return level;
+    }
+    qWarning("QtOcv: Unknown QTOCV_CPU_LEVEL %s, the best level is used.", name.constData());
+    return highestCpuLevel;
+}
+
+int currentCpuLevel()
+{
+    int level = loadAtomic(cpuLevelSetting);
+    if (level < 0) {
+        level = supportedCpuLevel(cpuLevelFromEnvironment());
+        cpuLevelSetting.fetchAndStoreRelaxed(level);
+    }
+    return level;
+}
+
+/* Byte shuffle mask which reorders the channels of the whole pixels of a
+ * vector of 16 bytes, the bytes after them are shuffled to themselves, so
+ * a vector can be stored over the next pixels, and src and dst can be the
+ * same row. Return the size of the whole pixels, which is the step of the
+ * vectors.
+ */
+int buildPermuteMask(int channelSize, int channels, const int *map, uchar *mask)
+{
+    const int pixelSize = channelSize * channels;
+    const int step = 16 / pixelSize * pixelSize;
+    for (int i=0; i<16; ++i)
+        mask[i] = uchar(i);
+    for (int p=0; p<step; p+=pixelSize) {
+        for (int c=0; c<channels; ++c) {
+            for (int b=0; b<channelSize; ++b)
+                mask[p + c*channelSize + b] = uchar(p + map[c]*channelSize + b);
+        }
+    }
+    return step;
+}
+
+/* Map of the permute kernels: map[0..3] is the channels map, map[4] is the
+ * step of the byte shuffle and map[5..8] hold its mask, so the mask is built
+ * once for a conversion instead of once per row.
+ */
+const int permuteMapSize = 9;
+
+void buildPermuteMap(int type, const int *channelsMap, int *map)
+{
+    const int channels = CV_MAT_CN(type);
+    for (int c=0; c<4; ++c)
+        map[c] = c < channels ? channelsMap[c] : c;
+    uchar mask[16];
+    map[4] = buildPermuteMask(CV_ELEM_SIZE1(type), channels, map, mask);
+    memcpy(map + 5, mask, sizeof(mask));
+}
+
+/* Shuffle the bytes of the row by the mask, return the number of bytes processed
+ */
+typedef int (*PermuteBytesKernel)(const uchar *src, uchar *dst, int bytes, int step, const uchar *mask);
+
+#ifdef QTOCV_X86_KERNELS
+QTOCV_TARGET("ssse3")
+int permuteBytesSSSE3(const uchar *src, uchar *dst, int bytes, int step, const uchar *mask)
+{
+    const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask));
+    int i = 0;
+    for (; i <= bytes - 16; i += step) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_shuffle_epi8(v, m));
+    }
+    return i;
+}
+
+QTOCV_TARGET("avx2")
+int permuteBytesAVX2(const uchar *src, uchar *dst, int bytes, int step, const uchar *mask)
+{
+    const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask));
+    int i = 0;
+    //The shuffle doesn't cross the 128 bits lanes, so the pixels must not either.
+    if (step == 16) {
+        const __m256i m2 = _mm256_broadcastsi128_si256(m);
+        for (; i <= bytes - 32; i += 32) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_shuffle_epi8(v, m2));
+        }
+    }
+    for (; i <= bytes - 16; i += step) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_shuffle_epi8(v, m));
+    }
+    return i;
+}
+#endif
+
+#ifdef QTOCV_NEON_KERNELS
+int permuteBytesNEON(const uchar *src, uchar *dst, int bytes, int step, const uchar *mask)
+{
+    const uint8x16_t m = vld1q_u8(mask);
+    int i = 0;
+    for (; i <= bytes - 16; i += step)
+        vst1q_u8(dst + i, vqtbl1q_u8(vld1q_u8(src + i), m));
+    return i;
+}
+#endif
+
+/* Byte shuffle kernel of the level, 0 if the level has none
+ */
+PermuteBytesKernel permuteBytesKernel(int level)
+{
+    switch (level) {
+#ifdef QTOCV_X86_KERNELS
+    case CPU_SSSE3:
+        return &permuteBytesSSSE3;
+    case CPU_AVX2:
+        return &permuteBytesAVX2;
+#endif
+#ifdef QTOCV_NEON_KERNELS
+    case CPU_NEON:
+        return &permuteBytesNEON;
+#endif
+    default:
+        return 0;
+    }
+}
+
+/* Reorder the channels of a row, such as (R G B) <==> (B G R) or
+ * (A R G B) <==> (B G R A), the map is built by buildPermuteMap() and
+ * must be a permutation. src and dst can be the same row. T is only used
+ * for the size of the channels, the byte shuffle of the CPU level is
+ * resolved at compile time.
+ */
+template<typename T, int cn, int level>
+void permuteRow(const uchar *srcRow, uchar *dstRow, int width, const int *map, double, double)
+{
+    int x = 0;
+    const PermuteBytesKernel kernel = permuteBytesKernel(level);
+    if (kernel) {
+        const int pixelSize = int(sizeof(T)) * cn;
+        x = kernel(srcRow, dstRow, width * pixelSize, map[4], reinterpret_cast<const uchar *>(map + 5)) / pixelSize;
+    }
+
+    //Without a byte shuffle, the channels are deinterleaved.
+    const T *src = reinterpret_cast<const T *>(srcRow) + x*cn;
+    T *dst = reinterpret_cast<T *>(dstRow) + x*cn;
+    const int n = RowSimd<T, T, cn, cn>::run(src, dst, width - x, map, T());
+    src += n*cn;
+    dst += n*cn;
+    for (x += n; x<width; ++x, src += cn, dst += cn) {
+        T v[cn];
+        for (int c=0; c<cn; ++c)
+            v[c] = src[c];
+        for (int c=0; c<cn; ++c)
+            dst[c] = v[map[c]];
+    }
+}
+
+#define QTOCV_PERMUTE_ROW_KERNELS(level) \
+    { { &LevelKernel<level>::run<&permuteRow<uchar, 3, level> >, &LevelKernel<level>::run<&permuteRow<uchar, 4, level> > }, \
+      { &LevelKernel<level>::run<&permuteRow<ushort, 3, level> >, &LevelKernel<level>::run<&permuteRow<ushort, 4, level> > }, \
+      { &LevelKernel<level>::run<&permuteRow<uint, 3, level> >, &LevelKernel<level>::run<&permuteRow<uint, 4, level> > } }
+
+/* Kernel table, indexed by [CPU level][size of channel: 1, 2, 4][channels: 3, 4]
+ */
+Q_DECL_CONSTEXPR const RowKernel permuteRowKernels[CPU_NEON + 1][3][2] = {
+    QTOCV_PERMUTE_ROW_KERNELS(CPU_Baseline),
+    QTOCV_PERMUTE_ROW_KERNELS(CPU_SSSE3),
+    QTOCV_PERMUTE_ROW_KERNELS(CPU_AVX2),
+    QTOCV_PERMUTE_ROW_KERNELS(CPU_NEON)
+};
+
+#undef QTOCV_PERMUTE_ROW_KERNELS
+
+int channelSizeIndex(int type)
+{
+    const int size = CV_ELEM_SIZE1(type);
+    return size == 1 ? 0 : (size == 2 ? 1 : 2);
+}
+
+/* Kernel which reorders the channels of the type at the CPU level
+ */
+RowKernel permuteRowKernel(int type, int level)
+{
+    return permuteRowKernels[level][channelSizeIndex(type)][CV_MAT_CN(type) == 4];
+}
+
+/* Row kernel between the pixels and the planes of their channels,
+ * row is the row of the pixels, planeRows are the rows of the planes.
+ */
+typedef void (*PlanesRowKernel)(uchar *row, uchar *const *planeRows, int width, const int *map, double alpha);
+
+const int identityMap[4] = {0, 1, 2, 3};
+
+#if defined(CV_SIMD128) && CV_SIMD128
+template<typename T, int cn, int planes>
+struct PlanesSimd
+{
+    typedef typename SimdVector<T>::type VT;
+
+    static int split(const T *src, T *const *dst, int width, const int *map, T alpha)
+    {
+        const int lanes = VT::nlanes;
+        const VT va = SimdVector<T>::setall(alpha);
+        VT s[4];
+        int x = 0;
+        for (; x <= width - lanes; x += lanes, src += lanes*cn) {
+            if (cn == 1)
+                s[0] = cv::v_load(src);
+            else if (cn == 3)
+                cv::v_load_deinterleave(src, s[0], s[1], s[2]);
+            else
+                cv::v_load_deinterleave(src, s[0], s[1], s[2], s[3]);
+
+            for (int c=0; c<planes; ++c)
+                cv::v_store(dst[c] + x, map[c] < 0 ? va : s[map[c]]);
+        }
+        return x;
+    }
+
+    static int merge(T *dst, const T *const *src, int width, const int *map, T alpha)
+    {
+        const int lanes = VT::nlanes;
+        const VT va = SimdVector<T>::setall(alpha);
+        VT s[4], d[4];
+        int x = 0;
+        for (; x <= width - lanes; x += lanes, dst += lanes*cn) {
+            for (int p=0; p<planes; ++p)
+                s[p] = cv::v_load(src[p] + x);
+            for (int c=0; c<cn; ++c)
+                d[c] = map[c] < 0 ? va : s[map[c]];
+
+            if (cn == 1)
+                cv::v_store(dst, d[0]);
+            else if (cn == 3)
+                cv::v_store_interleave(dst, d[0], d[1], d[2]);
+            else
+                cv::v_store_interleave(dst, d[0], d[1], d[2], d[3]);
+        }
+        return x;
+    }
+};
+#else
+template<typename T, int cn, int planes>
+struct PlanesSimd
+{
+    static int split(const T *, T *const *, int, const int *, T) { return 0; }
+    static int merge(T *, const T *const *, int, const int *, T) { return 0; }
+};
+#endif
+
+/* Deinterleave a row of cn channels pixels, plane c gets the channel
+ * map[c], or alpha when map[c] is -1.
+ */
+template<typename T, int cn, int planes>
+void splitRow(uchar *row, uchar *const *planeRows, int width, const int *map, double alpha)
+{
+    const T *src = reinterpret_cast<const T *>(row);
+    T *dst[4];
+    for (int c=0; c<planes; ++c)
+        dst[c] = reinterpret_cast<T *>(planeRows[c]);
+    const T a = cv::saturate_cast<T>(alpha);
+
+    int x = PlanesSimd<T, cn, planes>::split(src, dst, width, map, a);
+    for (; x<width; ++x) {
+        for (int c=0; c<planes; ++c)
+            dst[c][x] = map[c] < 0 ? a : src[x*cn + map[c]];
+    }
+}
+
+/* Interleave the planes to a row of cn channels pixels, channel c gets
+ * the plane map[c], or alpha when map[c] is -1.
+ */
+template<typename T, int cn, int planes>
+void mergeRow(uchar *row, uchar *const *planeRows, int width, const int *map, double alpha)
+{
+    T *dst = reinterpret_cast<T *>(row);
+    const T *src[4];
+    for (int p=0; p<planes; ++p)
+        src[p] = reinterpret_cast<const T *>(planeRows[p]);
+    const T a = cv::saturate_cast<T>(alpha);
+
+    int x = PlanesSimd<T, cn, planes>::merge(dst, src, width, map, a);
+    for (; x<width; ++x) {
+        for (int c=0; c<cn; ++c)
+            dst[x*cn + c] = map[c] < 0 ? a : src[map[c]][x];
+    }
+}
+
+#define QTOCV_PLANES_ROW_KERNELS(kernel, T) \
+    { { &kernel<T, 1, 1>, &kernel<T, 1, 3>, &kernel<T, 1, 4> }, \
+      { &kernel<T, 3, 1>, &kernel<T, 3, 3>, &kernel<T, 3, 4> }, \
+      { &kernel<T, 4, 1>, &kernel<T, 4, 3>, &kernel<T, 4, 4> } }
+
+/* Kernel tables, indexed by [depth][pixel channels][planes]
+ */
+const PlanesRowKernel splitRowKernels[3][3][3] = {
+    QTOCV_PLANES_ROW_KERNELS(splitRow, uchar),
+    QTOCV_PLANES_ROW_KERNELS(splitRow, ushort),
+    QTOCV_PLANES_ROW_KERNELS(splitRow, float)
+};
+const PlanesRowKernel mergeRowKernels[3][3][3] = {
+    QTOCV_PLANES_ROW_KERNELS(mergeRow, uchar),
+    QTOCV_PLANES_ROW_KERNELS(mergeRow, ushort),
+    QTOCV_PLANES_ROW_KERNELS(mergeRow, float)
+};
+
+/* Pool of the buffers, the free buffers are kept by size bucket.
+ * Each buffer starts with a header which holds its bucket size,
+ * so that the buffer can be given back by its data pointer only.
+ */
+class BufferPool
+{
+public:
+    BufferPool() {}
+
+    void *acquire(size_t size)
+    {
+        const size_t capacity = bucketSize(size);
+        QMutexLocker locker(&mutex);
+        void *block = 0;
+        QMap<size_t, QVector<void *> >::iterator it = freeBlocks.find(capacity);
+        if (it != freeBlocks.end() && !it.value().isEmpty()) {
+            block = it.value().last();
+            it.value().pop_back();
+            stats.bytesCached -= capacity;
+            ++stats.reuses;
+        } else {
+            block = cv::fastMalloc(capacity + headerSize);
+            *static_cast<size_t *>(block) = capacity;
+            ++stats.allocations;
+        }
+        stats.bytesInUse += capacity;
+        stats.highWaterBytes = qMax(stats.highWaterBytes, stats.bytesInUse + stats.bytesCached);
+        return static_cast<uchar *>(block) + headerSize;
+    }
+
+    void release(void *data)
+    {
+        if (!data)
+            return;
+        void *block = static_cast<uchar *>(data) - headerSize;
+        const size_t capacity = *static_cast<size_t *>(block);
+        QMutexLocker locker(&mutex);
+        freeBlocks[capacity].append(block);
+        stats.bytesInUse -= capacity;
+        stats.bytesCached += capacity;
+    }
+
+    //Free the cached buffers, the largest ones first.
+    void trim(qint64 maxCachedBytes)
+    {
+        QMutexLocker locker(&mutex);
+        QMap<size_t, QVector<void *> >::iterator it = freeBlocks.end();
+        while (it != freeBlocks.begin() && stats.bytesCached > maxCachedBytes) {
+            --it;
+            QVector<void *> &blocks = it.value();
+            while (!blocks.isEmpty() && stats.bytesCached > maxCachedBytes) {
+                cv::fastFree(blocks.last());
+                blocks.pop_back();
+                stats.bytesCached -= it.key();
+            }
+        }
+    }
+
+    BufferPoolStats statistics() const
+    {
+        QMutexLocker locker(&mutex);
+        return stats;
+    }
+
+private:
+    //Keep the data of the buffer aligned as cv::fastMalloc() does.
+    enum { headerSize = 64 };
+
+    //8 buckets per power of two, no more than 1/8 of a buffer is wasted.
+    static size_t bucketSize(size_t size)
+    {
+        size_t step = 64;
+        while (step * 16 < size)
+            step *= 2;
+        return (size + step - 1) / step * step;
+    }
+
+    mutable QMutex mutex;
+    QMap<size_t, QVector<void *> > freeBlocks;
+    BufferPoolStats stats;
+};
+
+/* The pool lives as long as the process, as the buffers may
+ * be released by static objects.
+ */
+BufferPool &bufferPool()
+{
+    static BufferPool *pool = new BufferPool;
+    return *pool;
+}
+
+QAtomicInt bufferPoolSetting(0);
+
+#if CV_MAJOR_VERSION >= 4
+typedef cv::AccessFlag MatAccessFlag;
+#else
+typedef int MatAccessFlag;
+#endif
+
+#if CV_MAJOR_VERSION >= 3
+/* cv::MatAllocator which takes the buffers from the pool,
+ * same as the standard allocator of OpenCV otherwise.
+ */
+class PoolMatAllocator : public cv::MatAllocator
+{
+public:
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data0, size_t *step,
+                           MatAccessFlag, cv::UMatUsageFlags) const
+    {
+        size_t total = CV_ELEM_SIZE(type);
+        for (int i=dims-1; i>=0; --i) {
+            if (step) {
+                if (data0 && step[i] != CV_AUTOSTEP) {
+                    CV_Assert(total <= step[i]);
+                    total = step[i];
+                } else {
+                    step[i] = total;
+                }
+            }
+            total *= sizes[i];
+        }
+
+        cv::UMatData *u = new cv::UMatData(this);
+        u->data = u->origdata = data0 ? static_cast<uchar *>(data0) : static_cast<uchar *>(bufferPool().acquire(total));
+        u->size = total;
+        if (data0)
+            u->flags |= cv::UMatData::USER_ALLOCATED;
+        return u;
+    }
+
+    bool allocate(cv::UMatData *u, MatAccessFlag, cv::UMatUsageFlags) const
+    {
+        return u != 0;
+    }
+
+    void deallocate(cv::UMatData *u) const
+    {
+        if (!u)
+            return;
+        CV_Assert(u->urefcount == 0);
+        CV_Assert(u->refcount == 0);
+        if (!(u->flags & cv::UMatData::USER_ALLOCATED)) {
+            bufferPool().release(u->origdata);
+            u->origdata = 0;
+        }
+        delete u;
+    }
+};
+#endif
+
+/* Let the mat take its buffer from the pool when it is (re)allocated,
+ * unless it has its own allocator. Only used for the mats of QtOcv,
+ * the mats of the caller go through PoolScope.
+ */
+void usePool(cv::Mat &mat)
+{
+#if CV_MAJOR_VERSION >= 3
+    if (!mat.allocator && loadAtomic(bufferPoolSetting))
+        mat.allocator = bufferPoolAllocator();
+#else
+    Q_UNUSED(mat);
+#endif
+}
+
+/* Same as usePool(), but the allocator of the mat, which may belong to
+ * the caller, is restored when the scope ends. The buffer allocated in
+ * the scope is still released to the pool, by its own allocator.
+ */
+class PoolScope
+{
+public:
+    explicit PoolScope(cv::Mat &mat)
+        : mat(mat), allocator(mat.allocator)
+    {
+        usePool(mat);
+    }
+
+    ~PoolScope()
+    {
+        mat.allocator = allocator;
+    }
+
+private:
+    cv::Mat &mat;
+    cv::MatAllocator *allocator;
+};
+
+void createMat(cv::Mat &mat, int rows, int cols, int type)
+{
+    PoolScope pool(mat);
+    mat.create(rows, cols, type);
+}
+
+#if QT_VERSION >= 0x050400
+/* Cleanup function of the QImage created by createPooledImage()
+ */
+void releasePooledBuffer(void *info)
+{
+    bufferPool().release(info);
+}
+#endif
+
+QImage createImage(int width, int height, QImage::Format format)
+{
+#if QT_VERSION >= 0x050400
+    if (loadAtomic(bufferPoolSetting))
+        return createPooledImage(QSize(width, height), format);
+#endif
+    return QImage(width, height, format);
+}
+
+/* Whether the buffer of the mat is not shared with other mats,
+ * so it can be written in place or taken by the result.
+ */
+bool isUniquelyOwned(const cv::Mat &mat)
+{
+#if CV_MAJOR_VERSION >= 3
+    return mat.u && mat.u->refcount == 1 && mat.u->urefcount == 0;
+#else
+    return mat.refcount && *mat.refcount == 1;
+#endif
+}
+
+#if CV_MAJOR_VERSION >= 3
+/* Data of the mats created by takeImageData(), which keeps the QImage
+ */
+struct ImageMatData : public cv::UMatData
+{
+    explicit ImageMatData(const cv::MatAllocator *allocator)
+        : cv::UMatData(allocator)
+    {
+    }
+
+    QImage image;
+};
+
+/* cv::MatAllocator of the mats created by takeImageData(), the QImage
+ * is released with the last copy of the mat. A reallocated mat
+ * gets its buffer from the standard allocator.
+ */
+class ImageMatAllocator : public cv::MatAllocator
+{
+public:
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data0, size_t *step,
+                           MatAccessFlag flags, cv::UMatUsageFlags usageFlags) const
+    {
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data0, step, flags, usageFlags);
+    }
+
+    bool allocate(cv::UMatData *u, MatAccessFlag flags, cv::UMatUsageFlags usageFlags) const
+    {
+        return cv::Mat::getStdAllocator()->allocate(u, flags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData *u) const
+    {
+        if (!u)
+            return;
+        CV_Assert(u->urefcount == 0);
+        CV_Assert(u->refcount == 0);
+        delete static_cast<ImageMatData *>(u);
+    }
+};
+
+/* cv::Mat which takes the buffer of img without data copy, img is null
+ * when the function returns. The buffer must not be shared with other images.
+ */
+cv::Mat takeImageData(QImage &img, int type)
+{
+    static ImageMatAllocator *allocator = new ImageMatAllocator;
+    ImageMatData *u = new ImageMatData(allocator);
+    u->image.swap(img);
+    u->data = u->origdata = u->image.bits();
+    u->size = size_t(u->image.bytesPerLine()) * u->image.height();
+    u->flags |= cv::UMatData::USER_ALLOCATED;
+
+    //The copies of the mat share u, as the mats allocated by OpenCV do.
+    cv::Mat mat(u->image.height(), u->image.width(), type, u->data, u->image.bytesPerLine());
+    mat.u = u;
+    mat.addref();
+    return mat;
+}
+#endif
+
+/* Run the row kernel on a stripe of rows, or copy the rows if
+ * no kernel is given.
+ */
+class RowKernelBody : public cv::ParallelLoopBody
+{
+public:
+    RowKernelBody(const cv::Mat &srcMat, cv::Mat &dstMat, RowKernel kernel, const int *map, double scale, double alpha)
+        : srcMat(srcMat), dstMat(dstMat), kernel(kernel), map(map), scale(scale), alpha(alpha)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        for (int row=range.start; row<range.end; ++row) {
+            if (kernel)
+                kernel(srcMat.ptr(row), dstMat.ptr(row), srcMat.cols, map, scale, alpha);
+            else
+                memcpy(dstMat.ptr(row), srcMat.ptr(row), srcMat.cols * srcMat.elemSize());
+        }
+    }
+
+private:
+    const cv::Mat &srcMat;
+    cv::Mat &dstMat;
+    RowKernel kernel;
+    const int *map;
+    double scale;
+    double alpha;
+};
+
+void runRowKernel(const cv::Mat &srcMat, cv::Mat &dstMat, RowKernel kernel, const int *map, double scale, double alpha)
+{
+    const int stripes = parallelStripes(srcMat.rows, srcMat.cols);
+    if (stripes > 1) {
+        cv::parallel_for_(cv::Range(0, srcMat.rows), RowKernelBody(srcMat, dstMat, kernel, map, scale, alpha), stripes);
+    } else if (!kernel) {
+        srcMat.copyTo(dstMat);
+    } else if (srcMat.isContinuous() && dstMat.isContinuous()) {
+        kernel(srcMat.data, dstMat.data, srcMat.rows*srcMat.cols, map, scale, alpha);
+    } else {
+        for (int row=0; row<srcMat.rows; ++row)
+            kernel(srcMat.ptr(row), dstMat.ptr(row), srcMat.cols, map, scale, alpha);
+    }
+}
+
+/* Run the table row kernel on a stripe of rows, width is
+ * the number of pixels of the 1 bit or indexed image.
+ */
+class TableRowBody : public cv::ParallelLoopBody
+{
+public:
+    TableRowBody(const cv::Mat &srcMat, cv::Mat &dstMat, int width, TableRowKernel kernel, const uchar *colors)
+        : srcMat(srcMat), dstMat(dstMat), width(width), kernel(kernel), colors(colors)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        for (int row=range.start; row<range.end; ++row)
+            kernel(srcMat.ptr(row), dstMat.ptr(row), width, colors);
+    }
+
+private:
+    const cv::Mat &srcMat;
+    cv::Mat &dstMat;
+    int width;
+    TableRowKernel kernel;
+    const uchar *colors;
+};
+
+void runTableRowKernel(const cv::Mat &srcMat, cv::Mat &dstMat, int width, TableRowKernel kernel, const uchar *colors)
+{
+    const int stripes = parallelStripes(srcMat.rows, width);
+    TableRowBody body(srcMat, dstMat, width, kernel, colors);
+    if (stripes > 1)
+        cv::parallel_for_(cv::Range(0, srcMat.rows), body, stripes);
+    else
+        body(cv::Range(0, srcMat.rows));
+}
+
+/* Run the planes row kernel on a stripe of rows, the planes have
+ * the same size as mat.
+ */
+class PlanesRowBody : public cv::ParallelLoopBody
+{
+public:
+    PlanesRowBody(const cv::Mat &mat, const std::vector<cv::Mat> &planes, PlanesRowKernel kernel,
+                  const int *map, double alpha)
+        : mat(mat), planes(planes), kernel(kernel), map(map), alpha(alpha)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        uchar *planeRows[4];
+        for (int row=range.start; row<range.end; ++row) {
+            for (size_t p=0; p<planes.size(); ++p)
+                planeRows[p] = planes[p].data + planes[p].step[0] * row;
+            kernel(mat.data + mat.step[0] * row, planeRows, mat.cols, map, alpha);
+        }
+    }
+
+private:
+    const cv::Mat &mat;
+    const std::vector<cv::Mat> &planes;
+    PlanesRowKernel kernel;
+    const int *map;
+    double alpha;
+};
+
+void runPlanesRowKernel(const cv::Mat &mat, const std::vector<cv::Mat> &planes, PlanesRowKernel kernel,
+                        const int *map, double alpha)
+{
+    const int stripes = parallelStripes(mat.rows, mat.cols);
+    PlanesRowBody body(mat, planes, kernel, map, alpha);
+    if (stripes > 1)
+        cv::parallel_for_(cv::Range(0, mat.rows), body, stripes);
+    else
+        body(cv::Range(0, mat.rows));
+}
+
+/* Deinterleave the channels of mat to the planes
+ */
+void splitMat(const cv::Mat &mat, std::vector<cv::Mat> &planes)
+{
+    const int depth = depthIndex(mat.depth());
+    if (depth < 0) {
+        cv::split(mat, planes);
+        return;
+    }
+
+    const int channels = mat.channels();
+    planes.resize(channels);
+    for (int c=0; c<channels; ++c)
+        createMat(planes[c], mat.rows, mat.cols, mat.depth());
+    runPlanesRowKernel(mat, planes, splitRowKernels[depth][channelsIndex(channels)][channelsIndex(channels)],
+                       identityMap, 0.0);
+}
+
+/* Interleave the planes of the same size and type to mat
+ */
+bool mergeMat(const std::vector<cv::Mat> &planes, cv::Mat &mat)
+{
+    const cv::Mat &first = planes[0];
+    if (channelsIndex(int(planes.size())) < 0)
+        return false;
+    for (size_t p=0; p<planes.size(); ++p) {
+        if (planes[p].type() != first.type() || planes[p].channels() != 1
+                || planes[p].cols != first.cols || planes[p].rows != first.rows)
+            return false;
+    }
+
+    const int depth = depthIndex(first.depth());
+    if (depth < 0) {
+        cv::merge(planes, mat);
+        return true;
+    }
+
+    const int channels = int(planes.size());
+    createMat(mat, first.rows, first.cols, CV_MAKETYPE(first.depth(), channels));
+    runPlanesRowKernel(mat, planes, mergeRowKernels[depth][channelsIndex(channels)][channelsIndex(channels)],
+                       identityMap, 0.0);
+    return true;
+}
+
+/* Map a stripe of (B G R A) or (A R G B) rows, which are QRgb in memory,
+ * to the indices of the color table. Each stripe has its own cache.
+ */
+class QuantizeBody : public cv::ParallelLoopBody
+{
+public:
+    QuantizeBody(const cv::Mat &srcMat, cv::Mat &dstMat, const QVector<QRgb> &colorTable)
+        : srcMat(srcMat), dstMat(dstMat), colorTable(colorTable)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        ColorQuantizer quantizer(colorTable);
+        for (int row=range.start; row<range.end; ++row) {
+            const uchar *src = srcMat.ptr(row);
+            uchar *dst = dstMat.ptr(row);
+            QRgb last = 0;
+            uchar lastIndex = quantizer.index(last);
+            for (int x=0; x<srcMat.cols; ++x, src += 4) {
+                QRgb rgb;
+                memcpy(&rgb, src, 4);
+                //Neighboring pixels have the same color mostly.
+                if (rgb != last) {
+                    last = rgb;
+                    lastIndex = quantizer.index(rgb);
+                }
+                dst[x] = lastIndex;
+            }
+        }
+    }
+
+private:
+    const cv::Mat &srcMat;
+    cv::Mat &dstMat;
+    const QVector<QRgb> &colorTable;
+};
+
+/* Statistics of the values of a stripe of rows, the alpha channel
+ * is skipped. The minimum and maximum are found when histogram
+ * is empty, otherwise the values are counted in the histogram
+ * of [histogramLow, histogramLow + histogram.size() / histogramScale].
+ */
+struct WindowStats
+{
+    WindowStats() : min(DBL_MAX), max(-DBL_MAX), histogramLow(0), histogramScale(0) {}
+
+    double min;
+    double max;
+    double histogramLow;
+    double histogramScale;
+    QVector<int> histogram;
+};
+
+inline bool isNaNValue(uchar) { return false; }
+inline bool isNaNValue(ushort) { return false; }
+inline bool isNaNValue(float v) { return v != v; }
+
+template<typename ST>
+class WindowStatsBody : public cv::ParallelLoopBody
+{
+public:
+    WindowStatsBody(const cv::Mat &mat, int alphaChannel, int stripeRows, WindowStats *stats)
+        : mat(mat), alphaChannel(alphaChannel), stripeRows(stripeRows), stats(stats)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        const int channels = mat.channels();
+        for (int i=range.start; i<range.end; ++i) {
+            WindowStats &stat = stats[i];
+            const int bins = stat.histogram.size();
+            int *histogram = bins ? stat.histogram.data() : 0;
+            const int endRow = qMin(mat.rows, (i + 1) * stripeRows);
+            for (int row=i*stripeRows; row<endRow; ++row) {
+                const ST *src = mat.ptr<ST>(row);
+                for (int x=0; x<mat.cols; ++x, src += channels) {
+                    for (int c=0; c<channels; ++c) {
+                        if (c == alphaChannel || isNaNValue(src[c]))
+                            continue;
+                        const double v = src[c];
+                        if (!histogram) {
+                            stat.min = qMin(stat.min, v);
+                            stat.max = qMax(stat.max, v);
+                        } else {
+                            const int bin = int((v - stat.histogramLow) * stat.histogramScale);
+                            ++histogram[qBound(0, bin, bins - 1)];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    const cv::Mat &mat;
+    int alphaChannel;
+    int stripeRows;
+    WindowStats *stats;
+};
+
+void computeWindowStats(const cv::Mat &mat, int alphaChannel, QVector<WindowStats> &stats)
+{
+    const int stripeRows = (mat.rows + stats.size() - 1) / stats.size();
+    switch (mat.depth()) {
+    case CV_8U:
+        cv::parallel_for_(cv::Range(0, stats.size()), WindowStatsBody<uchar>(mat, alphaChannel, stripeRows, stats.data()));
+        break;
+    case CV_16U:
+        cv::parallel_for_(cv::Range(0, stats.size()), WindowStatsBody<ushort>(mat, alphaChannel, stripeRows, stats.data()));
+        break;
+    default:
+        cv::parallel_for_(cv::Range(0, stats.size()), WindowStatsBody<float>(mat, alphaChannel, stripeRows, stats.data()));
+        break;
+    }
+}
+
+#ifdef CV_16F
+/* Half float mats are reordered as CV_16U data, and converted
+ * to/from other depths through CV_32F.
+ */
+bool convertHalfFloatPixels(const cv::Mat &srcMat, MatColorOrder srcOrder, cv::Mat &dstMat, MatColorOrder dstOrder,
+                            int level, cv::Mat &mat32F)
+{
+    if (srcMat.depth() == dstMat.depth() && dstMat.channels() != 1) {
+        cv::Mat src16U(srcMat.rows, srcMat.cols, CV_16UC(srcMat.channels()), srcMat.data, srcMat.step);
+        cv::Mat dst16U(dstMat.rows, dstMat.cols, CV_16UC(dstMat.channels()), dstMat.data, dstMat.step);
+        RowKernel kernel = findRowKernel(src16U.type(), dst16U.type(), level);
+        if (!kernel)
+            return false;
+        int map[4];
+        buildChannelMap(srcMat.channels(), srcOrder, dstMat.channels(), dstOrder, map);
+        //0x3C00 is 1.0 in half float
+        runRowKernel(src16U, dst16U, kernel, map, 1.0, 0x3C00);
+        return true;
+    }
+
+    if (srcMat.depth() == CV_16F) {
+        usePool(mat32F);
+        srcMat.convertTo(mat32F, CV_32FC(srcMat.channels()));
+        return convertPixels(mat32F, srcOrder, dstMat, dstOrder);
+    }
+    createMat(mat32F, dstMat.rows, dstMat.cols, CV_32FC(dstMat.channels()));
+    if (!convertPixels(srcMat, srcOrder, mat32F, dstOrder))
+        return false;
+    mat32F.convertTo(dstMat, dstMat.type());
+    return true;
+}
+#endif
+
+/* Pixel conversion between two mat types, which is resolved once
+ * and can be run for many frames.
+ */
+struct PixelConversion
+{
+    enum Mode {
+        PC_Invalid,
+        PC_Copy,
+        PC_Kernel,
+        PC_HalfFloat
+    };
+
+    Mode mode;
+    RowKernel kernel;
+    //map[4..] is only used by the permute kernels.
+    int map[permuteMapSize];
+    double scale;
+    double alpha;
+    MatColorOrder srcOrder;
+    MatColorOrder dstOrder;
+    int level;
+};
+
+/* Reorder the channels of the 3 or 4 channels mat in place,
+ * the conversion must be a permutation of the type of the mat.
+ */
+void swizzleInPlace(cv::Mat &mat, const PixelConversion &conversion)
+{
+    runRowKernel(mat, mat, conversion.kernel, conversion.map, 1.0, 0.0);
+}
+
+bool preparePixelConversion(int srcType, MatColorOrder srcOrder, int dstType, MatColorOrder dstOrder, PixelConversion *conversion)
+{
+    conversion->mode = PixelConversion::PC_Invalid;
+    conversion->kernel = 0;
+    conversion->srcOrder = srcOrder;
+    conversion->dstOrder = dstOrder;
+    //The level is read once here instead of once per row.
+    conversion->level = currentCpuLevel();
+    buildChannelMap(CV_MAT_CN(srcType), srcOrder, CV_MAT_CN(dstType), dstOrder, conversion->map);
+
+    if (srcType == dstType && (CV_MAT_CN(dstType) == 1 || isIdentityMap(conversion->map, CV_MAT_CN(dstType)))) {
+        conversion->mode = PixelConversion::PC_Copy;
+        return true;
+    }
+
+    //The channels are reordered only, the bytes are shuffled whatever the depth is.
+    if (srcType == dstType && CV_MAT_CN(dstType) >= 3) {
+        conversion->kernel = permuteRowKernel(dstType, conversion->level);
+        buildPermuteMap(dstType, conversion->map, conversion->map);
+        conversion->scale = 1.0;
+        conversion->alpha = 0.0;
+        conversion->mode = PixelConversion::PC_Kernel;
+        return true;
+    }
+
+#ifdef CV_16F
+    if (CV_MAT_DEPTH(srcType) == CV_16F || CV_MAT_DEPTH(dstType) == CV_16F) {
+        conversion->mode = PixelConversion::PC_HalfFloat;
+        return true;
+    }
+#endif
+
+    conversion->kernel = findRowKernel(srcType, dstType, conversion->level);
+    if (!conversion->kernel)
+        return false;
+    //Most of the frames are 8 bits, use the kernels without channels map.
+    if (CV_MAT_DEPTH(srcType) == CV_8U && CV_MAT_DEPTH(dstType) == CV_8U) {
+        conversion->kernel = fixedRowKernels[channelsIndex(CV_MAT_CN(srcType))][srcOrder]
+                [channelsIndex(CV_MAT_CN(dstType))][dstOrder];
+    }
+    conversion->scale = depthScale(CV_MAT_DEPTH(srcType), CV_MAT_DEPTH(dstType));
+    conversion->alpha = opaqueAlpha(CV_MAT_DEPTH(dstType));
+    conversion->mode = PixelConversion::PC_Kernel;
+    return true;
+}
+
+/* Unpack the packed 16 bits QImage formats to the dstType directly,
+ * the source mat is the CV_16UC1 mat which shares data with the QImage.
+ */
+bool preparePackedConversion(QImage::Format format, int dstType, MatColorOrder dstOrder, PixelConversion *conversion)
+{
+    int srcChannels;
+    const int index = packedFormatIndex(format, &srcChannels);
+    const int dd = depthIndex(CV_MAT_DEPTH(dstType));
+    const int dc = channelsIndex(CV_MAT_CN(dstType));
+    if (index < 0 || dd < 0 || dc < 0)
+        return false;
+
+    conversion->mode = PixelConversion::PC_Kernel;
+    conversion->level = currentCpuLevel();
+    conversion->kernel = packedRowKernels[index][dd][dc];
+    conversion->srcOrder = MCO_RGBA;
+    conversion->dstOrder = dstOrder;
+    buildChannelMap(srcChannels, MCO_RGBA, CV_MAT_CN(dstType), dstOrder, conversion->map);
+    conversion->scale = depthScale(CV_8U, CV_MAT_DEPTH(dstType));
+    conversion->alpha = opaqueAlpha(CV_MAT_DEPTH(dstType));
+    return true;
+}
+
+/* Premultiply or unpremultiply the colors of the (8 bits, 4 channels)
+ * source, and reorder or drop the channels in the same pass.
+ */
+bool prepareAlphaConversion(int srcType, MatColorOrder srcOrder, int dstType, MatColorOrder dstOrder,
+                            bool premultiply, PixelConversion *conversion)
+{
+    if (srcType != CV_8UC4 || (dstType != CV_8UC3 && dstType != CV_8UC4))
+        return false;
+
+    conversion->mode = PixelConversion::PC_Kernel;
+    conversion->level = currentCpuLevel();
+    conversion->kernel = alphaRowKernels[conversion->level][!premultiply][srcOrder == MCO_ARGB][dstType == CV_8UC4];
+    conversion->srcOrder = srcOrder;
+    conversion->dstOrder = dstOrder;
+    buildChannelMap(4, srcOrder, CV_MAT_CN(dstType), dstOrder, conversion->map);
+    conversion->scale = 1.0;
+    conversion->alpha = opaqueAlpha(CV_8U);
+    return true;
+}
+
+/* dstMat must have been allocated with the same size as srcMat.
+ */
+bool runPixelConversion(const PixelConversion &conversion, const cv::Mat &srcMat, cv::Mat &dstMat, cv::Mat &scratch)
+{
+    Q_ASSERT(srcMat.rows == dstMat.rows && srcMat.cols == dstMat.cols);
+
+    switch (conversion.mode) {
+    case PixelConversion::PC_Copy:
+        runRowKernel(srcMat, dstMat, 0, 0, 1.0, 0.0);
+        return true;
+    case PixelConversion::PC_Kernel:
+        runRowKernel(srcMat, dstMat, conversion.kernel, conversion.map, conversion.scale, conversion.alpha);
+        return true;
+#ifdef CV_16F
+    case PixelConversion::PC_HalfFloat:
+        return convertHalfFloatPixels(srcMat, conversion.srcOrder, dstMat, conversion.dstOrder, conversion.level, scratch);
+#endif
+    default:
+        Q_UNUSED(scratch);
+        return false;
+    }
+}
+
+/* Convert srcMat to the type and channels order of dstMat in one pass.
+ *
+ * dstMat must have been allocated with the same size as srcMat.
+ */
+bool convertPixels(const cv::Mat &srcMat, MatColorOrder srcOrder, cv::Mat &dstMat, MatColorOrder dstOrder)
+{
+    PixelConversion conversion;
+    if (!preparePixelConversion(srcMat.type(), srcOrder, dstMat.type(), dstOrder, &conversion))
+        return false;
+    cv::Mat scratch;
+    return runPixelConversion(conversion, srcMat, dstMat, scratch);
+}
+
+#if QT_VERSION >= 0x060200
+/* Depth of the mat which shares data with the floating point QImage,
+ * return -1 if the format is not a floating point format.
+ */
+int floatFormatDepth(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_RGBX32FPx4:
+    case QImage::Format_RGBA32FPx4:
+    case QImage::Format_RGBA32FPx4_Premultiplied:
+        return CV_32F;
+#ifdef CV_16F
+    case QImage::Format_RGBX16FPx4:
+    case QImage::Format_RGBA16FPx4:
+    case QImage::Format_RGBA16FPx4_Premultiplied:
+        return CV_16F;
+#endif
+    default:
+        return -1;
+    }
+}
+#endif
+
+/* Type of the mat which shares data with the QImage format, and
+ * the channels order of the mat, return -1 if the format is not supported.
+ *
+ * order is not touched for 1 channel formats.
+ */
+int sharedMatType(QImage::Format format, MatColorOrder *order)
+{
+    switch (format) {
+    case QImage::Format_Indexed8:
+        return CV_8UC1;
+#if QT_VERSION >= 0x040400
+    case QImage::Format_RGB888:
+        if (order)
+            *order = MCO_RGB;
+        return CV_8UC3;
+#endif
+#if QT_VERSION >= 0x050E00
+    case QImage::Format_BGR888:
+        if (order)
+            *order = MCO_BGR;
+        return CV_8UC3;
+#endif
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        if (order)
+            *order = getColorOrderOfRGB32Format();
+        return CV_8UC4;
+#if QT_VERSION >= 0x050200
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBA8888_Premultiplied:
+        if (order)
+            *order = MCO_RGBA;
+        return CV_8UC4;
+#endif
+#if QT_VERSION >= 0x050500
+    case QImage::Format_Alpha8:
+    case QImage::Format_Grayscale8:
+        return CV_8UC1;
+#endif
+#if QT_VERSION >= 0x050C00
+    case QImage::Format_RGBX64:
+    case QImage::Format_RGBA64:
+    case QImage::Format_RGBA64_Premultiplied:
+        if (order)
+            *order = MCO_RGBA;
+        return CV_16UC4;
+#endif
+#if QT_VERSION >= 0x050D00
+    case QImage::Format_Grayscale16:
+        return CV_16UC1;
+#endif
+#if QT_VERSION >= 0x060200
+    case QImage::Format_RGBX32FPx4:
+    case QImage::Format_RGBA32FPx4:
+    case QImage::Format_RGBA32FPx4_Premultiplied:
+#ifdef CV_16F
+    case QImage::Format_RGBX16FPx4:
+    case QImage::Format_RGBA16FPx4:
+    case QImage::Format_RGBA16FPx4_Premultiplied:
+#endif
+        if (order)
+            *order = MCO_RGBA;
+        return CV_MAKETYPE(floatFormatDepth(format), 4);
+#endif
+    default:
+        return -1;
+    }
+}
+
+/* Find the QImage format used by mat2Image(), and the type and
+ * channels order of the mat required by the format.
+ */
+QImage::Format findMat2ImageFormat(int matType, MatColorOrder order, QImage::Format formatHint,
+                                   int *requiredType, MatColorOrder *requiredOrder)
+{
+    const int depth = CV_MAT_DEPTH(matType);
+    const int channels = CV_MAT_CN(matType);
+
+#if QT_VERSION >= 0x050D00
+    //16 bits gray mat needn't to be converted to 8 bits
+    if (depth == CV_16U && channels == 1
+            && (formatHint == QImage::Format_Invalid || formatHint == QImage::Format_Grayscale16)) {
+        *requiredType = CV_16UC1;
+        *requiredOrder = order;
+        return QImage::Format_Grayscale16;
+    }
+#endif
+#if QT_VERSION >= 0x050C00
+    //16 bits color mat needn't to be converted to 8 bits
+    if (depth == CV_16U && channels != 1
+            && (formatHint == QImage::Format_Invalid
+                || formatHint == QImage::Format_RGBX64
+                || formatHint == QImage::Format_RGBA64
+                || formatHint == QImage::Format_RGBA64_Premultiplied)) {
+        *requiredType = CV_16UC4;
+        *requiredOrder = MCO_RGBA;
+        if (formatHint != QImage::Format_Invalid)
+            return formatHint;
+        return channels == 3 ? QImage::Format_RGBX64 : QImage::Format_RGBA64;
+    }
+#endif
+#if QT_VERSION >= 0x060200
+    //Floating point color mat needn't to be converted to 8 bits
+#ifdef CV_16F
+    const bool isFloat = depth == CV_32F || depth == CV_16F;
+#else
+    const bool isFloat = depth == CV_32F;
+#endif
+    if (isFloat && channels != 1
+            && (formatHint == QImage::Format_Invalid || floatFormatDepth(formatHint) != -1)) {
+        QImage::Format format = formatHint;
+        if (format == QImage::Format_Invalid) {
+#ifdef CV_16F
+            if (depth == CV_16F)
+                format = channels == 3 ? QImage::Format_RGBX16FPx4 : QImage::Format_RGBA16FPx4;
+            else
+#endif
+                format = channels == 3 ? QImage::Format_RGBX32FPx4 : QImage::Format_RGBA32FPx4;
+        }
+        *requiredType = CV_MAKETYPE(floatFormatDepth(format), 4);
+        *requiredOrder = MCO_RGBA;
+        return format;
+    }
+#endif
+    Q_UNUSED(depth);
+
+    QImage::Format format;
+    *requiredOrder = getColorOrderOfRGB32Format();
+    int requiredChannels = 4;
+    if (channels == 1) {
+        format = formatHint;
+        if (formatHint != QImage::Format_Indexed8
+        #if QT_VERSION >= 0x050500
+                && formatHint != QImage::Format_Alpha8
+                && formatHint != QImage::Format_Grayscale8
+        #endif
+                ) {
+            format = QImage::Format_Indexed8;
+        }
+        requiredChannels = 1;
+    } else if (channels == 3) {
+#if QT_VERSION >= 0x040400
+        format = QImage::Format_RGB888;
+        *requiredOrder = MCO_RGB;
+        requiredChannels = 3;
+#if QT_VERSION >= 0x050E00
+        //(B G R) mat can be copied to QImage without swapping channels.
+        if (order == MCO_BGR && (formatHint == QImage::Format_Invalid || formatHint == QImage::Format_BGR888)) {
+            format = QImage::Format_BGR888;
+            *requiredOrder = MCO_BGR;
+        }
+#endif
+#else
+        format = QImage::Format_RGB32;
+#endif
+    } else {
+        //Find best format if the formatHint can not be applied.
+        format = findClosestFormat(formatHint);
+        if (format != QImage::Format_RGB32
+                && format != QImage::Format_ARGB32
+                && format != QImage::Format_ARGB32_Premultiplied
+        #if QT_VERSION >= 0x050200
+                && format != QImage::Format_RGBX8888
+                && format != QImage::Format_RGBA8888
+                && format != QImage::Format_RGBA8888_Premultiplied
+        #endif
+                ) {
+#if QT_VERSION >= 0x050200
+            format = order == MCO_RGBA ? QImage::Format_RGBA8888 : QImage::Format_ARGB32;
+#else
+            format = QImage::Format_ARGB32;
+#endif
+        }
+
+#if QT_VERSION >= 0x050200
+        if (format == QImage::Format_RGBX8888
+                || format == QImage::Format_RGBA8888
+                || format == QImage::Format_RGBA8888_Premultiplied) {
+            *requiredOrder = MCO_RGBA;
+        }
+#endif
+    }
+
+    *requiredType = CV_8UC(requiredChannels);
+    return format;
+}
+
+/* Find the QImage format which can share data with the cv::Mat,
+ * Format_Invalid if the type can't be shared.
+ */
+QImage::Format findSharedFormat(int matType, QImage::Format formatHint)
+{
+    if (matType == CV_8UC1) {
+        if (formatHint != QImage::Format_Indexed8
+        #if QT_VERSION >= 0x050500
+                && formatHint != QImage::Format_Alpha8
+                && formatHint != QImage::Format_Grayscale8
+        #endif
+                ) {
+            formatHint = QImage::Format_Indexed8;
+        }
+#if QT_VERSION >= 0x040400
+    } else if (matType == CV_8UC3) {
+#if QT_VERSION >= 0x050E00
+        if (formatHint != QImage::Format_BGR888)
+            formatHint = QImage::Format_RGB888;
+#else
+        formatHint = QImage::Format_RGB888;
+#endif
+#endif
+#if QT_VERSION >= 0x050D00
+    } else if (matType == CV_16UC1) {
+        formatHint = QImage::Format_Grayscale16;
+#endif
+#if QT_VERSION >= 0x050C00
+    } else if (matType == CV_16UC4) {
+        if (formatHint != QImage::Format_RGBX64
+                && formatHint != QImage::Format_RGBA64_Premultiplied) {
+            formatHint = QImage::Format_RGBA64;
+        }
+#endif
+#if QT_VERSION >= 0x060200
+    } else if (matType == CV_32FC4) {
+        if (floatFormatDepth(formatHint) != CV_32F)
+            formatHint = QImage::Format_RGBA32FPx4;
+#ifdef CV_16F
+    } else if (matType == CV_MAKETYPE(CV_16F, 4)) {
+        if (floatFormatDepth(formatHint) != CV_16F)
+            formatHint = QImage::Format_RGBA16FPx4;
+#endif
+#endif
+    } else if (matType == CV_8UC4) {
+        if (formatHint != QImage::Format_RGB32
+                && formatHint != QImage::Format_ARGB32
+                && formatHint != QImage::Format_ARGB32_Premultiplied
+        #if QT_VERSION >= 0x050200
+                && formatHint != QImage::Format_RGBX8888
+                && formatHint != QImage::Format_RGBA8888
+                && formatHint != QImage::Format_RGBA8888_Premultiplied
+        #endif
+                ) {
+            formatHint = QImage::Format_ARGB32;
+        }
+    } else {
+        //The hint can't be shared with the type in this Qt version.
+        formatHint = QImage::Format_Invalid;
+    }
+    return formatHint;
+}
+
+QVector<QRgb> createGrayColorTable()
+{
+    QVector<QRgb> colorTable;
+    colorTable.reserve(256);
+    for (int i=0; i<256; ++i)
+        colorTable.append(qRgb(i,i,i));
+    return colorTable;
+}
+
+QVector<QRgb> createMonoColorTable()
+{
+    QVector<QRgb> colorTable;
+    colorTable.append(qRgb(0, 0, 0));
+    colorTable.append(qRgb(255, 255, 255));
+    return colorTable;
+}
+
+/* The default color tables are created once, and shared by all
+ * of the images, so setting them costs a reference count only.
+ */
+const QVector<QRgb> &sharedGrayColorTable()
+{
+    static const QVector<QRgb> colorTable = createGrayColorTable();
+    return colorTable;
+}
+
+const QVector<QRgb> &sharedMonoColorTable()
+{
+    static const QVector<QRgb> colorTable = createMonoColorTable();
+    return colorTable;
+}
+
+void setDefaultColorTable(QImage &img)
+{
+    if (img.format() == QImage::Format_Indexed8)
+        img.setColorTable(sharedGrayColorTable());
+    else if (isMonoFormat(img.format()))
+        img.setColorTable(sharedMonoColorTable());
+}
+
+#if QT_VERSION >= 0x050000
+/* Buffers of the images which share data with mats. These images don't own
+ * their buffers, so the buffers are never reused as dst or taken, which would
+ * change the pixels of the mats. Each image holds a slot of the table from its
+ * creation to the release of its last copy. The slots are claimed and checked
+ * with atomic operations, so that the zero-copy conversions and the dst reuse
+ * checks of different threads don't wait for each other.
+ */
+const int externalBufferSlots = 1024;
+const int externalBufferProbes = 16;
+QAtomicPointer<uchar> externalBuffers[externalBufferSlots];
+//Number of the images which didn't find a free slot.
+QAtomicInt externalBufferOverflow;
+
+int externalBufferSlot(const uchar *data)
+{
+    //Buffers of mats are aligned, the low bits are dropped.
+    return int((quint32(quintptr(data) >> 4) * 2654435761u) % externalBufferSlots);
+}
+
+QAtomicPointer<uchar> *addExternalBuffer(uchar *data)
+{
+    const int first = externalBufferSlot(data);
+    for (int i = 0; i < externalBufferProbes; ++i) {
+        QAtomicPointer<uchar> &slot = externalBuffers[(first + i) % externalBufferSlots];
+        if (slot.testAndSetOrdered(0, data))
+            return &slot;
+    }
+    //No buffer is reused as dst until this image is released.
+    externalBufferOverflow.fetchAndAddOrdered(1);
+    return 0;
+}
+
+void removeExternalBuffer(QAtomicPointer<uchar> *slot)
+{
+    if (slot)
+        slot->fetchAndStoreOrdered(0);
+    else
+        externalBufferOverflow.fetchAndAddOrdered(-1);
+}
+
+bool isExternalBuffer(const uchar *data)
+{
+    if (loadAtomic(externalBufferOverflow) > 0)
+        return true;
+    const int first = externalBufferSlot(data);
+    for (int i = 0; i < externalBufferProbes; ++i) {
+        if (externalBuffers[(first + i) % externalBufferSlots].loadAcquire() == data)
+            return true;
+    }
+    return false;
+}
+
+/* Cleanup function of the QImage created by mat2Image_shared(), info is its slot
+ */
+void releaseExternalBuffer(void *info)
+{
+    removeExternalBuffer(static_cast<QAtomicPointer<uchar> *>(info));
+}
+
+/* Mat kept alive by the QImage created by mat2Image_sharedRef()
+ */
+struct SharedMatRef
+{
+    cv::Mat mat;
+    QAtomicPointer<uchar> *slot;
+};
+
+/* Cleanup function of the QImage created by mat2Image_sharedRef()
+ */
+void releaseMat(void *info)
+{
+    SharedMatRef *ref = static_cast<SharedMatRef *>(info);
+    removeExternalBuffer(ref->slot);
+    delete ref;
+}
+#endif
+
+#ifdef QT_CONCURRENT_LIB
+/* Functors of the batch and asynchronous conversions
+ */
+struct Image2MatFunctor
+{
+    typedef cv::Mat result_type;
+
+    Image2MatFunctor(int type, MatColorOrder order)
+        : type(type), order(order)
+    {
+    }
+
+    cv::Mat operator()(const QImage &img) const
+    {
+        return image2Mat(img, type, order);
+    }
+
+    int type;
+    MatColorOrder order;
+};
+
+struct Mat2ImageFunctor
+{
+    typedef QImage result_type;
+
+    Mat2ImageFunctor(MatColorOrder order, QImage::Format formatHint)
+        : order(order), formatHint(formatHint)
+    {
+    }
+
+    QImage operator()(const cv::Mat &mat) const
+    {
+        return mat2Image(mat, order, formatHint);
+    }
+
+    MatColorOrder order;
+    QImage::Format formatHint;
+};
+#endif
+
+/* QImage header of the rect of img without data copy, the rect must be
+ * inside the image and start at a byte boundary.
+ */
+QImage subImage(const QImage &img, const QRect &rect)
+{
+    const uchar *data = img.constBits() + qint64(rect.y()) * img.bytesPerLine() + rect.x() * img.depth() / 8;
+    QImage sub(data, rect.width(), rect.height(), img.bytesPerLine(), img.format());
+    sub.setColorTable(img.colorTable());
+    return sub;
+}
+
+int resizeInterpolation(ResizeMode mode)
+{
+    return mode == RM_Nearest ? cv::INTER_NEAREST : cv::INTER_AREA;
+}
+
+/* cv::resize() supports these depths
+ */
+bool isResizableDepth(int depth)
+{
+    return depth == CV_8U || depth == CV_16U || depth == CV_32F;
+}
+
+/* cv::Mat which shares data with the image, it's empty if the format can not be
+ * shared. Unlike image2Mat_shared(), the conversion stats are not updated.
+ */
+cv::Mat createSharedMat(const QImage &img, MatColorOrder *order = 0)
+{
+    const int type = img.isNull() ? -1 : sharedMatType(img.format(), order);
+    if (type == -1)
+        return cv::Mat();
+    return cv::Mat(img.height(), img.width(), type, (uchar*)img.bits(), img.bytesPerLine());
+}
+
+/* QImage which shares data with the mat, format must be found by findSharedFormat()
+ */
+QImage createSharedImage(const cv::Mat &mat, QImage::Format format)
+{
+    if (mat.empty() || format == QImage::Format_Invalid)
+        return QImage();
+#if QT_VERSION >= 0x050000
+    QAtomicPointer<uchar> *slot = addExternalBuffer(mat.data);
+    QImage img(mat.data, mat.cols, mat.rows, mat.step, format, releaseExternalBuffer, slot);
+    //The cleanup function isn't called for a null image.
+    if (img.isNull()) {
+        removeExternalBuffer(slot);
+        return img;
+    }
+#else
+    QImage img(mat.data, mat.cols, mat.rows, mat.step, format);
+#endif
+    setDefaultColorTable(img);
+    return img;
+}
+
+#if QT_VERSION >= 0x050000
+/* QImage which shares data with the mat, and keeps a reference of the mat
+ */
+QImage createSharedRefImage(const cv::Mat &mat, QImage::Format format)
+{
+    if (mat.empty() || format == QImage::Format_Invalid)
+        return QImage();
+    //The reference will be released by the last copy of the QImage.
+    SharedMatRef *ref = new SharedMatRef;
+    ref->mat = mat;
+    ref->slot = addExternalBuffer(ref->mat.data);
+    QImage img(mat.data, mat.cols, mat.rows, mat.step, format, releaseMat, ref);
+    //The cleanup function isn't called for a null image.
+    if (img.isNull()) {
+        releaseMat(ref);
+        return img;
+    }
+    setDefaultColorTable(img);
+    return img;
+}
+#endif
+
+/* Path used by the pixel conversion, when no QImage format conversion is needed
+ */
+ConversionPlan::Path pixelConversionPath(const PixelConversion &conversion, int srcType, int dstType)
+{
+    if (conversion.mode == PixelConversion::PC_Copy)
+        return ConversionPlan::CP_Copy;
+    if (CV_MAT_DEPTH(srcType) == CV_MAT_DEPTH(dstType))
+        return ConversionPlan::CP_Swizzle;
+    return ConversionPlan::CP_DepthConvert;
+}
+
+/* Counters of the conversions, indexed by ConversionPlan::Path
+ */
+const int conversionPathCount = ConversionPlan::CP_QtFallback + 1;
+QAtomicInt conversionStatsSetting(0);
+QMutex conversionStatsMutex;
+ConversionStats conversionStatsTable[conversionPathCount];
+
+/* Collect the counters of one conversion, they are added to
+ * the table when the scope ends. Nothing is done when the
+ * counters are disabled.
+ */
+class StatsScope
+{
+public:
+    explicit StatsScope(ConversionPlan::Path path)
+        : path(path), enabled(loadAtomic(conversionStatsSetting) != 0), bytes(0), allocations(0)
+    {
+        if (enabled)
+            timer.start();
+    }
+
+    ~StatsScope()
+    {
+        if (!enabled)
+            return;
+        const qint64 nsecs = timer.nsecsElapsed();
+        QMutexLocker locker(&conversionStatsMutex);
+        ConversionStats &stats = conversionStatsTable[path];
+        ++stats.calls;
+        stats.bytes += bytes;
+        stats.allocations += allocations;
+        stats.nsecs += nsecs;
+    }
+
+    bool isEnabled() const { return enabled; }
+    void setPath(ConversionPlan::Path p) { path = p; }
+    void addBytes(qint64 n) { bytes += n; }
+    void addAllocations(int n) { allocations += n; }
+
+    //A buffer has been allocated if its data pointer changed.
+    void addAllocation(const void *before, const void *after)
+    {
+        if (after && after != before)
+            ++allocations;
+    }
+
+private:
+    ConversionPlan::Path path;
+    bool enabled;
+    qint64 bytes;
+    qint64 allocations;
+    QElapsedTimer timer;
+};
+} //namespace
+
+namespace detail {
+
+int reorderChannelsSimd(const void *src, void *dst, int width, int depth, int scn, int dcn, const int *map)
+{
+    const int d = depthIndex(depth);
+    const int sc = channelsIndex(scn);
+    const int dc = channelsIndex(dcn);
+    if (d < 0 || sc < 0 || dc < 0)
+        return 0;
+    return reorderSimdKernels[d][sc][dc](src, dst, width, map);
+}
+
+bool ownsImageData(const QImage &img)
+{
+    if (!img.isDetached())
+        return false;
+#if QT_VERSION >= 0x050000
+    return !isExternalBuffer(img.constBits());
+#else
+    //Qt 4 can't tell whether the bits are allocated by the image.
+    return false;
+#endif
+}
+
+} //namespace detail
+
+class ConversionPlanPrivate
+{
+public:
+    ConversionPlanPrivate();
+
+    void setupImage2Mat(QImage::Format format, const QSize &size, int requiredMatType,
+                        MatColorOrder requiredOrder, ConversionPlan::SharingMode mode);
+    void setupMat2Image(int type, const QSize &size, MatColorOrder order,
+                        QImage::Format formatHint, ConversionPlan::SharingMode mode);
+    bool image2Mat(const QImage &img, cv::Mat &dst);
+    bool mat2Image(const cv::Mat &mat, QImage &dst);
+    //Convert the pixels in the buffer of the input, and let the result take it
+    bool takeImage(QImage &img, cv::Mat &dst);
+    bool takeMat(cv::Mat &mat, QImage &dst);
+    //Deinterleave or interleave the pixels and the planes in one pass
+    bool splitImage(const QImage &img, std::vector<cv::Mat> &planes);
+    bool mergePlanes(const std::vector<cv::Mat> &planes, QImage &dst);
+
+    ConversionPlan::Path path;
+    bool fromImage;
+    QSize size;
+    //Set before the setup, how the colors with alpha are stored in the mat
+    AlphaMode alphaMode;
+    //Format of the source or result QImage
+    QImage::Format imageFormat;
+    //Format of the QImage which shares data with sharedMat
+    QImage::Format sharedFormat;
+    int sharedType;
+    MatColorOrder sharedOrder;
+    //Type of the source or result cv::Mat
+    int matType;
+    MatColorOrder matOrder;
+    PixelConversion conversion;
+    //Kernel of the 1 bit and indexed formats, used before or after the conversion
+    TableRowKernel tableKernel;
+    //Colors of the last color table, in the layout used by tableKernel
+    QVector<QRgb> colorTable;
+    bool grayColorTable;
+    uchar tableColors[256*4];
+
+    QImage scratchImage;
+    cv::Mat scratchMat;
+
+private:
+    bool convertImage(const QImage &img, cv::Mat &dst);
+    bool convertMat(const cv::Mat &mat, QImage &dst);
+    int fallbackAllocations() const;
+    bool convertStripes(const QImage &img, cv::Mat &dst);
+    bool lookupColors(const QImage &img, cv::Mat &dst);
+    bool convertsInPlace() const;
+    bool convertsPlanes() const;
+};
+
+#if QT_VERSION >= 0x050000
+/* Pixels converted by Qt at a time in the fallback path
+ */
+const int fallbackStripePixels = 64*1024;
+
+static int fallbackStripeRows(int width)
+{
+    return qMax(1, fallbackStripePixels / width);
+}
+
+/* Convert stripes of the image to the shared format by Qt,
+ * then to the cv::Mat.
+ */
+class FallbackStripeBody : public cv::ParallelLoopBody
+{
+public:
+    FallbackStripeBody(const QImage &img, cv::Mat &dst, const ConversionPlanPrivate *plan, int stripeRows)
+        : img(img), dst(dst), plan(plan), stripeRows(stripeRows), failed(0)
+    {
+    }
+
+    void operator()(const cv::Range &range) const
+    {
+        cv::Mat scratch;
+        for (int i=range.start; i<range.end; ++i) {
+            const int row = i * stripeRows;
+            const int rows = qMin(stripeRows, img.height() - row);
+            QImage stripe(img.constScanLine(row), img.width(), rows, img.bytesPerLine(), img.format());
+            stripe.setColorTable(img.colorTable());
+            const QImage image = stripe.convertToFormat(plan->sharedFormat);
+
+            const cv::Mat sharedMat(rows, img.width(), plan->sharedType, (uchar*)image.bits(), image.bytesPerLine());
+            cv::Mat dstStripe = dst.rowRange(row, row + rows);
+            if (!runPixelConversion(plan->conversion, sharedMat, dstStripe, scratch))
+                failed.fetchAndStoreRelaxed(1);
+        }
+    }
+
+    bool succeeded() const
+    {
+        return loadAtomic(failed) == 0;
+    }
+
+private:
+    const QImage &img;
+    cv::Mat &dst;
+    const ConversionPlanPrivate *plan;
+    int stripeRows;
+    mutable QAtomicInt failed;
+};
+#endif
+
+ConversionPlanPrivate::ConversionPlanPrivate()
+    : path(ConversionPlan::CP_Invalid), fromImage(true), alphaMode(AM_Raw)
+    , imageFormat(QImage::Format_Invalid), sharedFormat(QImage::Format_Invalid)
+    , sharedType(-1), sharedOrder(MCO_BGR), matType(-1), matOrder(MCO_BGR)
+    , tableKernel(0), grayColorTable(false)
+{
+    conversion.mode = PixelConversion::PC_Invalid;
+}
+
+void ConversionPlanPrivate::setupImage2Mat(QImage::Format format, const QSize &imageSize, int requiredMatType,
+                                           MatColorOrder requiredOrder, ConversionPlan::SharingMode mode)
+{
+    fromImage = true;
+    size = imageSize;
+    imageFormat = format;
+    path = ConversionPlan::CP_Invalid;
+    if (format == QImage::Format_Invalid || size.isEmpty())
+        return;
+
+    //Find the closest image format that can be shared with cv::Mat
+    sharedFormat = findClosestFormat(format);
+    sharedOrder = MCO_BGR;
+    sharedType = sharedMatType(sharedFormat, &sharedOrder);
+    if (sharedType == -1)
+        return;
+
+    int channels = CV_MAT_CN(requiredMatType);
+    if (channels == CV_CN_MAX)
+        channels = CV_MAT_CN(sharedType);
+    matType = CV_MAKETYPE(CV_MAT_DEPTH(requiredMatType), channels);
+    matOrder = requiredOrder;
+
+    //The colors are premultiplied or unpremultiplied in the same pass as
+    //the channels, or by QImage::convertToFormat() to the counterpart format.
+    if (convertsAlpha(sharedFormat, alphaMode)) {
+        if (prepareAlphaConversion(sharedType, sharedOrder, matType, matOrder,
+                                   !isPremultipliedFormat(sharedFormat), &conversion)) {
+            path = sharedFormat != format ? ConversionPlan::CP_QtFallback
+                                          : pixelConversionPath(conversion, sharedType, matType);
+            return;
+        }
+        sharedFormat = alphaCounterpartFormat(sharedFormat);
+        if (preparePixelConversion(sharedType, sharedOrder, matType, matOrder, &conversion))
+            path = ConversionPlan::CP_QtFallback;
+        return;
+    }
+
+    //Packed 16 bits pixels can be unpacked without QImage::convertToFormat()
+    if (preparePackedConversion(format, matType, matOrder, &conversion)) {
+        sharedFormat = format;
+        sharedType = CV_16UC1;
+        sharedOrder = MCO_RGBA;
+        path = ConversionPlan::CP_Unpack;
+        return;
+    }
+
+    //1 bit and indexed pixels are looked up in the color table, to the 8 bits
+    //pixels of the required channels, then the depth is converted if needed.
+    //The indices of Indexed8 image can still be shared.
+    const bool sharedIndices = mode == ConversionPlan::ShareData && matType == CV_8UC1;
+    if (isMonoFormat(format) || (format == QImage::Format_Indexed8 && !sharedIndices)) {
+        if (channelsIndex(channels) < 0)
+            return;
+        sharedFormat = format;
+        sharedType = CV_8UC(channels);
+        sharedOrder = matOrder;
+        if (isMonoFormat(format))
+            tableKernel = expandBitsRowKernels[format == QImage::Format_MonoLSB][channelsIndex(channels)];
+        else
+            tableKernel = lookupColorsRowKernels[channelsIndex(channels)];
+        if (preparePixelConversion(sharedType, sharedOrder, matType, matOrder, &conversion))
+            path = ConversionPlan::CP_Unpack;
+        return;
+    }
+
+    if (!preparePixelConversion(sharedType, sharedOrder, matType, matOrder, &conversion))
+        return;
+
+    if (sharedFormat != format)
+        path = ConversionPlan::CP_QtFallback;
+    else if (mode == ConversionPlan::ShareData && conversion.mode == PixelConversion::PC_Copy)
+        path = ConversionPlan::CP_ZeroCopy;
+    else
+        path = pixelConversionPath(conversion, sharedType, matType);
+}
+
+void ConversionPlanPrivate::setupMat2Image(int type, const QSize &matSize, MatColorOrder order,
+                                           QImage::Format formatHint, ConversionPlan::SharingMode mode)
+{
+    fromImage = false;
+    size = matSize;
+    matType = type;
+    matOrder = order;
+    path = ConversionPlan::CP_Invalid;
+    if (size.isEmpty())
+        return;
+
+    //Gray pixels are packed to 1 bit pixels without QImage::convertToFormat()
+    if (isMonoFormat(formatHint)) {
+        imageFormat = sharedFormat = formatHint;
+        sharedType = CV_8UC1;
+        sharedOrder = order;
+        tableKernel = formatHint == QImage::Format_MonoLSB ? &packBitsRow<true> : &packBitsRow<false>;
+        if (preparePixelConversion(matType, matOrder, sharedType, sharedOrder, &conversion))
+            path = ConversionPlan::CP_Unpack;
+        return;
+    }
+
+    //Find proper QImage format, and the mat type required by it.
+    sharedFormat = findMat2ImageFormat(matType, matOrder, formatHint, &sharedType, &sharedOrder);
+    const bool hasAlpha = CV_MAT_CN(matType) == 4;
+    //The premultiplied colors are kept as they are when no format is asked.
+    if (hasAlpha && alphaMode == AM_Premultiplied && formatHint == QImage::Format_Invalid
+            && convertsAlpha(sharedFormat, alphaMode)) {
+        sharedFormat = alphaCounterpartFormat(sharedFormat);
+    }
+
+    //The colors are premultiplied or unpremultiplied in the same pass as
+    //the channels, or by QImage::convertToFormat() from the counterpart format.
+    if (hasAlpha && convertsAlpha(sharedFormat, alphaMode)) {
+        if (!prepareAlphaConversion(matType, matOrder, sharedType, sharedOrder,
+                                    isPremultipliedFormat(sharedFormat), &conversion)) {
+            sharedFormat = alphaCounterpartFormat(sharedFormat);
+            if (!preparePixelConversion(matType, matOrder, sharedType, sharedOrder, &conversion))
+                return;
+        }
+    } else if (!preparePixelConversion(matType, matOrder, sharedType, sharedOrder, &conversion)) {
+        return;
+    }
+
+    //Should we convert the image to the format specified by formatHint?
+    if (sharedFormat != formatHint && formatHint != QImage::Format_Invalid) {
+        imageFormat = formatHint;
+        path = ConversionPlan::CP_QtFallback;
+        scratchImage = createImage(size.width(), size.height(), sharedFormat);
+        setDefaultColorTable(scratchImage);
+        return;
+    }
+
+    imageFormat = sharedFormat;
+    if (mode == ConversionPlan::ShareData && conversion.mode == PixelConversion::PC_Copy
+            && findSharedFormat(matType, sharedFormat) == sharedFormat)
+        path = ConversionPlan::CP_ZeroCopy;
+    else
+        path = pixelConversionPath(conversion, matType, sharedType);
+}
+
+bool ConversionPlanPrivate::image2Mat(const QImage &img, cv::Mat &dst)
+{
+    StatsScope stats(path);
+    if (!stats.isEnabled())
+        return convertImage(img, dst);
+
+    const uchar *dstData = dst.data;
+    const uchar *scratchData = scratchMat.data;
+    if (!convertImage(img, dst)) {
+        stats.setPath(ConversionPlan::CP_Invalid);
+        return false;
+    }
+    if (path != ConversionPlan::CP_ZeroCopy) {
+        stats.addBytes(qint64(dst.total() * dst.elemSize()));
+        stats.addAllocation(dstData, dst.data);
+    }
+    stats.addAllocation(scratchData, scratchMat.data);
+    if (path == ConversionPlan::CP_QtFallback)
+        stats.addAllocations(fallbackAllocations());
+    return true;
+}
+
+bool ConversionPlanPrivate::convertImage(const QImage &img, cv::Mat &dst)
+{
+    if (path == ConversionPlan::CP_Invalid || !fromImage || img.format() != imageFormat || img.size() != size)
+        return false;
+
+    if (path == ConversionPlan::CP_QtFallback) {
+        createMat(dst, size.height(), size.width(), matType);
+        return convertStripes(img, dst);
+    }
+
+    if (tableKernel)
+        return lookupColors(img, dst);
+
+    const cv::Mat sharedMat(size.height(), size.width(), sharedType, (uchar*)img.bits(), img.bytesPerLine());
+    if (path == ConversionPlan::CP_ZeroCopy) {
+        dst = sharedMat;
+        return true;
+    }
+
+    //Adjust channels and depth in one pass.
+    createMat(dst, size.height(), size.width(), matType);
+    return runPixelConversion(conversion, sharedMat, dst, scratchMat);
+}
+
+/* Look up the 1 bit or indexed pixels in the color table, and
+ * convert them to the required depth if needed.
+ */
+bool ConversionPlanPrivate::lookupColors(const QImage &img, cv::Mat &dst)
+{
+    const bool mono = isMonoFormat(imageFormat);
+    const QVector<QRgb> table = mono ? monoColorTable(img) : indexedColorTable(img);
+    if (table != colorTable) {
+        colorTable = table;
+        grayColorTable = !mono && detail::hasGrayColorTable(img);
+        //Only the first 256 colors can be indexed by 8 bits pixels.
+        buildTableColors(colorTable, qMin(int(colorTable.size()), 256), CV_MAT_CN(sharedType), sharedOrder, tableColors);
+    }
+
+    createMat(dst, size.height(), size.width(), matType);
+    cv::Mat scratch;
+
+    //Indices of gray color table are the gray pixels already.
+    if (grayColorTable && sharedType == CV_8UC1) {
+        const cv::Mat grayMat(size.height(), size.width(), CV_8UC1, (uchar*)img.bits(), img.bytesPerLine());
+        return runPixelConversion(conversion, grayMat, dst, scratch);
+    }
+
+    const cv::Mat indexMat(size.height(), img.bytesPerLine(), CV_8UC1, (uchar*)img.bits(), img.bytesPerLine());
+
+    if (conversion.mode == PixelConversion::PC_Copy) {
+        runTableRowKernel(indexMat, dst, size.width(), tableKernel, tableColors);
+        return true;
+    }
+    createMat(scratchMat, size.height(), size.width(), sharedType);
+    runTableRowKernel(indexMat, scratchMat, size.width(), tableKernel, tableColors);
+    return runPixelConversion(conversion, scratchMat, dst, scratch);
+}
+
+/* Number of images created by QImage::convertToFormat() in convertStripes()
+ */
+int ConversionPlanPrivate::fallbackAllocations() const
+{
+#if QT_VERSION >= 0x050000
+    const int stripeRows = fallbackStripeRows(size.width());
+    return (size.height() + stripeRows - 1) / stripeRows;
+#else
+    return 1;
+#endif
+}
+
+/* Convert the image to sharedFormat by Qt stripe by stripe, so that
+ * the converted stripe is still in cache when it is converted to dst.
+ */
+bool ConversionPlanPrivate::convertStripes(const QImage &img, cv::Mat &dst)
+{
+#if QT_VERSION >= 0x050000
+    const int stripeRows = fallbackStripeRows(size.width());
+    const int stripes = (size.height() + stripeRows - 1) / stripeRows;
+    const int threads = qMin(stripes, parallelStripes(size.height(), size.width()));
+    FallbackStripeBody body(img, dst, this, stripeRows);
+    if (threads > 1)
+        cv::parallel_for_(cv::Range(0, stripes), body, threads);
+    else
+        body(cv::Range(0, stripes));
+    return body.succeeded();
+#else
+    const QImage image = img.convertToFormat(sharedFormat);
+    const cv::Mat sharedMat(size.height(), size.width(), sharedType, (uchar*)image.bits(), image.bytesPerLine());
+    return runPixelConversion(conversion, sharedMat, dst, scratchMat);
+#endif
+}
+
+bool ConversionPlanPrivate::mat2Image(const cv::Mat &mat, QImage &dst)
+{
+    StatsScope stats(path);
+    if (!stats.isEnabled())
+        return convertMat(mat, dst);
+
+    const uchar *dstData = dst.constBits();
+    const uchar *scratchImageData = scratchImage.constBits();
+    const uchar *scratchData = scratchMat.data;
+    if (!convertMat(mat, dst)) {
+        stats.setPath(ConversionPlan::CP_Invalid);
+        return false;
+    }
+    if (path != ConversionPlan::CP_ZeroCopy) {
+        stats.addBytes(qint64(dst.bytesPerLine()) * dst.height());
+        stats.addAllocation(dstData, dst.constBits());
+    }
+    stats.addAllocation(scratchImageData, scratchImage.constBits());
+    stats.addAllocation(scratchData, scratchMat.data);
+    return true;
+}
+
+bool ConversionPlanPrivate::convertMat(const cv::Mat &mat, QImage &dst)
+{
+    if (path == ConversionPlan::CP_Invalid || fromImage || mat.type() != matType
+            || mat.cols != size.width() || mat.rows != size.height())
+        return false;
+
+    if (path == ConversionPlan::CP_ZeroCopy) {
+#if QT_VERSION >= 0x050000
+        dst = createSharedRefImage(mat, sharedFormat);
+#else
+        dst = createSharedImage(mat, sharedFormat);
+#endif
+        return true;
+    }
+
+    QImage image;
+    if (path == ConversionPlan::CP_QtFallback)
+        image.swap(scratchImage);
+    else
+        image.swap(dst);
+
+    //The buffer can only be reused when no one else shares it.
+    if (image.format() != sharedFormat || image.size() != size || !detail::ownsImageData(image))
+        image = createImage(size.width(), size.height(), sharedFormat);
+    //The pixels are gray or mono, whatever the color table of a reused image was.
+    setDefaultColorTable(image);
+    if (image.isNull()) {
+        dst = QImage();
+        return false;
+    }
+
+    if (tableKernel) {
+        //Pack the gray pixels to 1 bit pixels.
+        const cv::Mat *grayMat = &mat;
+        if (conversion.mode != PixelConversion::PC_Copy) {
+            cv::Mat scratch;
+            createMat(scratchMat, size.height(), size.width(), sharedType);
+            runPixelConversion(conversion, mat, scratchMat, scratch);
+            grayMat = &scratchMat;
+        }
+        cv::Mat bitsMat(image.height(), image.bytesPerLine(), CV_8UC1, image.bits(), image.bytesPerLine());
+        runTableRowKernel(*grayMat, bitsMat, size.width(), tableKernel, 0);
+    } else {
+        //Adjust mat channels and depth in one pass.
+        cv::Mat sharedMat(image.height(), image.width(), sharedType, image.bits(), image.bytesPerLine());
+        runPixelConversion(conversion, mat, sharedMat, scratchMat);
+    }
+
+    if (path == ConversionPlan::CP_QtFallback) {
+        dst = image.convertToFormat(imageFormat);
+        scratchImage.swap(image);
+    } else {
+        dst.swap(image);
+    }
+    return true;
+}
+
+/* The pixels can be converted in the buffer of the input when
+ * the channels are copied or reordered only
+ */
+bool ConversionPlanPrivate::convertsInPlace() const
+{
+    if (alphaMode != AM_Raw)
+        return false;
+    if (path == ConversionPlan::CP_Copy)
+        return true;
+    return path == ConversionPlan::CP_Swizzle && sharedType == matType && CV_MAT_CN(matType) >= 3;
+}
+
+bool ConversionPlanPrivate::takeImage(QImage &img, cv::Mat &dst)
+{
+#if CV_MAJOR_VERSION >= 3
+    if (!fromImage || !convertsInPlace() || img.format() != imageFormat || img.size() != size || !detail::ownsImageData(img))
+        return false;
+
+    StatsScope stats(path == ConversionPlan::CP_Copy ? ConversionPlan::CP_ZeroCopy : path);
+    //The holder of the QImage is allocated.
+    stats.addAllocations(1);
+    dst = takeImageData(img, matType);
+    if (path == ConversionPlan::CP_Swizzle) {
+        swizzleInPlace(dst, conversion);
+        stats.addBytes(qint64(dst.total() * dst.elemSize()));
+    }
+    return true;
+#else
+    Q_UNUSED(img);
+    Q_UNUSED(dst);
+    return false;
+#endif
+}
+
+bool ConversionPlanPrivate::takeMat(cv::Mat &mat, QImage &dst)
+{
+#if QT_VERSION >= 0x050000
+    if (fromImage || !convertsInPlace() || mat.type() != matType
+            || mat.cols != size.width() || mat.rows != size.height() || !isUniquelyOwned(mat))
+        return false;
+
+    StatsScope stats(path == ConversionPlan::CP_Copy ? ConversionPlan::CP_ZeroCopy : path);
+    //The reference of the mat is allocated.
+    stats.addAllocations(1);
+    if (path == ConversionPlan::CP_Swizzle) {
+        swizzleInPlace(mat, conversion);
+        stats.addBytes(qint64(mat.total() * mat.elemSize()));
+    }
+    dst = createSharedRefImage(mat, sharedFormat);
+    mat.release();
+    return true;
+#else
+    Q_UNUSED(mat);
+    Q_UNUSED(dst);
+    return false;
+#endif
+}
+
+/* The planes can be deinterleaved from or interleaved to the shared
+ * pixels directly when the channels are copied or reordered only
+ */
+bool ConversionPlanPrivate::convertsPlanes() const
+{
+    if (path != ConversionPlan::CP_Copy && path != ConversionPlan::CP_Swizzle)
+        return false;
+    if (alphaMode != AM_Raw || depthIndex(CV_MAT_DEPTH(matType)) < 0)
+        return false;
+    //Gray pixels are the weighted sums of the color channels.
+    const int srcChannels = CV_MAT_CN(fromImage ? sharedType : matType);
+    const int dstChannels = CV_MAT_CN(fromImage ? matType : sharedType);
+    return dstChannels > 1 || srcChannels == 1;
+}
+
+bool ConversionPlanPrivate::splitImage(const QImage &img, std::vector<cv::Mat> &planes)
+{
+    if (!fromImage || !convertsPlanes() || img.format() != imageFormat || img.size() != size)
+        return false;
+
+    StatsScope stats(path);
+    const int depth = CV_MAT_DEPTH(matType);
+    const int channels = CV_MAT_CN(matType);
+    planes.resize(channels);
+    for (int c=0; c<channels; ++c) {
+        const uchar *data = planes[c].data;
+        createMat(planes[c], size.height(), size.width(), depth);
+        stats.addAllocation(data, planes[c].data);
+        stats.addBytes(qint64(planes[c].total() * planes[c].elemSize()));
+    }
+
+    const cv::Mat sharedMat(size.height(), size.width(), sharedType, (uchar*)img.bits(), img.bytesPerLine());
+    const PlanesRowKernel kernel = splitRowKernels[depthIndex(depth)][channelsIndex(CV_MAT_CN(sharedType))]
+            [channelsIndex(channels)];
+    runPlanesRowKernel(sharedMat, planes, kernel, conversion.map, opaqueAlpha(depth));
+    return true;
+}
+
+bool ConversionPlanPrivate::mergePlanes(const std::vector<cv::Mat> &planes, QImage &dst)
+{
+    const int depth = CV_MAT_DEPTH(matType);
+    const int channels = CV_MAT_CN(matType);
+    if (fromImage || !convertsPlanes() || int(planes.size()) != channels)
+        return false;
+    for (int c=0; c<channels; ++c) {
+        if (planes[c].type() != depth || planes[c].cols != size.width() || planes[c].rows != size.height())
+            return false;
+    }
+
+    StatsScope stats(path);
+    const uchar *dstData = dst.constBits();
+    //The buffer can only be reused when no one else shares it.
+    if (dst.format() != sharedFormat || dst.size() != size || !detail::ownsImageData(dst)) {
+        dst = createImage(size.width(), size.height(), sharedFormat);
+        setDefaultColorTable(dst);
+    }
+    if (dst.isNull())
+        return false;
+    stats.addAllocation(dstData, dst.constBits());
+    stats.addBytes(qint64(dst.bytesPerLine()) * dst.height());
+
+    cv::Mat sharedMat(size.height(), size.width(), sharedType, dst.bits(), dst.bytesPerLine());
+    const PlanesRowKernel kernel = mergeRowKernels[depthIndex(depth)][channelsIndex(CV_MAT_CN(sharedType))]
+            [channelsIndex(channels)];
+    runPlanesRowKernel(sharedMat, planes, kernel, conversion.map, opaqueAlpha(depth));
+    return true;
+}
+
+/* Convert QImage to cv::Mat
+ */
+cv::Mat image2Mat(const QImage &img, int requiredMatType, MatColorOrder requriedOrder)
+{
+    cv::Mat mat;
+    image2Mat(img, mat, requiredMatType, requriedOrder);
+    return mat;
+}
+
+/* Convert QImage to cv::Mat, reuse the buffer of dst if possible
+ */
+void image2Mat(const QImage &img, cv::Mat &dst, int requiredMatType, MatColorOrder requriedOrder)
+{
+    image2Mat(img, dst, requiredMatType, requriedOrder, AM_Raw);
+}
+
+/* Convert QImage to cv::Mat of the alpha mode
+ */
+cv::Mat image2Mat(const QImage &img, int requiredMatType, MatColorOrder requiredOrder, AlphaMode alphaMode)
+{
+    cv::Mat mat;
+    image2Mat(img, mat, requiredMatType, requiredOrder, alphaMode);
+    return mat;
+}
+
+void image2Mat(const QImage &img, cv::Mat &dst, int requiredMatType, MatColorOrder requriedOrder, AlphaMode alphaMode)
+{
+    int targetDepth = CV_MAT_DEPTH(requiredMatType);
+    int targetChannels = CV_MAT_CN(requiredMatType);
+    Q_ASSERT(targetChannels==CV_CN_MAX || targetChannels==1 || targetChannels==3 || targetChannels==4);
+#ifdef CV_16F
+    Q_ASSERT(targetDepth==CV_8U || targetDepth==CV_16U || targetDepth==CV_32F || targetDepth==CV_16F);
+#else
+    Q_ASSERT(targetDepth==CV_8U || targetDepth==CV_16U || targetDepth==CV_32F);
+#endif
+
+    if (img.isNull()) {
+        dst.release();
+        return;
+    }
+
+    ConversionPlanPrivate plan;
+    plan.alphaMode = alphaMode;
+    plan.setupImage2Mat(img.format(), img.size(), requiredMatType, requriedOrder, ConversionPlan::CopyData);
+    if (!plan.image2Mat(img, dst))
+        dst.release();
+}
+
+/* Convert the color indices of QImage to cv::Mat
+ */
+cv::Mat image2Mat_indices(const QImage &img)
+{
+    cv::Mat mat;
+    image2Mat_indices(img, mat);
+    return mat;
+}
+
+/* Convert the color indices of QImage to cv::Mat, reuse the buffer of dst if possible
+ */
+void image2Mat_indices(const QImage &img, cv::Mat &dst)
+{
+    if (img.format() == QImage::Format_Indexed8) {
+        image2Mat_shared(img).copyTo(dst);
+    } else if (isMonoFormat(img.format())) {
+        static const uchar indices[2] = {0, 1};
+        const cv::Mat bitsMat(img.height(), img.bytesPerLine(), CV_8UC1, (uchar*)img.bits(), img.bytesPerLine());
+        createMat(dst, img.height(), img.width(), CV_8UC1);
+        runTableRowKernel(bitsMat, dst, img.width(), expandBitsRowKernels[img.format() == QImage::Format_MonoLSB][0], indices);
+    } else {
+        dst.release();
+    }
+}
+
+/* Convert cv::Mat to QImage
+ */
+QImage mat2Image(const cv::Mat &mat, MatColorOrder order, QImage::Format formatHint)
+{
+    QImage image;
+    mat2Image(mat, image, order, formatHint);
+    return image;
+}
+
+/* Convert cv::Mat to QImage, reuse the buffer of dst if possible
+ */
+void mat2Image(const cv::Mat &mat, QImage &dst, MatColorOrder order, QImage::Format formatHint)
+{
+    mat2Image(mat, dst, order, formatHint, AM_Raw);
+}
+
+/* Convert cv::Mat of the alpha mode to QImage
+ */
+QImage mat2Image(const cv::Mat &mat, MatColorOrder order, QImage::Format formatHint, AlphaMode alphaMode)
+{
+    QImage image;
+    mat2Image(mat, image, order, formatHint, alphaMode);
+    return image;
+}
+
+void mat2Image(const cv::Mat &mat, QImage &dst, MatColorOrder order, QImage::Format formatHint, AlphaMode alphaMode)
+{
+    Q_ASSERT(mat.channels()==1 || mat.channels()==3 || mat.channels()==4);
+#ifdef CV_16F
+    Q_ASSERT(mat.depth()==CV_8U || mat.depth()==CV_16U || mat.depth()==CV_32F || mat.depth()==CV_16F);
+#else
+    Q_ASSERT(mat.depth()==CV_8U || mat.depth()==CV_16U || mat.depth()==CV_32F);
+#endif
+
+    if (mat.empty()) {
+        dst = QImage();
+        return;
+    }
+
+    ConversionPlanPrivate plan;
+    plan.alphaMode = alphaMode;
+    plan.setupMat2Image(mat.type(), QSize(mat.cols, mat.rows), order, formatHint, ConversionPlan::CopyData);
+    if (!plan.mat2Image(mat, dst))
+        dst = QImage();
+}
+
+#if QT_VERSION >= 0x060000 || defined(Q_COMPILER_RVALUE_REFS)
+/* Convert the owned QImage to cv::Mat, take its buffer if possible
+ */
+cv::Mat image2Mat(QImage &&img, int requiredMatType, MatColorOrder requiredOrder)
+{
+    QImage image;
+    image.swap(img);
+    if (!detail::ownsImageData(image))
+        return image2Mat(image, requiredMatType, requiredOrder);
+
+    ConversionPlanPrivate plan;
+    plan.setupImage2Mat(image.format(), image.size(), requiredMatType, requiredOrder, ConversionPlan::CopyData);
+    cv::Mat mat;
+    if (!plan.takeImage(image, mat) && !plan.image2Mat(image, mat))
+        mat.release();
+    return mat;
+}
+
+/* Convert the owned cv::Mat to QImage, take its buffer if possible
+ */
+QImage mat2Image(cv::Mat &&mat, MatColorOrder order, QImage::Format formatHint)
+{
+    cv::Mat owned = mat;
+    mat.release();
+    if (owned.empty() || !isUniquelyOwned(owned))
+        return mat2Image(owned, order, formatHint);
+
+    ConversionPlanPrivate plan;
+    plan.setupMat2Image(owned.type(), QSize(owned.cols, owned.rows), order, formatHint, ConversionPlan::CopyData);
+    QImage image;
+    if (!plan.takeMat(owned, image) && !plan.mat2Image(owned, image))
+        image = QImage();
+    return image;
+}
+#endif
+
+/* Convert QImage to the planes of its channels
+ */
+std::vector<cv::Mat> image2Planes(const QImage &img, int requiredMatType, MatColorOrder requiredOrder)
+{
+    std::vector<cv::Mat> planes;
+    image2Planes(img, planes, requiredMatType, requiredOrder);
+    return planes;
+}
+
+/* Convert QImage to the planes of its channels, reuse the planes if possible
+ */
+void image2Planes(const QImage &img, std::vector<cv::Mat> &planes, int requiredMatType, MatColorOrder requiredOrder)
+{
+    if (img.isNull()) {
+        planes.clear();
+        return;
+    }
+
+    ConversionPlanPrivate plan;
+    plan.setupImage2Mat(img.format(), img.size(), requiredMatType, requiredOrder, ConversionPlan::CopyData);
+    if (plan.splitImage(img, planes))
+        return;
+
+    //Other formats and depths are converted to the pixels first,
+    //a single plane is the converted mat itself.
+    cv::Mat mat;
+    if (planes.size() == 1)
+        mat = planes[0];
+    if (!plan.image2Mat(img, mat))
+        planes.clear();
+    else if (mat.channels() == 1)
+        planes.assign(1, mat);
+    else
+        splitMat(mat, planes);
+}
+
+/* Convert the planes of the channels to QImage
+ */
+QImage planes2Image(const std::vector<cv::Mat> &planes, MatColorOrder order, QImage::Format formatHint)
+{
+    QImage image;
+    planes2Image(planes, image, order, formatHint);
+    return image;
+}
+
+/* Convert the planes of the channels to QImage, reuse the buffer of dst if possible
+ */
+void planes2Image(const std::vector<cv::Mat> &planes, QImage &dst, MatColorOrder order, QImage::Format formatHint)
+{
+    Q_ASSERT(planes.size()==1 || planes.size()==3 || planes.size()==4);
+
+    if (planes.empty() || planes[0].empty()) {
+        dst = QImage();
+        return;
+    }
+    if (planes.size() == 1) {
+        mat2Image(planes[0], dst, order, formatHint);
+        return;
+    }
+
+    const cv::Mat &first = planes[0];
+    ConversionPlanPrivate plan;
+    plan.setupMat2Image(CV_MAKETYPE(first.depth(), int(planes.size())), QSize(first.cols, first.rows),
+                        order, formatHint, ConversionPlan::CopyData);
+    if (plan.mergePlanes(planes, dst))
+        return;
+
+    //Other formats and depths are converted from the pixels.
+    cv::Mat mat;
+    if (!mergeMat(planes, mat) || !plan.mat2Image(mat, dst))
+        dst = QImage();
+}
+
+/* Convert the region of QImage to cv::Mat
+ */
+cv::Mat image2Mat(const QImage &img, const QRect &roi, int requiredMatType, MatColorOrder requiredOrder)
+{
+    cv::Mat mat;
+    image2Mat(img, mat, roi, requiredMatType, requiredOrder);
+    return mat;
+}
+
+/* Convert the region of QImage to cv::Mat, reuse the buffer of dst if possible
+ */
+void image2Mat(const QImage &img, cv::Mat &dst, const QRect &roi, int requiredMatType, MatColorOrder requiredOrder)
+{
+    const QRect rect = roi & img.rect();
+    if (img.isNull() || rect.isEmpty()) {
+        dst.release();
+        return;
+    }
+
+    //1 bit pixels are converted from the byte boundary before the region.
+    const int skip = img.depth() == 1 ? rect.x() % 8 : 0;
+    const QImage sub = subImage(img, rect.adjusted(-skip, 0, 0, 0));
+    if (!skip) {
+        image2Mat(sub, dst, requiredMatType, requiredOrder);
+        return;
+    }
+    cv::Mat mat;
+    image2Mat(sub, mat, requiredMatType, requiredOrder);
+    if (mat.empty())
+        dst.release();
+    else
+        mat(cv::Rect(skip, 0, rect.width(), rect.height())).copyTo(dst);
+}
+
+/* Convert the region of cv::Mat to QImage
+ */
+QImage mat2Image(const cv::Mat &mat, const cv::Rect &roi, MatColorOrder order, QImage::Format formatHint)
+{
+    QImage image;
+    mat2Image(mat, image, roi, order, formatHint);
+    return image;
+}
+
+/* Convert the region of cv::Mat to QImage, reuse the buffer of dst if possible
+ */
+void mat2Image(const cv::Mat &mat, QImage &dst, const cv::Rect &roi, MatColorOrder order, QImage::Format formatHint)
+{
+    const cv::Rect rect = roi & cv::Rect(0, 0, mat.cols, mat.rows);
+    if (mat.empty() || rect.width <= 0 || rect.height <= 0) {
+        dst = QImage();
+        return;
+    }
+    mat2Image(mat(rect), dst, order, formatHint);
+}
+
+/* Convert QImage to cv::Mat of the given size
+ */
+cv::Mat image2Mat(const QImage &img, const cv::Size &size, ResizeMode mode, int requiredMatType, MatColorOrder requiredOrder)
+{
+    cv::Mat mat;
+    image2Mat(img, mat, size, mode, requiredMatType, requiredOrder);
+    return mat;
+}
+
+/* Convert QImage to cv::Mat of the given size, reuse the buffer of dst if possible
+ */
+void image2Mat(const QImage &img, cv::Mat &dst, const cv::Size &size, ResizeMode mode,
+               int requiredMatType, MatColorOrder requiredOrder)
+{
+    if (img.isNull() || size.width <= 0 || size.height <= 0) {
+        dst.release();
+        return;
+    }
+
+    //Resize the pixels in the layout of the image format, then convert the
+    //resized image. The indices of Indexed8 image can not be averaged.
+    //Only the conversion of the resized image is counted in the stats.
+    const cv::Mat sharedMat = createSharedMat(img);
+    if (!sharedMat.empty() && isResizableDepth(sharedMat.depth())
+            && (img.format() != QImage::Format_Indexed8 || mode == RM_Nearest)) {
+        cv::Mat resized;
+        usePool(resized);
+        cv::resize(sharedMat, resized, size, 0, 0, resizeInterpolation(mode));
+        QImage resizedImage = createSharedImage(resized, img.format());
+        resizedImage.setColorTable(img.colorTable());
+        image2Mat(resizedImage, dst, requiredMatType, requiredOrder);
+        return;
+    }
+
+    //1 bit, packed and half float pixels are converted first.
+    cv::Mat mat;
+    image2Mat(img, mat, requiredMatType, requiredOrder);
+    if (mat.empty()) {
+        dst.release();
+        return;
+    }
+    PoolScope pool(dst);
+    if (isResizableDepth(mat.depth())) {
+        cv::resize(mat, dst, size, 0, 0, resizeInterpolation(mode));
+        return;
+    }
+
+    //Half float pixels are resized as float.
+    cv::Mat values, resized;
+    mat.convertTo(values, CV_32F);
+    cv::resize(values, resized, size, 0, 0, resizeInterpolation(mode));
+    resized.convertTo(dst, mat.depth());
+}
+
+/* Convert cv::Mat to QImage of the given size
+ */
+QImage mat2Image(const cv::Mat &mat, const QSize &size, ResizeMode mode, MatColorOrder order, QImage::Format formatHint)
+{
+    QImage image;
+    mat2Image(mat, image, size, mode, order, formatHint);
+    return image;
+}
+
+/* Convert cv::Mat to QImage of the given size, reuse the buffer of dst if possible
+ */
+void mat2Image(const cv::Mat &mat, QImage &dst, const QSize &size, ResizeMode mode,
+               MatColorOrder order, QImage::Format formatHint)
+{
+    if (mat.empty() || size.isEmpty()) {
+        dst = QImage();
+        return;
+    }
+
+    cv::Mat values = mat;
+    if (!isResizableDepth(mat.depth()))
+        mat.convertTo(values, CV_32F);
+    cv::Mat resized;
+    usePool(resized);
+    cv::resize(values, resized, cv::Size(size.width(), size.height()), 0, 0, resizeInterpolation(mode));
+    mat2Image(resized, dst, order, formatHint);
+}
+
+/* Convert cv::Mat to Indexed8 QImage of the color table
+ */
+QImage mat2Image(const cv::Mat &mat, const QVector<QRgb> &colorTable, MatColorOrder order)
+{
+    QImage image;
+    mat2Image(mat, image, colorTable, order);
+    return image;
+}
+
+/* Convert cv::Mat to Indexed8 QImage of the color table, reuse the buffer of dst if possible
+ */
+void mat2Image(const cv::Mat &mat, QImage &dst, const QVector<QRgb> &colorTable, MatColorOrder order)
+{
+    Q_ASSERT(mat.channels()==1 || mat.channels()==3 || mat.channels()==4);
+
+    if (mat.empty() || colorTable.isEmpty()) {
+        dst = QImage();
+        return;
+    }
+
+    StatsScope stats(ConversionPlan::CP_Unpack);
+
+    //The pixels are read as QRgb.
+    const MatColorOrder rgbOrder = getColorOrderOfRGB32Format();
+    PixelConversion conversion;
+    if (!preparePixelConversion(mat.type(), order, CV_8UC4, rgbOrder, &conversion)) {
+        stats.setPath(ConversionPlan::CP_Invalid);
+        dst = QImage();
+        return;
+    }
+    cv::Mat rgbMat = mat;
+    if (conversion.mode != PixelConversion::PC_Copy) {
+        cv::Mat scratch;
+        rgbMat = cv::Mat();
+        createMat(rgbMat, mat.rows, mat.cols, CV_8UC4);
+        runPixelConversion(conversion, mat, rgbMat, scratch);
+        stats.addAllocations(1);
+    }
+
+    //The buffer can only be reused when no one else shares it.
+    if (dst.format() != QImage::Format_Indexed8 || dst.width() != mat.cols || dst.height() != mat.rows
+            || !detail::ownsImageData(dst)) {
+        dst = createImage(mat.cols, mat.rows, QImage::Format_Indexed8);
+        stats.addAllocations(1);
+    }
+    if (dst.isNull()) {
+        stats.setPath(ConversionPlan::CP_Invalid);
+        return;
+    }
+    dst.setColorTable(colorTable.mid(0, 256));
+    stats.addBytes(qint64(dst.bytesPerLine()) * dst.height());
+
+    cv::Mat indexMat(dst.height(), dst.width(), CV_8UC1, dst.bits(), dst.bytesPerLine());
+    const QuantizeBody body(rgbMat, indexMat, colorTable);
+    const int stripes = parallelStripes(mat.rows, mat.cols);
+    if (stripes > 1)
+        cv::parallel_for_(cv::Range(0, mat.rows), body, stripes);
+    else
+        body(cv::Range(0, mat.rows));
+}
+
+/* Display window
+ */
+DisplayWindow::DisplayWindow(double low, double high)
+    : m_mode(DW_Fixed), m_low(low), m_high(high)
+{
+}
+
+DisplayWindow::DisplayWindow(Mode mode, double low, double high)
+    : m_mode(mode), m_low(low), m_high(high)
+{
+}
+
+DisplayWindow DisplayWindow::fromWindowLevel(double window, double level)
+{
+    return DisplayWindow(level - window / 2, level + window / 2);
+}
+
+DisplayWindow DisplayWindow::minMax()
+{
+    return DisplayWindow(DW_MinMax, 0, 100);
+}
+
+DisplayWindow DisplayWindow::percentile(double lowPercent, double highPercent)
+{
+    return DisplayWindow(DW_Percentile, lowPercent, highPercent);
+}
+
+DisplayWindow::Mode DisplayWindow::mode() const
+{
+    return m_mode;
+}
+
+double DisplayWindow::low() const
+{
+    return m_low;
+}
+
+double DisplayWindow::high() const
+{
+    return m_high;
+}
+
+DisplayWindow DisplayWindow::resolved(const cv::Mat &mat, MatColorOrder order) const
+{
+    if (m_mode == DW_Fixed || mat.empty())
+        return *this;
+
+    cv::Mat values = mat;
+#ifdef CV_16F
+    if (mat.depth() == CV_16F)
+        mat.convertTo(values, CV_32F);
+#endif
+    int alphaChannel = -1;
+    if (values.channels() == 4) {
+        int roles[4];
+        channelRoles(4, order, roles);
+        for (int c=0; c<4; ++c) {
+            if (roles[c] == CR_Alpha)
+                alphaChannel = c;
+        }
+    }
+
+    //Each stripe of rows has its own statistics, which are merged later.
+    QVector<WindowStats> stats(parallelStripes(values.rows, values.cols));
+    computeWindowStats(values, alphaChannel, stats);
+    double min = DBL_MAX;
+    double max = -DBL_MAX;
+    for (int i=0; i<stats.size(); ++i) {
+        min = qMin(min, stats[i].min);
+        max = qMax(max, stats[i].max);
+    }
+    if (min > max)
+        return DisplayWindow(0, 0);
+    if (m_mode == DW_MinMax || min == max)
+        return DisplayWindow(min, max);
+
+    //Clip the values below and above the percentiles.
+    const int bins = 4096;
+    const double scale = bins / (max - min);
+    for (int i=0; i<stats.size(); ++i) {
+        stats[i].histogramLow = min;
+        stats[i].histogramScale = scale;
+        stats[i].histogram = QVector<int>(bins, 0);
+    }
+    computeWindowStats(values, alphaChannel, stats);
+    QVector<qint64> histogram(bins, 0);
+    qint64 total = 0;
+    for (int i=0; i<stats.size(); ++i) {
+        for (int bin=0; bin<bins; ++bin)
+            histogram[bin] += stats[i].histogram[bin];
+    }
+    for (int bin=0; bin<bins; ++bin)
+        total += histogram[bin];
+
+    const double lowCount = total * qBound(0.0, m_low, 100.0) / 100;
+    const double highCount = total * (100 - qBound(0.0, m_high, 100.0)) / 100;
+    int lowBin = 0;
+    qint64 count = 0;
+    while (lowBin < bins - 1 && count + histogram[lowBin] <= lowCount)
+        count += histogram[lowBin++];
+    int highBin = bins - 1;
+    count = 0;
+    while (highBin > lowBin && count + histogram[highBin] <= highCount)
+        count += histogram[highBin--];
+    return DisplayWindow(min + lowBin / scale, min + (highBin + 1) / scale);
+}
+
+/* Convert cv::Mat to 8 bits QImage through the display window
+ */
+QImage mat2Image(const cv::Mat &mat, const DisplayWindow &window, MatColorOrder order, QImage::Format formatHint)
+{
+    QImage image;
+    mat2Image(mat, image, window, order, formatHint);
+    return image;
+}
+
+/* Convert cv::Mat to 8 bits QImage through the display window, reuse the buffer of dst if possible
+ */
+void mat2Image(const cv::Mat &mat, QImage &dst, const DisplayWindow &window, MatColorOrder order, QImage::Format formatHint)
+{
+    Q_ASSERT(mat.channels()==1 || mat.channels()==3 || mat.channels()==4);
+
+    if (mat.empty()) {
+        dst = QImage();
+        return;
+    }
+
+    StatsScope stats(ConversionPlan::CP_DepthConvert);
+    cv::Mat values = mat;
+#ifdef CV_16F
+    if (mat.depth() == CV_16F) {
+        mat.convertTo(values, CV_32F);
+        stats.addAllocations(1);
+    }
+#endif
+    const DisplayWindow fixedWindow = window.resolved(values, order);
+
+    //Same format as the one of the CV_8U mat.
+    int sharedType;
+    MatColorOrder sharedOrder;
+    const QImage::Format format = findMat2ImageFormat(CV_8UC(values.channels()), order, formatHint,
+                                                      &sharedType, &sharedOrder);
+    const int sd = depthIndex(values.depth());
+    const int sc = channelsIndex(values.channels());
+    const int dc = channelsIndex(CV_MAT_CN(sharedType));
+    if (sd < 0 || sc < 0 || dc < 0) {
+        stats.setPath(ConversionPlan::CP_Invalid);
+        dst = QImage();
+        return;
+    }
+
+    int map[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    buildChannelMap(values.channels(), order, CV_MAT_CN(sharedType), sharedOrder, map);
+    if (values.channels() == 4 && CV_MAT_CN(sharedType) != 1) {
+        int roles[4];
+        channelRoles(4, order, roles);
+        for (int c=0; c<CV_MAT_CN(sharedType); ++c)
+            map[4 + c] = map[c] >= 0 && roles[map[c]] == CR_Alpha;
+    }
+
+    //The buffer can only be reused when no one else shares it.
+    const bool convertedByQt = formatHint != QImage::Format_Invalid && formatHint != format;
+    QImage image;
+    if (!convertedByQt)
+        image.swap(dst);
+    if (image.format() != format || image.width() != values.cols || image.height() != values.rows
+            || !detail::ownsImageData(image)) {
+        image = createImage(values.cols, values.rows, format);
+        setDefaultColorTable(image);
+        stats.addAllocations(1);
+    }
+    if (image.isNull()) {
+        stats.setPath(ConversionPlan::CP_Invalid);
+        dst = QImage();
+        return;
+    }
+
+    const double low = fixedWindow.low();
+    const double high = fixedWindow.high();
+    const double scale = high > low ? 255.0 / (high - low) : 0.0;
+    cv::Mat sharedMat(image.height(), image.width(), sharedType, image.bits(), image.bytesPerLine());
+    runRowKernel(values, sharedMat, windowRowKernels[currentCpuLevel()][sd][sc][dc], map, scale, low);
+
+    if (convertedByQt) {
+        dst = image.convertToFormat(formatHint);
+        stats.addAllocations(1);
+    } else {
+        dst.swap(image);
+    }
+    stats.addBytes(qint64(dst.bytesPerLine()) * dst.height());
+}
+
+/* Convert QImage to cv::Mat without data copy
+ */
+cv::Mat image2Mat_shared(const QImage &img, MatColorOrder *order)
+{
+    if (img.isNull())
+        return cv::Mat();
+
+    StatsScope stats(ConversionPlan::CP_ZeroCopy);
+    const cv::Mat mat = createSharedMat(img, order);
+    if (mat.empty())
+        stats.setPath(ConversionPlan::CP_Invalid);
+    return mat;
+}
+
+/* Convert the region of QImage to cv::Mat without data copy
+ */
+cv::Mat image2Mat_shared(const QImage &img, const QRect &roi, MatColorOrder *order)
+{
+    const QRect rect = roi & img.rect();
+    if (img.isNull() || rect.isEmpty() || img.depth() < 8)
+        return cv::Mat();
+    return image2Mat_shared(subImage(img, rect), order);
+}
+
+/* Convert  cv::Mat to QImage without data copy
+ */
+QImage mat2Image_shared(const cv::Mat &mat, QImage::Format formatHint)
+{
+    Q_ASSERT(mat.type() == CV_8UC1 || mat.type() == CV_8UC3 || mat.type() == CV_8UC4
+#if QT_VERSION >= 0x050D00
+             || mat.type() == CV_16UC1
+#endif
+#if QT_VERSION >= 0x050C00
+             || mat.type() == CV_16UC4
+#endif
+#if QT_VERSION >= 0x060200
+             || mat.type() == CV_32FC4
+#ifdef CV_16F
+             || mat.type() == CV_MAKETYPE(CV_16F, 4)
+#endif
+#endif
+             );
+
+    if (mat.empty())
+        return QImage();
+
+    StatsScope stats(ConversionPlan::CP_ZeroCopy);
+    const QImage::Format format = findSharedFormat(mat.type(), formatHint);
+    if (format == QImage::Format_Invalid) {
+        stats.setPath(ConversionPlan::CP_Invalid);
+        return QImage();
+    }
+    return createSharedImage(mat, format);
+}
+
+/* Convert CV_8UC1 cv::Mat to Indexed8 QImage of the color table without data copy
+ */
+QImage mat2Image_shared(const cv::Mat &mat, const QVector<QRgb> &colorTable)
+{
+    Q_ASSERT(mat.type() == CV_8UC1);
+
+    if (mat.empty() || mat.type() != CV_8UC1)
+        return QImage();
+
+    StatsScope stats(ConversionPlan::CP_ZeroCopy);
+    QImage img = createSharedImage(mat, QImage::Format_Indexed8);
+    img.setColorTable(colorTable);
+    return img;
+}
+
+#if QT_VERSION >= 0x050000
+/* Convert  cv::Mat to QImage without data copy, and keep the mat alive
+ */
+QImage mat2Image_sharedRef(const cv::Mat &mat, QImage::Format formatHint)
+{
+    Q_ASSERT(mat.type() == CV_8UC1 || mat.type() == CV_8UC3 || mat.type() == CV_8UC4
+#if QT_VERSION >= 0x050D00
+             || mat.type() == CV_16UC1
+#endif
+#if QT_VERSION >= 0x050C00
+             || mat.type() == CV_16UC4
+#endif
+#if QT_VERSION >= 0x060200
+             || mat.type() == CV_32FC4
+#ifdef CV_16F
+             || mat.type() == CV_MAKETYPE(CV_16F, 4)
+#endif
+#endif
+             );
+
+    if (mat.empty())
+        return QImage();
+
+    StatsScope stats(ConversionPlan::CP_ZeroCopy);
+    const QImage::Format format = findSharedFormat(mat.type(), formatHint);
+    if (format == QImage::Format_Invalid) {
+        stats.setPath(ConversionPlan::CP_Invalid);
+        return QImage();
+    }
+    //The reference of the mat is allocated.
+    stats.addAllocations(1);
+    return createSharedRefImage(mat, format);
+}
+#endif
+
+#if QT_VERSION >= 0x050000
+/* Convert CV_8UC1 cv::Mat to Indexed8 QImage of the color table without data copy,
+ * and keep the mat alive
+ */
+QImage mat2Image_sharedRef(const cv::Mat &mat, const QVector<QRgb> &colorTable)
+{
+    Q_ASSERT(mat.type() == CV_8UC1);
+
+    if (mat.empty() || mat.type() != CV_8UC1)
+        return QImage();
+
+    StatsScope stats(ConversionPlan::CP_ZeroCopy);
+    stats.addAllocations(1);
+    QImage img = createSharedRefImage(mat, QImage::Format_Indexed8);
+    img.setColorTable(colorTable);
+    return img;
+}
+#endif
+
+#if CV_MAJOR_VERSION >= 3
+/* Color table of the OpenCV colormap
+ */
+QVector<QRgb> colorMapTable(int colorMap)
+{
+    cv::Mat gray(1, 256, CV_8UC1);
+    for (int i=0; i<256; ++i)
+        gray.at<uchar>(0, i) = uchar(i);
+    cv::Mat bgr;
+    cv::applyColorMap(gray, bgr, colorMap);
+
+    QVector<QRgb> colorTable;
+    colorTable.reserve(256);
+    for (int i=0; i<256; ++i) {
+        const cv::Vec3b &color = bgr.at<cv::Vec3b>(0, i);
+        colorTable.append(qRgb(color[2], color[1], color[0]));
+    }
+    return colorTable;
+}
+#endif
+
+#ifdef QT_CONCURRENT_LIB
+/* Convert QImages to cv::Mats by the threads of the global pool
+ */
+QFuture<cv::Mat> image2MatBatch(const QVector<QImage> &images, int requiredMatType, MatColorOrder requiredOrder)
+{
+    return QtConcurrent::mapped(images, Image2MatFunctor(requiredMatType, requiredOrder));
+}
+
+/* Convert cv::Mats to QImages by the threads of the global pool
+ */
+QFuture<QImage> mat2ImageBatch(const std::vector<cv::Mat> &mats, MatColorOrder order, QImage::Format formatHint)
+{
+    return QtConcurrent::mapped(mats, Mat2ImageFunctor(order, formatHint));
+}
+
+/* Convert QImage to cv::Mat by a thread of the global pool
+ */
+QFuture<cv::Mat> image2MatAsync(const QImage &img, int requiredMatType, MatColorOrder requiredOrder)
+{
+    //Unlike QtConcurrent::run(), the future of mapped() can be canceled.
+    return image2MatBatch(QVector<QImage>(1, img), requiredMatType, requiredOrder);
+}
+
+/* Convert cv::Mat to QImage by a thread of the global pool
+ */
+QFuture<QImage> mat2ImageAsync(const cv::Mat &mat, MatColorOrder order, QImage::Format formatHint)
+{
+    return mat2ImageBatch(std::vector<cv::Mat>(1, mat), order, formatHint);
+}
+#endif
+
+/* Settings of the row parallel conversion
+ */
+void setParallelThreshold(int pixels)
+{
+    parallelThresholdSetting.fetchAndStoreRelaxed(pixels);
+}
+
+int parallelThreshold()
+{
+    return loadAtomic(parallelThresholdSetting);
+}
+
+void setMaxParallelThreads(int threads)
+{
+    maxParallelThreadsSetting.fetchAndStoreRelaxed(threads);
+}
+
+int maxParallelThreads()
+{
+    return loadAtomic(maxParallelThreadsSetting);
+}
+
+/* Instruction sets of the conversion kernels
+ */
+void setCpuLevel(CpuLevel level)
+{
+    cpuLevelSetting.fetchAndStoreRelaxed(level == CPU_Auto ? -1 : supportedCpuLevel(level));
+}
+
+CpuLevel cpuLevel()
+{
+    return CpuLevel(currentCpuLevel());
+}
+
+const char *cpuLevelName(CpuLevel level)
+{
+    switch (level) {
+    case CPU_Baseline:
+        return "baseline";
+    case CPU_SSSE3:
+        return "ssse3";
+    case CPU_AVX2:
+        return "avx2";
+    case CPU_NEON:
+        return "neon";
+    default:
+        return "auto";
+    }
+}
+
+/* Counters of the conversions
+ */
+void setConversionStatsEnabled(bool enabled)
+{
+    conversionStatsSetting.fetchAndStoreRelaxed(enabled ? 1 : 0);
+}
+
+bool conversionStatsEnabled()
+{
+    return loadAtomic(conversionStatsSetting) != 0;
+}
+
+ConversionStats conversionStats(ConversionPlan::Path path)
+{
+    if (path < 0 || path >= conversionPathCount)
+        return ConversionStats();
+    QMutexLocker locker(&conversionStatsMutex);
+    return conversionStatsTable[path];
+}
+
+void resetConversionStats()
+{
+    QMutexLocker locker(&conversionStatsMutex);
+    for (int i=0; i<conversionPathCount; ++i)
+        conversionStatsTable[i] = ConversionStats();
+}
+
+/* Pool of the buffers used by the conversions
+ */
+void setBufferPoolEnabled(bool enabled)
+{
+    bufferPoolSetting.fetchAndStoreRelaxed(enabled ? 1 : 0);
+}
+
+bool bufferPoolEnabled()
+{
+    return loadAtomic(bufferPoolSetting) != 0;
+}
+
+cv::MatAllocator *bufferPoolAllocator()
+{
+#if CV_MAJOR_VERSION >= 3
+    static PoolMatAllocator *allocator = new PoolMatAllocator;
+    return allocator;
+#else
+    return 0;
+#endif
+}
+
+#if QT_VERSION >= 0x050400
+QImage createPooledImage(const QSize &size, QImage::Format format)
+{
+    if (size.isEmpty() || format == QImage::Format_Invalid)
+        return QImage();
+
+    //Lines are 32 bits aligned, same as QImage.
+    const qint64 depth = QImage::toPixelFormat(format).bitsPerPixel();
+    const qint64 bytesPerLine = ((size.width() * depth + 31) >> 5) << 2;
+    if (bytesPerLine > INT_MAX)
+        return QImage();
+    void *data = bufferPool().acquire(size_t(bytesPerLine * size.height()));
+    return QImage(static_cast<uchar *>(data), size.width(), size.height(), int(bytesPerLine), format,
+                  releasePooledBuffer, data);
+}
+#endif
+
+BufferPoolStats bufferPoolStats()
+{
+    return bufferPool().statistics();
+}
+
+void trimBufferPool(qint64 maxCachedBytes)
+{
+    bufferPool().trim(maxCachedBytes);
+}
+
+/* Conversion plan of QImage ==> cv::Mat
+ */
+ConversionPlan::ConversionPlan(QImage::Format format, const QSize &size, int requiredMatType,
+                               MatColorOrder requiredOrder, SharingMode mode, AlphaMode alphaMode)
+    : d(new ConversionPlanPrivate)
+{
+    d->alphaMode = alphaMode;
+    d->setupImage2Mat(format, size, requiredMatType, requiredOrder, mode);
+}
+
+/* Conversion plan of cv::Mat ==> QImage
+ */
+ConversionPlan::ConversionPlan(int matType, const QSize &size, MatColorOrder order,
+                               QImage::Format formatHint, SharingMode mode, AlphaMode alphaMode)
+    : d(new ConversionPlanPrivate)
+{
+    d->alphaMode = alphaMode;
+    d->setupMat2Image(matType, size, order, formatHint, mode);
+}
+
+ConversionPlan::~ConversionPlan()
+{
+    delete d;
+}
+
+bool ConversionPlan::isValid() const
+{
+    return d->path != CP_Invalid;
+}
+
+ConversionPlan::Path ConversionPlan::path() const
+{
+    return d->path;
+}
+
+QImage::Format ConversionPlan::imageFormat() const
+{
+    return d->imageFormat;
+}
+
+int ConversionPlan::matType() const
+{
+    return d->matType;
+}
+
+QSize ConversionPlan::size() const
+{
+    return d->size;
+}
+
+bool ConversionPlan::convert(const QImage &img, cv::Mat &dst)
+{
+    return d->image2Mat(img, dst);
+}
+
+bool ConversionPlan::convert(const cv::Mat &mat, QImage &dst)
+{
+    return d->mat2Image(mat, dst);
 }
 
 } //namespace QtOcv
@@ -27,6 +27,10 @@
 #define CVMATANDQIMAGE_H
 
 #include <QtGui/qimage.h>
+#ifdef QT_CONCURRENT_LIB
+#include <QtCore/qfuture.h>
+#endif
+#include <vector>
 #include <opencv2/core/core.hpp>
 
 namespace QtOcv {
@@ -51,13 +55,212 @@ enum MatColorOrder {
  *     - CV_8U  [0, 255]
  *     - CV_16U [0, 65535]
  *     - CV_32F [0, 1.0]
+ *     - CV_16F [0, 1.0] (OpenCV 4)
  *
  * - QImage
  *   - All of the formats of QImage are supported.
+ *   - When formatHint is QImage::Format_Invalid, a (B G R) mat is converted
+ *     to QImage::Format_BGR888 under Qt 5.14 or newer, which needs no
+ *     channels swapping.
+ *   - When formatHint is QImage::Format_Invalid, a CV_16U mat is converted
+ *     to QImage::Format_Grayscale16 (Qt 5.13), QImage::Format_RGBX64 or
+ *     QImage::Format_RGBA64 (Qt 5.12) without losing precision.
+ *   - When formatHint is QImage::Format_Invalid, a CV_32F or CV_16F color
+ *     mat is converted to QImage::Format_RGBX32FPx4, QImage::Format_RGBA32FPx4,
+ *     QImage::Format_RGBX16FPx4 or QImage::Format_RGBA16FPx4 (Qt 6.2).
+ *   - QImage::Format_Indexed8, QImage::Format_Mono and QImage::Format_MonoLSB
+ *     images are expanded through their color tables, the indices of an
+ *     Indexed8 image without color table are gray. When formatHint is QImage::Format_Mono
+ *     or QImage::Format_MonoLSB, the gray pixels of 128 or more are set,
+ *     and the color table is (black, white).
  */
 cv::Mat image2Mat(const QImage &img, int requiredMatType = CV_8UC(0), MatColorOrder requiredOrder=MCO_BGR);
 QImage mat2Image(const cv::Mat &mat, MatColorOrder order=MCO_BGR, QImage::Format formatHint = QImage::Format_Invalid);
 
+/* Same as above, but write the result to dst
+ *
+ * - The buffer of dst is reused when its size, type or format
+ *   matches the result, so converting frames of a video stream
+ *   does not allocate memory once the first frame is done.
+ * - A QImage buffer shared with other QImage copies is never
+ *   overwritten, a new one will be allocated instead.
+ */
+void image2Mat(const QImage &img, cv::Mat &dst, int requiredMatType = CV_8UC(0), MatColorOrder requiredOrder=MCO_BGR);
+void mat2Image(const cv::Mat &mat, QImage &dst, MatColorOrder order=MCO_BGR, QImage::Format formatHint = QImage::Format_Invalid);
+
+#if QT_VERSION >= 0x060000 || defined(Q_COMPILER_RVALUE_REFS)
+/* Same as above, but the input is an owned temporary, such as the result
+ * of QImage::scaled() or cv::imread(), or is passed by std::move()
+ *
+ * - When the buffer of the input is not shared with other copies, and
+ *   the channels are copied or reordered only, such as (R G B) <==> (B G R)
+ *   or (A R G B) <==> (B G R A), the channels are reordered in place and
+ *   the result takes the buffer, so no pixel buffer is allocated.
+ * - The taking of a QImage needs OpenCV 3, the taking of a cv::Mat needs Qt 5.
+ * - The input is empty when the function returns.
+ */
+cv::Mat image2Mat(QImage &&img, int requiredMatType = CV_8UC(0), MatColorOrder requiredOrder=MCO_BGR);
+QImage mat2Image(cv::Mat &&mat, MatColorOrder order=MCO_BGR, QImage::Format formatHint = QImage::Format_Invalid);
+#endif
+
+/* How the colors of the pixels with alpha are stored in the mat
+ *
+ * - AM_Raw: the colors are copied as the QImage format stores them, they
+ *   are premultiplied for QImage::Format_ARGB32_Premultiplied and the other
+ *   premultiplied formats. This is what the functions without an AlphaMode
+ *   parameter and the _shared functions do.
+ * - AM_Straight: the colors of the mat are not multiplied by alpha.
+ * - AM_Premultiplied: the colors of the mat are multiplied by alpha. When
+ *   formatHint is QImage::Format_Invalid, a mat with alpha channel is
+ *   converted to the premultiplied format, such as
+ *   QImage::Format_ARGB32_Premultiplied, so the colors are kept as they are.
+ * - 8 bits colors are multiplied or divided by alpha in the same pass as
+ *   the channels are reordered. The other depths are premultiplied or
+ *   unpremultiplied by QImage::convertToFormat().
+ */
+enum AlphaMode {
+    AM_Raw,
+    AM_Straight,
+    AM_Premultiplied
+};
+
+cv::Mat image2Mat(const QImage &img, int requiredMatType, MatColorOrder requiredOrder, AlphaMode alphaMode);
+void image2Mat(const QImage &img, cv::Mat &dst, int requiredMatType, MatColorOrder requiredOrder, AlphaMode alphaMode);
+QImage mat2Image(const cv::Mat &mat, MatColorOrder order, QImage::Format formatHint, AlphaMode alphaMode);
+void mat2Image(const cv::Mat &mat, QImage &dst, MatColorOrder order, QImage::Format formatHint, AlphaMode alphaMode);
+
+/* Convert a region of QImage to/from cv::Mat
+ *
+ * - Only the pixels of the region are converted, the region is clipped
+ *   to the image or the mat.
+ * - The region of a cv::Mat is shared by mat(roi), so mat2Image_shared()
+ *   can be used with it too. image2Mat_shared() below shares the region
+ *   of a QImage, except for 1 bit images.
+ */
+cv::Mat image2Mat(const QImage &img, const QRect &roi, int requiredMatType = CV_8UC(0), MatColorOrder requiredOrder=MCO_BGR);
+void image2Mat(const QImage &img, cv::Mat &dst, const QRect &roi, int requiredMatType = CV_8UC(0),
+               MatColorOrder requiredOrder=MCO_BGR);
+QImage mat2Image(const cv::Mat &mat, const cv::Rect &roi, MatColorOrder order=MCO_BGR,
+                 QImage::Format formatHint = QImage::Format_Invalid);
+void mat2Image(const cv::Mat &mat, QImage &dst, const cv::Rect &roi, MatColorOrder order=MCO_BGR,
+               QImage::Format formatHint = QImage::Format_Invalid);
+
+/* Convert QImage to/from cv::Mat of another size, such as a preview or
+ * an image which fits the view
+ *
+ * - The pixels are resized before they are converted when the format
+ *   allows, so only the pixels of the result are converted.
+ * - RM_Area averages the source pixels of each result pixel, which is
+ *   the best for shrinking. RM_Nearest picks one of them, which is faster,
+ *   and keeps the color indices of Indexed8 images.
+ * - The aspect ratio is not kept, use QSize::scaled() to find the size.
+ */
+enum ResizeMode {
+    RM_Nearest,
+    RM_Area
+};
+
+cv::Mat image2Mat(const QImage &img, const cv::Size &size, ResizeMode mode = RM_Area, int requiredMatType = CV_8UC(0),
+                  MatColorOrder requiredOrder=MCO_BGR);
+void image2Mat(const QImage &img, cv::Mat &dst, const cv::Size &size, ResizeMode mode = RM_Area,
+               int requiredMatType = CV_8UC(0), MatColorOrder requiredOrder=MCO_BGR);
+QImage mat2Image(const cv::Mat &mat, const QSize &size, ResizeMode mode = RM_Area, MatColorOrder order=MCO_BGR,
+                 QImage::Format formatHint = QImage::Format_Invalid);
+void mat2Image(const cv::Mat &mat, QImage &dst, const QSize &size, ResizeMode mode = RM_Area,
+               MatColorOrder order=MCO_BGR, QImage::Format formatHint = QImage::Format_Invalid);
+
+/* Convert QImage to/from the planes of its channels, such as the
+ * (B G R) planes of cv::split()
+ *
+ * - The channels are deinterleaved to, or interleaved from, the planes
+ *   in one pass when the format has the depth of the planes. The others
+ *   are converted to the pixels of requiredMatType first.
+ * - The planes are single channel mats in the channels order given, the
+ *   number of planes is the number of channels of requiredMatType.
+ * - The planes in the vector are reused when their size and type match.
+ * - The planes given to planes2Image() must have the same size and type.
+ */
+std::vector<cv::Mat> image2Planes(const QImage &img, int requiredMatType = CV_8UC(0), MatColorOrder requiredOrder=MCO_BGR);
+void image2Planes(const QImage &img, std::vector<cv::Mat> &planes, int requiredMatType = CV_8UC(0),
+                  MatColorOrder requiredOrder=MCO_BGR);
+QImage planes2Image(const std::vector<cv::Mat> &planes, MatColorOrder order=MCO_BGR,
+                    QImage::Format formatHint = QImage::Format_Invalid);
+void planes2Image(const std::vector<cv::Mat> &planes, QImage &dst, MatColorOrder order=MCO_BGR,
+                  QImage::Format formatHint = QImage::Format_Invalid);
+
+/* Convert the color indices of QImage::Format_Indexed8, QImage::Format_Mono
+ * and QImage::Format_MonoLSB image to CV_8UC1 mat
+ *
+ * - The color table is not used, so the pixels of a 1 bit image are 0 or 1.
+ *   image2Mat() converts the pixels through the color table instead, the
+ *   pixels of a black and white image are 0 or 255.
+ * - An empty mat is returned for the images of other formats.
+ */
+cv::Mat image2Mat_indices(const QImage &img);
+void image2Mat_indices(const QImage &img, cv::Mat &dst);
+
+/* Convert cv::Mat to QImage::Format_Indexed8 image of the given color table
+ *
+ * - Each pixel is mapped to the closest color of the color table, the
+ *   results are cached, so the search is done once for each color.
+ * - Only the first 256 colors of the color table are used.
+ */
+QImage mat2Image(const cv::Mat &mat, const QVector<QRgb> &colorTable, MatColorOrder order=MCO_BGR);
+void mat2Image(const cv::Mat &mat, QImage &dst, const QVector<QRgb> &colorTable, MatColorOrder order=MCO_BGR);
+
+/* Window of the values of the mat, which is mapped to [0, 255] by mat2Image()
+ *
+ * - DisplayWindow(low, high) maps [low, high] to [0, 255], the values out of
+ *   the window are saturated. The values are the raw values of the mat, such
+ *   as [0, 4095] for the 12 bits data of a CV_16U mat.
+ * - fromWindowLevel() is the same, with the width and the center of the window.
+ * - minMax() uses the minimum and maximum values of the mat, percentile()
+ *   uses the values at the given percentiles of the histogram of the mat,
+ *   so that a few outliers don't squeeze the other values.
+ * - The alpha channel is not windowed, and is not counted by the statistics.
+ */
+class DisplayWindow
+{
+public:
+    enum Mode {
+        DW_Fixed,
+        DW_MinMax,
+        DW_Percentile
+    };
+
+    DisplayWindow(double low, double high);
+    static DisplayWindow fromWindowLevel(double window, double level);
+    static DisplayWindow minMax();
+    static DisplayWindow percentile(double lowPercent, double highPercent);
+
+    Mode mode() const;
+    //Values of the window, or the percentiles for DW_MinMax and DW_Percentile
+    double low() const;
+    double high() const;
+
+    //The fixed window found from the statistics of the mat
+    DisplayWindow resolved(const cv::Mat &mat, MatColorOrder order=MCO_BGR) const;
+
+private:
+    DisplayWindow(Mode mode, double low, double high);
+
+    Mode m_mode;
+    double m_low;
+    double m_high;
+};
+
+/* Convert CV_8U, CV_16U or CV_32F mat to 8 bits QImage through the display window
+ *
+ * - The statistics of the window are computed in parallel, then the window is
+ *   applied while the pixels are written to the QImage, so no normalized
+ *   intermediate mat is needed.
+ * - The QImage format is chosen the same way as mat2Image() of a CV_8U mat.
+ */
+QImage mat2Image(const cv::Mat &mat, const DisplayWindow &window, MatColorOrder order=MCO_BGR,
+                 QImage::Format formatHint = QImage::Format_Invalid);
+void mat2Image(const cv::Mat &mat, QImage &dst, const DisplayWindow &window, MatColorOrder order=MCO_BGR,
+               QImage::Format formatHint = QImage::Format_Invalid);
+
 /* Convert QImage to/from cv::Mat without data copy
  *
  * - Supported QImage formats and cv::Mat types are:
@@ -65,12 +268,23 @@ QImage mat2Image(const cv::Mat &mat, MatColorOrder order=MCO_BGR, QImage::Format
  *   - QImage::Format_Alpha8                 <==> CV_8UC1
  *   - QImage::Format_Grayscale8             <==> CV_8UC1
  *   - QImage::Format_RGB888                 <==> CV_8UC3 (R G B)
+ *   - QImage::Format_BGR888                 <==> CV_8UC3 (B G R)
  *   - QImage::Format_RGB32                  <==> CV_8UC4 (A R G B or B G R A)
  *   - QImage::Format_ARGB32                 <==> CV_8UC4 (A R G B or B G R A)
  *   - QImage::Format_ARGB32_Premultiplied   <==> CV_8UC4 (A R G B or B G R A)
  *   - QImage::Format_RGBX8888               <==> CV_8UC4 (R G B A)
  *   - QImage::Format_RGBA8888               <==> CV_8UC4 (R G B A)
  *   - QImage::Format_RGBA8888_Premultiplied <==> CV_8UC4 (R G B A)
+ *   - QImage::Format_Grayscale16            <==> CV_16UC1
+ *   - QImage::Format_RGBX64                 <==> CV_16UC4 (R G B A)
+ *   - QImage::Format_RGBA64                 <==> CV_16UC4 (R G B A)
+ *   - QImage::Format_RGBA64_Premultiplied   <==> CV_16UC4 (R G B A)
+ *   - QImage::Format_RGBX32FPx4             <==> CV_32FC4 (R G B A)
+ *   - QImage::Format_RGBA32FPx4             <==> CV_32FC4 (R G B A)
+ *   - QImage::Format_RGBA32FPx4_Premultiplied <==> CV_32FC4 (R G B A)
+ *   - QImage::Format_RGBX16FPx4             <==> CV_16FC4 (R G B A)
+ *   - QImage::Format_RGBA16FPx4             <==> CV_16FC4 (R G B A)
+ *   - QImage::Format_RGBA16FPx4_Premultiplied <==> CV_16FC4 (R G B A)
  *
  * - For QImage::Format_RGB32 ,QImage::Format_ARGB32
  *   and QImage::Format_ARGB32_Premultiplied, the
@@ -79,10 +293,527 @@ QImage mat2Image(const cv::Mat &mat, MatColorOrder order=MCO_BGR, QImage::Format
  *
  * - User must make sure that the color channels order is the same as
  *   the color channels order requried by QImage.
+ *
+ * - The colors of the premultiplied formats are shared as they are, use
+ *   image2Mat() or mat2Image() with AM_Straight to get or give straight alpha.
+ *
+ * - mat2Image_shared() returns a null QImage for the types which can't be
+ *   shared with this Qt version, such as CV_16UC4 before Qt 5.12, or
+ *   CV_32FC4 and CV_16FC4 before Qt 6.2.
  */
 cv::Mat image2Mat_shared(const QImage &img, MatColorOrder *order=0);
+cv::Mat image2Mat_shared(const QImage &img, const QRect &roi, MatColorOrder *order=0);
 QImage mat2Image_shared(const cv::Mat &mat, QImage::Format formatHint = QImage::Format_Invalid);
 
+/* Convert CV_8UC1 cv::Mat to QImage::Format_Indexed8 image of the given
+ * color table without data copy
+ *
+ * - The pixels of the mat are used as the color indices, so single channel
+ *   data can be displayed in false color without any pass over the pixels.
+ * - The color table can be a custom one, or the one of an OpenCV colormap,
+ *   see colorMapTable(). Keep it and pass it for each frame, the table is
+ *   shared by the images.
+ */
+QImage mat2Image_shared(const cv::Mat &mat, const QVector<QRgb> &colorTable);
+#if QT_VERSION >= 0x050000
+QImage mat2Image_sharedRef(const cv::Mat &mat, const QVector<QRgb> &colorTable);
+#endif
+
+#if CV_MAJOR_VERSION >= 3
+/* Color table of the OpenCV colormap, such as cv::COLORMAP_JET
+ */
+QVector<QRgb> colorMapTable(int colorMap);
+#endif
+
+#if QT_VERSION >= 0x050000
+/* Same as mat2Image_shared(), but the returned QImage holds a reference
+ * of the cv::Mat until the QImage and all of its copies are destroyed.
+ *
+ * - The QImage can outlive the cv::Mat, and can be passed to other
+ *   threads or queued signals without copying any data.
+ * - Don't write the data of the cv::Mat (for example, by capturing the
+ *   next frame into the same cv::Mat) while the QImage is in use.
+ */
+QImage mat2Image_sharedRef(const cv::Mat &mat, QImage::Format formatHint = QImage::Format_Invalid);
+#endif
+
+#ifdef QT_CONCURRENT_LIB
+/* Batch and asynchronous conversions (QT += concurrent)
+ *
+ * - The images or mats are converted by the threads of
+ *   QThreadPool::globalInstance(), the functions return at once.
+ * - The results of the batch functions are in the same order as the
+ *   inputs, QFuture::results() waits for all of them.
+ * - QFuture::cancel() skips the conversions not started yet, the
+ *   results of them are missing.
+ * - The mats share data with the inputs until they are converted,
+ *   so don't write the data of the inputs before the future is finished.
+ */
+QFuture<cv::Mat> image2MatBatch(const QVector<QImage> &images, int requiredMatType = CV_8UC(0),
+                                MatColorOrder requiredOrder=MCO_BGR);
+QFuture<QImage> mat2ImageBatch(const std::vector<cv::Mat> &mats, MatColorOrder order=MCO_BGR,
+                               QImage::Format formatHint = QImage::Format_Invalid);
+QFuture<cv::Mat> image2MatAsync(const QImage &img, int requiredMatType = CV_8UC(0), MatColorOrder requiredOrder=MCO_BGR);
+QFuture<QImage> mat2ImageAsync(const cv::Mat &mat, MatColorOrder order=MCO_BGR,
+                               QImage::Format formatHint = QImage::Format_Invalid);
+#endif
+
+/* Settings of the row parallel conversion
+ *
+ * - Images of at least parallelThreshold() pixels are split into row
+ *   stripes, which are converted by the threads of cv::parallel_for_().
+ *   The default threshold is 1024*1024 pixels, 0 disables it.
+ * - maxParallelThreads() caps the number of stripes, so the conversion
+ *   doesn't take all of the cores. 0 means cv::getNumThreads().
+ */
+void setParallelThreshold(int pixels);
+int parallelThreshold();
+void setMaxParallelThreads(int threads);
+int maxParallelThreads();
+
+/* Instruction sets of the conversion kernels
+ *
+ * - The kernels which reorder channels, convert depths, premultiply alpha or
+ *   map display windows are compiled for several instruction sets, the best
+ *   one supported by the CPU is chosen by the first conversion, so one binary
+ *   runs at full speed on all of the hosts. AVX-512 hosts use the AVX2 kernels.
+ * - CPU_Baseline uses the universal intrinsics of the OpenCV build only.
+ * - The environment variable QTOCV_CPU_LEVEL (baseline, ssse3, avx2 or neon)
+ *   or setCpuLevel() forces a lower level, for testing and benchmarks. A level
+ *   which the CPU doesn't support falls back to the best one below it.
+ *   setCpuLevel(CPU_Auto) lets the next conversion choose the level again.
+ *   A ConversionPlan keeps the kernels of the level selected when it's created.
+ * - cpuLevel() returns the selected level.
+ */
+enum CpuLevel {
+    CPU_Auto = -1,
+    CPU_Baseline,
+    CPU_SSSE3,
+    CPU_AVX2,
+    CPU_NEON
+};
+
+void setCpuLevel(CpuLevel level);
+CpuLevel cpuLevel();
+const char *cpuLevelName(CpuLevel level);
+
+class ConversionPlanPrivate;
+
+/* Convert QImage to/from cv::Mat of the same format, size and type repeatedly
+ *
+ * - The intermediate formats, the channels map and the pixel kernel are
+ *   chosen when the plan is created, and the scratch buffers are owned
+ *   by the plan, so converting the frames of a stream costs nothing but
+ *   the pixel work.
+ * - The first constructor creates a QImage ==> cv::Mat plan, the second
+ *   one creates a cv::Mat ==> QImage plan, the parameters are the same
+ *   as image2Mat() and mat2Image().
+ * - With ShareData, the result shares data with the input when no pixel
+ *   needs to be converted, see image2Mat_shared() and mat2Image_sharedRef().
+ * - alphaMode is the same as the one of image2Mat() and mat2Image(), the
+ *   colors premultiplied or unpremultiplied by the 8 bits kernels are
+ *   counted as CP_Swizzle.
+ * - convert() returns false if the input does not match the plan.
+ * - A plan must not be used by several threads at the same time.
+ */
+class ConversionPlan
+{
+public:
+    enum Path {
+        CP_Invalid,
+        CP_ZeroCopy,      //Data is shared
+        CP_Copy,          //Pixels are copied as is
+        CP_Swizzle,       //Channels are reordered, added or dropped
+        CP_DepthConvert,  //Depth and channels are converted in one pass
+        CP_Unpack,        //Packed or indexed pixels are unpacked (or packed), and converted in one pass
+        CP_QtFallback     //QImage::convertToFormat() is used too
+    };
+
+    enum SharingMode {
+        CopyData,
+        ShareData
+    };
+
+    ConversionPlan(QImage::Format format, const QSize &size, int requiredMatType = CV_8UC(0),
+                   MatColorOrder requiredOrder=MCO_BGR, SharingMode mode=CopyData, AlphaMode alphaMode=AM_Raw);
+    ConversionPlan(int matType, const QSize &size, MatColorOrder order=MCO_BGR,
+                   QImage::Format formatHint = QImage::Format_Invalid, SharingMode mode=CopyData,
+                   AlphaMode alphaMode=AM_Raw);
+    ~ConversionPlan();
+
+    bool isValid() const;
+    Path path() const;
+    QImage::Format imageFormat() const;
+    int matType() const;
+    QSize size() const;
+
+    bool convert(const QImage &img, cv::Mat &dst);
+    bool convert(const cv::Mat &mat, QImage &dst);
+
+private:
+    Q_DISABLE_COPY(ConversionPlan)
+    ConversionPlanPrivate *d;
+};
+
+/* Counters of the conversions, per ConversionPlan::Path
+ *
+ * - Counting is disabled by default. When disabled, a conversion only
+ *   reads an atomic flag, so it can be left in the release builds.
+ * - image2Mat(), mat2Image(), the _shared functions and ConversionPlan
+ *   are counted. mat2Image() with a color table is counted as CP_Unpack,
+ *   mat2Image() with a display window as CP_DepthConvert, and the failed
+ *   conversions as CP_Invalid.
+ * - bytes is the size of the converted data, 0 for CP_ZeroCopy.
+ * - allocations counts the buffers of the result and the scratch buffers,
+ *   including the images created by QImage::convertToFormat().
+ */
+struct ConversionStats
+{
+    ConversionStats() : calls(0), bytes(0), allocations(0), nsecs(0) {}
+
+    qint64 calls;
+    qint64 bytes;
+    qint64 allocations;
+    qint64 nsecs;
+};
+
+void setConversionStatsEnabled(bool enabled);
+bool conversionStatsEnabled();
+ConversionStats conversionStats(ConversionPlan::Path path);
+void resetConversionStats();
+
+/* Pool of the buffers used by the conversions
+ *
+ * - The pool is disabled by default. When enabled, the cv::Mat, QImage
+ *   and scratch buffers allocated by the conversions are taken from size
+ *   buckets of the pool, and given back when released, so that streaming
+ *   frames of the same size does no malloc/free of pixel buffers.
+ * - bufferPoolAllocator() can be set as the allocator of other cv::Mat,
+ *   it is 0 for OpenCV 2. createPooledImage() creates a QImage with a
+ *   pooled buffer (Qt 5.4).
+ * - highWaterBytes is the peak of bytesInUse + bytesCached.
+ *   trimBufferPool() frees the cached buffers, the largest ones first,
+ *   until no more than maxCachedBytes are cached.
+ */
+struct BufferPoolStats
+{
+    BufferPoolStats() : bytesInUse(0), bytesCached(0), highWaterBytes(0), allocations(0), reuses(0) {}
+
+    qint64 bytesInUse;
+    qint64 bytesCached;
+    qint64 highWaterBytes;
+    qint64 allocations;
+    qint64 reuses;
+};
+
+void setBufferPoolEnabled(bool enabled);
+bool bufferPoolEnabled();
+cv::MatAllocator *bufferPoolAllocator();
+#if QT_VERSION >= 0x050400
+QImage createPooledImage(const QSize &size, QImage::Format format);
+#endif
+BufferPoolStats bufferPoolStats();
+void trimBufferPool(qint64 maxCachedBytes = 0);
+
+namespace detail {
+
+/* Value ranges used by QtOcv:
+ *   CV_8U [0, 255], CV_16U [0, 65535], CV_32F [0, 1.0]
+ */
+template<typename T> struct DepthTraits;
+template<> struct DepthTraits<uchar>
+{
+    static float unit() { return 1.0f; }
+    static uchar opaque() { return 255; }
+};
+template<> struct DepthTraits<ushort>
+{
+    static float unit() { return 257.0f; }
+    static ushort opaque() { return 65535; }
+};
+template<> struct DepthTraits<float>
+{
+    static float unit() { return 1.0f/255; }
+    static float opaque() { return 1.0f; }
+};
+
+template<int depth> struct DepthType;
+template<> struct DepthType<CV_8U> { typedef uchar type; };
+template<> struct DepthType<CV_16U> { typedef ushort type; };
+template<> struct DepthType<CV_32F> { typedef float type; };
+
+template<typename ST, typename DT>
+struct DepthConvert
+{
+    static DT apply(ST v) { return cv::saturate_cast<DT>(v * (DepthTraits<DT>::unit() / DepthTraits<ST>::unit())); }
+};
+template<typename T>
+struct DepthConvert<T, T>
+{
+    static T apply(T v) { return v; }
+};
+
+/* Index of the channel with role (0:R 1:G 2:B 3:A) in a pixel,
+ * -1 if the pixel has no such channel.
+ */
+template<int cn, int order, int role>
+struct ChannelIndex
+{
+    enum { value = cn == 1 ? (role == 3 ? -1 : 0)
+                 : role == 3 ? (cn == 4 ? (order == MCO_ARGB ? 0 : 3) : -1)
+                 : (cn == 4 && order == MCO_ARGB) ? role + 1
+                 : order == MCO_BGR ? 2 - role : role };
+};
+
+/* Role (0:R 1:G 2:B 3:A) of the i-th channel of a pixel
+ */
+template<int cn, int order, int i>
+struct ChannelRole
+{
+    enum { value = (cn == 4 && order == MCO_ARGB) ? (i + 3) % 4
+                 : i == 3 ? 3
+                 : order == MCO_BGR ? 2 - i : i };
+};
+
+template<typename ST, typename DT, int index>
+struct ChannelAt
+{
+    static DT get(const ST *src) { return DepthConvert<ST, DT>::apply(src[index]); }
+};
+template<typename ST, typename DT>
+struct ChannelAt<ST, DT, -1>
+{
+    static DT get(const ST *) { return DepthTraits<DT>::opaque(); }
+};
+
+/* Vectorized part of the row converters, which reorders / expands / drops
+ * the channels of pixels of the same depth, return the number of pixels
+ * processed. It's defined in cvmatandqimage.cpp, so the universal
+ * intrinsics of OpenCV are not part of this header.
+ */
+int reorderChannelsSimd(const void *src, void *dst, int width, int depth, int scn, int dcn, const int *map);
+
+template<typename ST, typename DT, int scn, int dcn>
+struct RowSimd
+{
+    static int run(const ST *, DT *, int, const int *) { return 0; }
+};
+template<typename T, int scn, int dcn>
+struct RowSimd<T, T, scn, dcn>
+{
+    static int run(const T *src, T *dst, int width, const int *map)
+    {
+        return reorderChannelsSimd(src, dst, width, cv::DataType<T>::depth, scn, dcn, map);
+    }
+};
+
+/* Convert a row of (ST, scn, order) pixels to (DT, dcn, order) pixels,
+ * the channels map is resolved at compile time.
+ */
+template<typename ST, typename DT, int scn, int srcOrder, int dcn, int dstOrder>
+struct RowConverter
+{
+    enum {
+        m0 = ChannelIndex<scn, srcOrder, ChannelRole<dcn, dstOrder, 0>::value>::value,
+        m1 = ChannelIndex<scn, srcOrder, ChannelRole<dcn, dstOrder, 1>::value>::value,
+        m2 = ChannelIndex<scn, srcOrder, ChannelRole<dcn, dstOrder, 2>::value>::value,
+        m3 = ChannelIndex<scn, srcOrder, ChannelRole<dcn, dstOrder, 3>::value>::value
+    };
+
+    static void run(const ST *src, DT *dst, int width)
+    {
+        const int map[4] = {m0, m1, m2, m3};
+        const int x = RowSimd<ST, DT, scn, dcn>::run(src, dst, width, map);
+        src += x*scn;
+        dst += x*dcn;
+        for (int i=x; i<width; ++i, src += scn, dst += dcn) {
+            dst[0] = ChannelAt<ST, DT, m0>::get(src);
+            dst[1] = ChannelAt<ST, DT, m1>::get(src);
+            dst[2] = ChannelAt<ST, DT, m2>::get(src);
+            if (dcn == 4)
+                dst[3] = ChannelAt<ST, DT, m3>::get(src);
+        }
+    }
+};
+
+/* Weighted (R G B) ==> Gray
+ */
+template<typename ST, typename DT, int scn, int srcOrder, int dstOrder>
+struct RowConverter<ST, DT, scn, srcOrder, 1, dstOrder>
+{
+    enum {
+        r = ChannelIndex<scn, srcOrder, 0>::value,
+        g = ChannelIndex<scn, srcOrder, 1>::value,
+        b = ChannelIndex<scn, srcOrder, 2>::value
+    };
+
+    static void run(const ST *src, DT *dst, int width)
+    {
+        const float scale = DepthTraits<DT>::unit() / DepthTraits<ST>::unit();
+        for (int x=0; x<width; ++x, src += scn)
+            dst[x] = cv::saturate_cast<DT>((src[r]*0.299f + src[g]*0.587f + src[b]*0.114f) * scale);
+    }
+};
+
+template<typename ST, typename DT, int srcOrder, int dstOrder>
+struct RowConverter<ST, DT, 1, srcOrder, 1, dstOrder>
+{
+    static void run(const ST *src, DT *dst, int width)
+    {
+        for (int x=0; x<width; ++x)
+            dst[x] = DepthConvert<ST, DT>::apply(src[x]);
+    }
+};
+
+/* Type and channels order of the cv::Mat which shares data
+ * with the QImage format, type is -1 for unsupported formats.
+ */
+template<QImage::Format format>
+struct ImageFormatTraits
+{
+    enum { type = -1, order = MCO_BGR };
+};
+
+#define QTOCV_IMAGE_FORMAT_TRAITS(format, matType, matOrder) \
+    template<> struct ImageFormatTraits<QImage::format> { enum { type = matType, order = matOrder }; };
+
+QTOCV_IMAGE_FORMAT_TRAITS(Format_Indexed8, CV_8UC1, MCO_BGR)
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+QTOCV_IMAGE_FORMAT_TRAITS(Format_RGB32, CV_8UC4, MCO_BGRA)
+QTOCV_IMAGE_FORMAT_TRAITS(Format_ARGB32, CV_8UC4, MCO_BGRA)
+QTOCV_IMAGE_FORMAT_TRAITS(Format_ARGB32_Premultiplied, CV_8UC4, MCO_BGRA)
+#else
+QTOCV_IMAGE_FORMAT_TRAITS(Format_RGB32, CV_8UC4, MCO_ARGB)
+QTOCV_IMAGE_FORMAT_TRAITS(Format_ARGB32, CV_8UC4, MCO_ARGB)
+QTOCV_IMAGE_FORMAT_TRAITS(Format_ARGB32_Premultiplied, CV_8UC4, MCO_ARGB)
+#endif
+QTOCV_IMAGE_FORMAT_TRAITS(Format_RGB888, CV_8UC3, MCO_RGB)
+#if QT_VERSION >= 0x050200
+QTOCV_IMAGE_FORMAT_TRAITS(Format_RGBX8888, CV_8UC4, MCO_RGBA)
+QTOCV_IMAGE_FORMAT_TRAITS(Format_RGBA8888, CV_8UC4, MCO_RGBA)
+QTOCV_IMAGE_FORMAT_TRAITS(Format_RGBA8888_Premultiplied, CV_8UC4, MCO_RGBA)
+#endif
+#if QT_VERSION >= 0x050500
+QTOCV_IMAGE_FORMAT_TRAITS(Format_Alpha8, CV_8UC1, MCO_BGR)
+QTOCV_IMAGE_FORMAT_TRAITS(Format_Grayscale8, CV_8UC1, MCO_BGR)
+#endif
+#if QT_VERSION >= 0x050C00
+QTOCV_IMAGE_FORMAT_TRAITS(Format_RGBX64, CV_16UC4, MCO_RGBA)
+QTOCV_IMAGE_FORMAT_TRAITS(Format_RGBA64, CV_16UC4, MCO_RGBA)
+QTOCV_IMAGE_FORMAT_TRAITS(Format_RGBA64_Premultiplied, CV_16UC4, MCO_RGBA)
+#endif
+#if QT_VERSION >= 0x050D00
+QTOCV_IMAGE_FORMAT_TRAITS(Format_Grayscale16, CV_16UC1, MCO_BGR)
+#endif
+#if QT_VERSION >= 0x050E00
+QTOCV_IMAGE_FORMAT_TRAITS(Format_BGR888, CV_8UC3, MCO_BGR)
+#endif
+#if QT_VERSION >= 0x060200
+QTOCV_IMAGE_FORMAT_TRAITS(Format_RGBX32FPx4, CV_32FC4, MCO_RGBA)
+QTOCV_IMAGE_FORMAT_TRAITS(Format_RGBA32FPx4, CV_32FC4, MCO_RGBA)
+QTOCV_IMAGE_FORMAT_TRAITS(Format_RGBA32FPx4_Premultiplied, CV_32FC4, MCO_RGBA)
+#endif
+
+#undef QTOCV_IMAGE_FORMAT_TRAITS
+
+/* Whether the buffer of the image can be written or taken as dst: no one
+ * else shares it, and it's not the buffer of a mat shared by mat2Image_shared()
+ * or mat2Image_sharedRef(). Images created on buffers of the caller can't
+ * be told apart from the images which own their buffers. With Qt 4, no image
+ * is known to own its buffer, so the dst images are never reused.
+ */
+bool ownsImageData(const QImage &img);
+
+/* Whether the color indices of the Indexed8 image are its gray pixels,
+ * the indices without colors are gray.
+ */
+inline bool hasGrayColorTable(const QImage &img)
+{
+    const QVector<QRgb> colorTable = img.colorTable();
+    for (int i=0; i<colorTable.size(); ++i) {
+        if (colorTable.at(i) != qRgb(i, i, i))
+            return false;
+    }
+    return true;
+}
+
+} //namespace detail
+
+#if QT_VERSION >= 0x050000
+/* Convert QImage to/from cv::Mat, with the QImage format, the cv::Mat type
+ * and channels order known at compile time
+ *
+ * - The pixel kernels are specialized at compile time, so the inner loops
+ *   are inlined into the caller and contain no dispatch.
+ * - Format must be one of the formats supported by image2Mat_shared(),
+ *   depth of MatType must be CV_8U, CV_16U or CV_32F.
+ * - Images of other formats, mats of other types, and QImage dst which
+ *   can not be reused are handled by image2Mat() and mat2Image().
+ *
+ *   typedef QtOcv::Converter<QImage::Format_RGB888, CV_8UC3, QtOcv::MCO_BGR> Rgb888Converter;
+ *   QImage image;
+ *   Rgb888Converter::mat2Image(frame, image);
+ */
+template<QImage::Format Format, int MatType, MatColorOrder Order = MCO_BGR>
+class Converter
+{
+    typedef detail::ImageFormatTraits<Format> ImageTraits;
+    Q_STATIC_ASSERT_X(int(ImageTraits::type) != -1, "QImage format can not be shared with cv::Mat");
+
+    typedef typename detail::DepthType<CV_MAT_DEPTH(ImageTraits::type)>::type ImageT;
+    typedef typename detail::DepthType<CV_MAT_DEPTH(MatType)>::type MatT;
+    enum {
+        ImageChannels = CV_MAT_CN(ImageTraits::type),
+        MatChannels = CV_MAT_CN(MatType)
+    };
+
+public:
+    typedef detail::RowConverter<ImageT, MatT, ImageChannels, ImageTraits::order, MatChannels, Order> ToMatRow;
+    typedef detail::RowConverter<MatT, ImageT, MatChannels, Order, ImageChannels, ImageTraits::order> ToImageRow;
+
+    static void image2Mat(const QImage &img, cv::Mat &dst)
+    {
+        if (img.format() != Format
+                || (Format == QImage::Format_Indexed8 && !detail::hasGrayColorTable(img))) {
+            QtOcv::image2Mat(img, dst, MatType, Order);
+            return;
+        }
+        dst.create(img.height(), img.width(), MatType);
+        for (int row=0; row<img.height(); ++row)
+            ToMatRow::run(reinterpret_cast<const ImageT *>(img.constScanLine(row)), dst.ptr<MatT>(row), img.width());
+    }
+
+    static cv::Mat image2Mat(const QImage &img)
+    {
+        cv::Mat mat;
+        image2Mat(img, mat);
+        return mat;
+    }
+
+    static void mat2Image(const cv::Mat &mat, QImage &dst)
+    {
+        //Same as mat2Image(), some conversions are done by Qt.
+        const bool convertedByQt = (ImageChannels == 1 && MatChannels != 1)
+                || (CV_MAT_DEPTH(ImageTraits::type) != CV_8U && CV_MAT_DEPTH(ImageTraits::type) != CV_MAT_DEPTH(MatType));
+        if (convertedByQt || mat.type() != MatType || dst.format() != Format
+                || dst.width() != mat.cols || dst.height() != mat.rows || !detail::ownsImageData(dst)
+                || (Format == QImage::Format_Indexed8 && !detail::hasGrayColorTable(dst))) {
+            QtOcv::mat2Image(mat, dst, Order, Format);
+            return;
+        }
+        for (int row=0; row<mat.rows; ++row)
+            ToImageRow::run(mat.ptr<MatT>(row), reinterpret_cast<ImageT *>(dst.scanLine(row)), mat.cols);
+    }
+
+    static QImage mat2Image(const cv::Mat &mat)
+    {
+        QImage image;
+        mat2Image(mat, image);
+        return image;
+    }
+};
+#endif
+
 } //namespace QtOcv
 
 #endif // CVMATANDQIMAGE_H
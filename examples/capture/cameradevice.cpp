@@ -3,6 +3,7 @@
 #include <QImage>
 #include "opencv2/core/core.hpp"
 #include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
 #include "cvmatandqimage.h"
 
 CameraDevice::CameraDevice(QObject *parent) :
@@ -45,8 +46,17 @@ void CameraDevice::onTimeout()
     if (!m_capture->isOpened())
         return;
 
-    static cv::Mat frame;
+    //A new frame buffer each time, which will be owned by the emitted image.
+    cv::Mat frame;
     *m_capture >> frame;
-    if (frame.cols)
+    if (frame.cols) {
+#if QT_VERSION >= 0x050E00
+        emit imageReady(QtOcv::mat2Image_sharedRef(frame, QImage::Format_BGR888));
+#elif QT_VERSION >= 0x050000
+        cv::cvtColor(frame, frame, cv::COLOR_BGR2RGB);
+        emit imageReady(QtOcv::mat2Image_sharedRef(frame));
+#else
         emit imageReady(QtOcv::mat2Image(frame));
+#endif
+    }
 }
@@ -10,6 +10,8 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include <vector>
+
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow)
@@ -52,30 +54,19 @@ void MainWindow::on_action_Open_triggered()
     ui->originImageWidget->setImage(img);
     ui->originImageWidget->setCurrentScale(0);
 
-    QImage image = img.convertToFormat(QImage::Format_RGB888);
-    cv::Mat mat = QtOcv::image2Mat_shared(image);
-#if 0
-    std::vector<cv::Mat> channels;
-    cv::split(mat, channels);
-
-    ui->rImageWidget->setImage(QtOcv::mat2Image_shared(channels[0]));
-    ui->gImageWidget->setImage(QtOcv::mat2Image_shared(channels[1]));
-    ui->bImageWidget->setImage(QtOcv::mat2Image_shared(channels[2]));
-#else
-    cv::Mat rMat(mat.rows, mat.cols, mat.type(), cv::Scalar(0, 0, 0));
-    cv::Mat gMat = rMat.clone();
-    cv::Mat bMat = rMat.clone();
-    int r[] = {0, 0};
-    int g[] = {1, 1};
-    int b[] = {2, 2};
-    cv::mixChannels(&mat, 1, &rMat, 1, r, 1);
-    cv::mixChannels(&mat, 1, &gMat, 1, g, 1);
-    cv::mixChannels(&mat, 1, &bMat, 1, b, 1);
+    //Each plane is shown through the color table of its channel.
+    std::vector<cv::Mat> planes;
+    QtOcv::image2Planes(img, planes, CV_8UC3, QtOcv::MCO_RGB);
 
-    ui->rImageWidget->setImage(QtOcv::mat2Image_shared(rMat));
-    ui->gImageWidget->setImage(QtOcv::mat2Image_shared(gMat));
-    ui->bImageWidget->setImage(QtOcv::mat2Image_shared(bMat));
-#endif
+    QVector<QRgb> rTable, gTable, bTable;
+    for (int i=0; i<256; ++i) {
+        rTable.append(qRgb(i, 0, 0));
+        gTable.append(qRgb(0, i, 0));
+        bTable.append(qRgb(0, 0, i));
+    }
+    ui->rImageWidget->setImage(QtOcv::mat2Image_shared(planes[0], rTable));
+    ui->gImageWidget->setImage(QtOcv::mat2Image_shared(planes[1], gTable));
+    ui->bImageWidget->setImage(QtOcv::mat2Image_shared(planes[2], bTable));
 
     ui->rImageWidget->setCurrentScale(0);
     ui->gImageWidget->setCurrentScale(0);
@@ -46,6 +46,10 @@ win32{
 # silence msvc warning 4819
 win32-msvc*:QMAKE_CXXFLAGS += -wd4819
 
+# The batch and asynchronous conversions need QtConcurrent, enable them with
+# QT += concurrent, or with CONFIG += qtocv_concurrent before including this file.
+qtocv_concurrent:greaterThan(QT_MAJOR_VERSION, 4): QT += concurrent
+
 INCLUDEPATH += $$PWD
 DEPENDPATH += $$PWD
 
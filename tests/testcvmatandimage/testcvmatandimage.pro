@@ -1,3 +1,4 @@
+CONFIG += qtocv_concurrent
 include(../../opencv.pri)
 
 QT       += testlib
@@ -3,12 +3,18 @@
 #include <QtTest>
 #include <QTemporaryFile>
 #include <QDebug>
+#ifdef QT_CONCURRENT_LIB
+#include <QThreadPool>
+#include <QSemaphore>
+#include <QtConcurrentRun>
+#endif
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
 #include <vector>
+#include <utility>
 #include <math.h>
 
 using namespace QtOcv;
@@ -101,6 +107,16 @@ static bool lenientCompare(const cv::Mat &actual, const cv::Mat &expected)
     return true;
 }
 
+#ifdef QT_CONCURRENT_LIB
+/* Keep a thread of the pool busy until release is released
+ */
+static void blockThread(QSemaphore *started, QSemaphore *release)
+{
+    started->release();
+    release->acquire();
+}
+#endif
+
 class CvMatAndImageTest : public QObject
 {
     Q_OBJECT
@@ -116,11 +132,67 @@ private Q_SLOTS:
     void testMat2QImage();
     void testMat2QImageShared_data();
     void testMat2QImageShared();
+    void testMat2QImageReuse_data();
+    void testMat2QImageReuse();
+#if QT_VERSION >= 0x050000
+    void testMat2QImageSharedRef_data();
+    void testMat2QImageSharedRef();
+    void testExternalImageData();
+#endif
 
     void testQImage2Mat_data();
     void testQImage2Mat();
     void testQImage2MatShared_data();
     void testQImage2MatShared();
+    void testQImage2MatReuse_data();
+    void testQImage2MatReuse();
+
+#if QT_VERSION >= 0x050000
+    void testConverter();
+#endif
+
+    void testConversionPlanImage2Mat_data();
+    void testConversionPlanImage2Mat();
+    void testConversionPlanMat2Image_data();
+    void testConversionPlanMat2Image();
+    void testConversionPlanPath();
+
+    void testParallelConversion_data();
+    void testParallelConversion();
+
+    void testPackedImage2Mat_data();
+    void testPackedImage2Mat();
+
+    void testMonoImage_data();
+    void testMonoImage();
+
+    void testIndexedImage_data();
+    void testIndexedImage();
+
+    void testLongColorTable();
+    void testSharedColorTable();
+
+    void testDisplayWindow_data();
+    void testDisplayWindow();
+
+    void testFullRange16Bit();
+
+    void testConversionStats();
+    void testBufferPool();
+    void testRegionOfInterest();
+    void testResizeConversion();
+    void testChannelsPermutation();
+    void testDepthConversion();
+    void testCpuLevel();
+    void testPlanes();
+    void testAlphaMode();
+#if QT_VERSION >= 0x060000 || defined(Q_COMPILER_RVALUE_REFS)
+    void testMoveConversion();
+#endif
+
+#ifdef QT_CONCURRENT_LIB
+    void testBatchConversion();
+#endif
 
 private:
     cv::Mat mat_8UC1;
@@ -163,10 +235,24 @@ private:
 #if QT_VERSION >= 0x040400
     QImage image_rgb888;
 #endif
+#if QT_VERSION >= 0x050E00
+    QImage image_bgr888;
+#endif
 #if QT_VERSION >= 0x050200
     QImage image_rgbx8888;
     QImage image_rgba8888;
 #endif
+#if QT_VERSION >= 0x050C00
+    QImage image_rgbx64;
+    QImage image_rgba64;
+#endif
+#if QT_VERSION >= 0x050D00
+    QImage image_grayscale16;
+#endif
+#if QT_VERSION >= 0x060200
+    QImage image_rgbx32fpx4;
+    QImage image_rgba32fpx4;
+#endif
 };
 
 CvMatAndImageTest::CvMatAndImageTest()
@@ -218,9 +304,23 @@ CvMatAndImageTest::CvMatAndImageTest()
 #if QT_VERSION >= 0x040400
     image_rgb888 = QImage(width, height, QImage::Format_RGB888);
 #endif
+#if QT_VERSION >= 0x050E00
+    image_bgr888 = QImage(width, height, QImage::Format_BGR888);
+#endif
 #if QT_VERSION >= 0x050200
     image_rgbx8888 = QImage(width, height, QImage::Format_RGBX8888);
     image_rgba8888 = QImage(width, height, QImage::Format_RGBA8888);
+#endif
+#if QT_VERSION >= 0x050C00
+    image_rgbx64 = QImage(width, height, QImage::Format_RGBX64);
+    image_rgba64 = QImage(width, height, QImage::Format_RGBA64);
+#endif
+#if QT_VERSION >= 0x050D00
+    image_grayscale16 = QImage(width, height, QImage::Format_Grayscale16);
+#endif
+#if QT_VERSION >= 0x060200
+    image_rgbx32fpx4 = QImage(width, height, QImage::Format_RGBX32FPx4);
+    image_rgba32fpx4 = QImage(width, height, QImage::Format_RGBA32FPx4);
 #endif
     for (int row=0; row<height; ++row) {
         for (int col=0; col<width; ++col) {
@@ -229,15 +329,15 @@ CvMatAndImageTest::CvMatAndImageTest()
             uchar b = g/2;
             uchar a = b/2;
             mat_8UC1.at<uchar>(row, col) = r;
-            mat_16UC1.at<quint16>(row, col) = r*255;
+            mat_16UC1.at<quint16>(row, col) = r*257;
             mat_32FC1.at<float>(row, col) = r/255.0;
 
             mat_8UC3_rgb.at<cv::Vec3b>(row, col) = cv::Vec3b(r, g, b);
-            mat_16UC3_rgb.at<cv::Vec3w>(row, col) = cv::Vec3w(r*255, g*255, b*255);
+            mat_16UC3_rgb.at<cv::Vec3w>(row, col) = cv::Vec3w(r*257, g*257, b*257);
             mat_32FC3_rgb.at<cv::Vec3f>(row, col) = cv::Vec3f(r/255.0, g/255.0, b/255.0);
 
             mat_8UC3_bgr.at<cv::Vec3b>(row, col) = cv::Vec3b(b, g, r);
-            mat_16UC3_bgr.at<cv::Vec3w>(row, col) = cv::Vec3w(b*255, g*255, r*255);
+            mat_16UC3_bgr.at<cv::Vec3w>(row, col) = cv::Vec3w(b*257, g*257, r*257);
             mat_32FC3_bgr.at<cv::Vec3f>(row, col) = cv::Vec3f(b/255.0, g/255.0, r/255.0);
 
             mat_8UC4_rgba.at<cv::Vec4b>(row, col) = cv::Vec4b(r, g, b, a);
@@ -247,12 +347,12 @@ CvMatAndImageTest::CvMatAndImageTest()
             mat_8UC4_xrgb.at<cv::Vec4b>(row, col) = cv::Vec4b(255, r, g, b);
             mat_8UC4_bgrx.at<cv::Vec4b>(row, col) = cv::Vec4b(b, g, r, 255);
 
-            mat_16UC4_rgba.at<cv::Vec4w>(row, col) = cv::Vec4w(r*255, g*255, b*255, a*255);
-            mat_16UC4_argb.at<cv::Vec4w>(row, col) = cv::Vec4w(a*255, r*255, g*255, b*255);
-            mat_16UC4_bgra.at<cv::Vec4w>(row, col) = cv::Vec4w(b*255, g*255, r*255, a*255);
-            mat_16UC4_rgbx.at<cv::Vec4w>(row, col) = cv::Vec4w(r*255, g*255, b*255, 65535);
-            mat_16UC4_xrgb.at<cv::Vec4w>(row, col) = cv::Vec4w(65535, r*255, g*255, b*255);
-            mat_16UC4_bgrx.at<cv::Vec4w>(row, col) = cv::Vec4w(b*255, g*255, r*255, 65535);
+            mat_16UC4_rgba.at<cv::Vec4w>(row, col) = cv::Vec4w(r*257, g*257, b*257, a*257);
+            mat_16UC4_argb.at<cv::Vec4w>(row, col) = cv::Vec4w(a*257, r*257, g*257, b*257);
+            mat_16UC4_bgra.at<cv::Vec4w>(row, col) = cv::Vec4w(b*257, g*257, r*257, a*257);
+            mat_16UC4_rgbx.at<cv::Vec4w>(row, col) = cv::Vec4w(r*257, g*257, b*257, 65535);
+            mat_16UC4_xrgb.at<cv::Vec4w>(row, col) = cv::Vec4w(65535, r*257, g*257, b*257);
+            mat_16UC4_bgrx.at<cv::Vec4w>(row, col) = cv::Vec4w(b*257, g*257, r*257, 65535);
 
             mat_32FC4_rgba.at<cv::Vec4f>(row, col) = cv::Vec4f(r/255.0, g/255.0, b/255.0, a/255.0);
             mat_32FC4_argb.at<cv::Vec4f>(row, col) = cv::Vec4f(a/255.0, r/255.0, g/255.0, b/255.0);
@@ -271,9 +371,23 @@ CvMatAndImageTest::CvMatAndImageTest()
 #if QT_VERSION >= 0x040400
             image_rgb888.setPixel(col, row, qRgb(r, g, b));
 #endif
+#if QT_VERSION >= 0x050E00
+            image_bgr888.setPixel(col, row, qRgb(r, g, b));
+#endif
 #if QT_VERSION >= 0x050200
             image_rgbx8888.setPixel(col, row, qRgb(r, g, b));
             image_rgba8888.setPixel(col, row, qRgba(r, g, b, a));
+#endif
+#if QT_VERSION >= 0x050C00
+            image_rgbx64.setPixel(col, row, qRgb(r, g, b));
+            image_rgba64.setPixel(col, row, qRgba(r, g, b, a));
+#endif
+#if QT_VERSION >= 0x050D00
+            image_grayscale16.setPixel(col, row, qRgb(r, r, r));
+#endif
+#if QT_VERSION >= 0x060200
+            image_rgbx32fpx4.setPixel(col, row, qRgb(r, g, b));
+            image_rgba32fpx4.setPixel(col, row, qRgba(r, g, b, a));
 #endif
         }
     }
@@ -327,10 +441,21 @@ void CvMatAndImageTest::testMat2QImage_data()
     QTest::newRow("8UC3(RGB)_RGB888") << mat_8UC3_rgb << MCO_RGB << QImage::Format_RGB888 << image_rgb888;
     QTest::newRow("16UC3(RGB)_RGB888") << mat_16UC3_rgb << MCO_RGB << QImage::Format_RGB888 << image_rgb888;
     QTest::newRow("32FC3(RGB)_RGB888") << mat_32FC3_rgb << MCO_RGB << QImage::Format_RGB888 << image_rgb888;
+#if QT_VERSION >= 0x050E00
+    QTest::newRow("8UC3(BGR)_Invalid") << mat_8UC3_bgr << MCO_BGR << QImage::Format_Invalid << image_bgr888;
+#else
     QTest::newRow("8UC3(BGR)_Invalid") << mat_8UC3_bgr << MCO_BGR << QImage::Format_Invalid << image_rgb888;
+#endif
     QTest::newRow("8UC3(BGR)_RGB888") << mat_8UC3_bgr << MCO_BGR << QImage::Format_RGB888 << image_rgb888;
     QTest::newRow("16UC3(BGR)_RGB888") << mat_16UC3_bgr << MCO_BGR << QImage::Format_RGB888 << image_rgb888;
     QTest::newRow("32FC3(BGR)_RGB888") << mat_32FC3_bgr << MCO_BGR << QImage::Format_RGB888 << image_rgb888;
+#endif
+#if QT_VERSION >= 0x050E00
+    //Test data: C3 ==> BGR888
+    QTest::newRow("8UC3(BGR)_BGR888") << mat_8UC3_bgr << MCO_BGR << QImage::Format_BGR888 << image_bgr888;
+    QTest::newRow("16UC3(BGR)_BGR888") << mat_16UC3_bgr << MCO_BGR << QImage::Format_BGR888 << image_bgr888;
+    QTest::newRow("32FC3(BGR)_BGR888") << mat_32FC3_bgr << MCO_BGR << QImage::Format_BGR888 << image_bgr888;
+    QTest::newRow("8UC3(RGB)_BGR888") << mat_8UC3_rgb << MCO_RGB << QImage::Format_BGR888 << image_bgr888;
 #endif
     //Test data: C3 ==> RGB32
     QTest::newRow("8UC3(RGB)_RGB32") << mat_8UC3_rgb << MCO_RGB << QImage::Format_RGB32 << image_rgb32;
@@ -374,6 +499,27 @@ void CvMatAndImageTest::testMat2QImage_data()
     QTest::newRow("16UC4(RGBA)_RGBA8888") << mat_16UC4_rgba << MCO_RGBA << QImage::Format_RGBA8888 << image_rgba8888;
     QTest::newRow("32FC4(RGBA)_RGBA8888") << mat_32FC4_rgba << MCO_RGBA << QImage::Format_RGBA8888 << image_rgba8888;
 #endif
+
+#if QT_VERSION >= 0x050C00
+    //Test data: 16U C3/C4 ==> RGBX64/RGBA64
+    QTest::newRow("16UC3(BGR)_Invalid") << mat_16UC3_bgr << MCO_BGR << QImage::Format_Invalid << image_rgbx64;
+    QTest::newRow("16UC3(RGB)_RGBX64") << mat_16UC3_rgb << MCO_RGB << QImage::Format_RGBX64 << image_rgbx64;
+    QTest::newRow("16UC4(BGRA)_Invalid") << mat_16UC4_bgra << MCO_BGRA << QImage::Format_Invalid << image_rgba64;
+    QTest::newRow("16UC4(ARGB)_RGBA64") << mat_16UC4_argb << MCO_ARGB << QImage::Format_RGBA64 << image_rgba64;
+    QTest::newRow("8UC4(RGBA)_RGBA64") << mat_8UC4_rgba << MCO_RGBA << QImage::Format_RGBA64 << image_rgba64;
+#endif
+#if QT_VERSION >= 0x050D00
+    //Test data: 16U C1 ==> Grayscale16
+    QTest::newRow("16UC1_Invalid") << mat_16UC1 << MCO_BGR << QImage::Format_Invalid << image_grayscale16;
+    QTest::newRow("16UC1_Grayscale16") << mat_16UC1 << MCO_BGR << QImage::Format_Grayscale16 << image_grayscale16;
+#endif
+#if QT_VERSION >= 0x060200
+    //Test data: 32F C3/C4 ==> RGBX32FPx4/RGBA32FPx4
+    QTest::newRow("32FC3(BGR)_Invalid") << mat_32FC3_bgr << MCO_BGR << QImage::Format_Invalid << image_rgbx32fpx4;
+    QTest::newRow("32FC4(BGRA)_Invalid") << mat_32FC4_bgra << MCO_BGRA << QImage::Format_Invalid << image_rgba32fpx4;
+    QTest::newRow("32FC4(RGBA)_RGBA32FPx4") << mat_32FC4_rgba << MCO_RGBA << QImage::Format_RGBA32FPx4 << image_rgba32fpx4;
+    QTest::newRow("8UC4(BGRA)_RGBA32FPx4") << mat_8UC4_bgra << MCO_BGRA << QImage::Format_RGBA32FPx4 << image_rgba32fpx4;
+#endif
 }
 
 void CvMatAndImageTest::testMat2QImage()
@@ -407,6 +553,10 @@ void CvMatAndImageTest::testMat2QImageShared_data()
     //Test data: C3 ==> RGB8888
     QTest::newRow("8UC3_Invalid") << mat_8UC3_rgb << QImage::Format_Invalid << image_rgb888;
 #endif
+#if QT_VERSION >= 0x050E00
+    //Test data: C3 ==> BGR888
+    QTest::newRow("8UC3_BGR888") << mat_8UC3_bgr << QImage::Format_BGR888 << image_bgr888;
+#endif
 
     //Test data: C4 ==> ARGB32
 #if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
@@ -421,6 +571,21 @@ void CvMatAndImageTest::testMat2QImageShared_data()
     //Test data: C4 ==> RGBA8888
     QTest::newRow("8UC4_RGBA8888") << mat_8UC4_rgba << QImage::Format_RGBA8888 << image_rgba8888;
 #endif
+
+#if QT_VERSION >= 0x050C00
+    //Test data: 16UC4 ==> RGBA64
+    QTest::newRow("16UC4_Invalid") << mat_16UC4_rgba << QImage::Format_Invalid << image_rgba64;
+    QTest::newRow("16UC4_RGBX64") << mat_16UC4_rgbx << QImage::Format_RGBX64 << image_rgbx64;
+#endif
+#if QT_VERSION >= 0x050D00
+    //Test data: 16UC1 ==> Grayscale16
+    QTest::newRow("16UC1_Invalid") << mat_16UC1 << QImage::Format_Invalid << image_grayscale16;
+#endif
+#if QT_VERSION >= 0x060200
+    //Test data: 32FC4 ==> RGBA32FPx4
+    QTest::newRow("32FC4_Invalid") << mat_32FC4_rgba << QImage::Format_Invalid << image_rgba32fpx4;
+    QTest::newRow("32FC4_RGBX32FPx4") << mat_32FC4_rgbx << QImage::Format_RGBX32FPx4 << image_rgbx32fpx4;
+#endif
 }
 
 void CvMatAndImageTest::testMat2QImageShared()
@@ -433,6 +598,82 @@ void CvMatAndImageTest::testMat2QImageShared()
     QVERIFY(lenientCompare(convertedImage, expect));
 }
 
+void CvMatAndImageTest::testMat2QImageReuse_data()
+{
+    testMat2QImage_data();
+}
+
+void CvMatAndImageTest::testMat2QImageReuse()
+{
+    QFETCH(cv::Mat, mat);
+    QFETCH(MatColorOrder, mcOrder);
+    QFETCH(QImage::Format, formatHint);
+    QFETCH(QImage, expect);
+
+    QImage convertedImage;
+    mat2Image(mat, convertedImage, mcOrder, formatHint);
+    QVERIFY(lenientCompare(convertedImage, expect));
+
+    //The buffer should be reused by the second conversion.
+    const uchar *bits = convertedImage.constBits();
+    mat2Image(mat, convertedImage, mcOrder, formatHint);
+    QVERIFY(lenientCompare(convertedImage, expect));
+    if (formatHint == QImage::Format_Invalid || formatHint == convertedImage.format())
+        QCOMPARE(convertedImage.constBits(), bits);
+
+    //The buffer should not be reused when it is shared.
+    QImage sharedImage = convertedImage;
+    mat2Image(mat, convertedImage, mcOrder, formatHint);
+    QVERIFY(convertedImage.constBits() != sharedImage.constBits());
+}
+
+#if QT_VERSION >= 0x050000
+void CvMatAndImageTest::testMat2QImageSharedRef_data()
+{
+    testMat2QImageShared_data();
+}
+
+void CvMatAndImageTest::testMat2QImageSharedRef()
+{
+    QFETCH(cv::Mat, mat);
+    QFETCH(QImage::Format, formatHint);
+    QFETCH(QImage, expect);
+
+    QImage convertedImage;
+    {
+        //The image must be still valid after the mat is destroyed.
+        cv::Mat tmpMat = mat.clone();
+        convertedImage = mat2Image_sharedRef(tmpMat, formatHint);
+        QCOMPARE(convertedImage.constBits(), (const uchar *)tmpMat.data);
+    }
+    QImage copiedImage = convertedImage;
+    convertedImage = QImage();
+    QVERIFY(lenientCompare(copiedImage, expect));
+}
+#endif
+
+void CvMatAndImageTest::testExternalImageData()
+{
+    //The buffer of a mat shared by the image is not reused as dst.
+    cv::Mat shared = mat_8UC4_bgra.clone();
+    const cv::Mat black(shared.rows, shared.cols, CV_8UC4, cv::Scalar::all(0));
+    QImage image = mat2Image_shared(shared);
+    mat2Image(black, image, MCO_BGR, image.format());
+    QVERIFY(image.constBits() != shared.data);
+    QCOMPARE(cv::norm(shared, mat_8UC4_bgra, cv::NORM_INF), 0.0);
+
+    image = mat2Image_sharedRef(shared);
+    ConversionPlan plan(black.type(), image.size(), MCO_BGR, image.format());
+    QVERIFY(plan.convert(black, image));
+    QVERIFY(image.constBits() != shared.data);
+    QCOMPARE(cv::norm(shared, mat_8UC4_bgra, cv::NORM_INF), 0.0);
+
+    //The buffer is reused once the image owns it.
+    const uchar *bits = image.constBits();
+    QVERIFY(plan.convert(black, image));
+    QCOMPARE(image.constBits(), bits);
+}
+
 void CvMatAndImageTest::testQImage2Mat_data()
 {
     QTest::addColumn<QImage>("image");
@@ -465,6 +706,15 @@ void CvMatAndImageTest::testQImage2Mat_data()
     QTest::newRow("RGB888_32FC4(RGBX)") << image_rgb888 << MCO_RGBA << CV_32FC4 << mat_32FC4_rgbx;
 #endif
 
+#if QT_VERSION >= 0x050E00
+    //Test data: BGR888 ==> C3
+    QTest::newRow("BGR888_8UC3(BGR)") << image_bgr888 << MCO_BGR << CV_8UC3 << mat_8UC3_bgr;
+    QTest::newRow("BGR888_16UC3(BGR)") << image_bgr888 << MCO_BGR << CV_16UC3 << mat_16UC3_bgr;
+    QTest::newRow("BGR888_32FC3(BGR)") << image_bgr888 << MCO_BGR << CV_32FC3 << mat_32FC3_bgr;
+    QTest::newRow("BGR888_8UC3(RGB)") << image_bgr888 << MCO_RGB << CV_8UC3 << mat_8UC3_rgb;
+    QTest::newRow("BGR888_8UC4(BGRX)") << image_bgr888 << MCO_BGRA << CV_8UC4 << mat_8UC4_bgrx;
+#endif
+
     //Test data: ARGB32 ==> C4
     QTest::newRow("ARGB32_8UC4(BGRA)") << image_argb32 << MCO_BGRA << CV_8UC4 << mat_8UC4_bgra;
     QTest::newRow("ARGB32_16UC4(BGRA)") << image_argb32 << MCO_BGRA << CV_16UC4 << mat_16UC4_bgra;
@@ -486,6 +736,28 @@ void CvMatAndImageTest::testQImage2Mat_data()
     QTest::newRow("RGBA8888_16UC4(BGRA)") << image_rgba8888 << MCO_BGRA << CV_16UC4 << mat_16UC4_bgra;
     QTest::newRow("RGBA8888_32FC4(BGRA)") << image_rgba8888 << MCO_BGRA << CV_32FC4 << mat_32FC4_bgra;
 #endif
+
+#if QT_VERSION >= 0x050C00
+    //Test data: RGBA64 ==> C3/C4
+    QTest::newRow("RGBA64_16UC4(RGBA)") << image_rgba64 << MCO_RGBA << CV_16UC4 << mat_16UC4_rgba;
+    QTest::newRow("RGBA64_16UC4(BGRA)") << image_rgba64 << MCO_BGRA << CV_16UC4 << mat_16UC4_bgra;
+    QTest::newRow("RGBA64_8UC4(ARGB)") << image_rgba64 << MCO_ARGB << CV_8UC4 << mat_8UC4_argb;
+    QTest::newRow("RGBA64_32FC4(RGBA)") << image_rgba64 << MCO_RGBA << CV_32FC4 << mat_32FC4_rgba;
+    QTest::newRow("RGBX64_16UC3(BGR)") << image_rgbx64 << MCO_BGR << CV_16UC3 << mat_16UC3_bgr;
+#endif
+#if QT_VERSION >= 0x050D00
+    //Test data: Grayscale16 ==> C1
+    QTest::newRow("Grayscale16_16UC1") << image_grayscale16 << MCO_BGR << CV_16UC1 << mat_16UC1;
+    QTest::newRow("Grayscale16_8UC1") << image_grayscale16 << MCO_BGR << CV_8UC1 << mat_8UC1;
+    QTest::newRow("Grayscale16_32FC1") << image_grayscale16 << MCO_BGR << CV_32FC1 << mat_32FC1;
+#endif
+#if QT_VERSION >= 0x060200
+    //Test data: RGBA32FPx4 ==> C3/C4
+    QTest::newRow("RGBA32FPx4_32FC4(RGBA)") << image_rgba32fpx4 << MCO_RGBA << CV_32FC4 << mat_32FC4_rgba;
+    QTest::newRow("RGBA32FPx4_32FC4(BGRA)") << image_rgba32fpx4 << MCO_BGRA << CV_32FC4 << mat_32FC4_bgra;
+    QTest::newRow("RGBA32FPx4_8UC4(ARGB)") << image_rgba32fpx4 << MCO_ARGB << CV_8UC4 << mat_8UC4_argb;
+    QTest::newRow("RGBX32FPx4_32FC3(BGR)") << image_rgbx32fpx4 << MCO_BGR << CV_32FC3 << mat_32FC3_bgr;
+#endif
 }
 
 void CvMatAndImageTest::testQImage2Mat()
@@ -524,6 +796,11 @@ void CvMatAndImageTest::testQImage2MatShared_data()
     QTest::newRow("RGB8888_8UC3") << image_rgb888 << mat_8UC3_rgb;
 #endif
 
+#if QT_VERSION >= 0x050E00
+    //Test data: BGR888 ==> C3
+    QTest::newRow("BGR888_8UC3") << image_bgr888 << mat_8UC3_bgr;
+#endif
+
     //Test data: ARGB32 ==> C4
 #if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
     QTest::newRow("ARGB32_8UC4") << image_argb32 << mat_8UC4_bgra;
@@ -535,6 +812,19 @@ void CvMatAndImageTest::testQImage2MatShared_data()
     //Test data: RGBA8888 ==> C4
     QTest::newRow("RGBA8888_8UC4") << image_rgba8888 << mat_8UC4_rgba;
 #endif
+
+#if QT_VERSION >= 0x050C00
+    //Test data: RGBA64 ==> 16UC4
+    QTest::newRow("RGBA64_16UC4") << image_rgba64 << mat_16UC4_rgba;
+#endif
+#if QT_VERSION >= 0x050D00
+    //Test data: Grayscale16 ==> 16UC1
+    QTest::newRow("Grayscale16_16UC1") << image_grayscale16 << mat_16UC1;
+#endif
+#if QT_VERSION >= 0x060200
+    //Test data: RGBA32FPx4 ==> 32FC4
+    QTest::newRow("RGBA32FPx4_32FC4") << image_rgba32fpx4 << mat_32FC4_rgba;
+#endif
 }
 
 void CvMatAndImageTest::testQImage2MatShared()
@@ -543,9 +833,855 @@ void CvMatAndImageTest::testQImage2MatShared()
     QFETCH(cv::Mat, expect);
 
     cv::Mat convertedMat = image2Mat_shared(image);
-    QVERIFY(lenientCompare<uchar>(convertedMat, expect));
+    if (convertedMat.depth() == CV_16U)
+        QVERIFY(lenientCompare<quint16>(convertedMat, expect));
+    else if (convertedMat.depth() == CV_32F)
+        QVERIFY(lenientCompare<float>(convertedMat, expect));
+    else
+        QVERIFY(lenientCompare<uchar>(convertedMat, expect));
+}
+
+void CvMatAndImageTest::testQImage2MatReuse_data()
+{
+    testQImage2Mat_data();
+}
+
+void CvMatAndImageTest::testQImage2MatReuse()
+{
+    QFETCH(QImage, image);
+    QFETCH(MatColorOrder, order);
+    QFETCH(int, matType);
+    QFETCH(cv::Mat, expect);
+
+    cv::Mat mat;
+    image2Mat(image, mat, matType, order);
+    uchar *data = mat.data;
+    image2Mat(image, mat, matType, order);
+    QCOMPARE(mat.data, data);
+
+    if (mat.depth() == CV_8U)
+        QVERIFY(lenientCompare<uchar>(mat, expect));
+    else if (mat.depth() == CV_16U)
+        QVERIFY(lenientCompare<quint16>(mat, expect));
+    else if (mat.depth() == CV_32F)
+        QVERIFY(lenientCompare<float>(mat, expect));
+    else
+        QVERIFY(false);
+}
+
+#if QT_VERSION >= 0x050000
+void CvMatAndImageTest::testConverter()
+{
+    //QImage ==> cv::Mat
+    QVERIFY(lenientCompare<uchar>(Converter<QImage::Format_ARGB32, CV_8UC3, MCO_BGR>::image2Mat(image_argb32), mat_8UC3_bgr));
+    QVERIFY(lenientCompare<uchar>(Converter<QImage::Format_ARGB32, CV_8UC4, MCO_RGBA>::image2Mat(image_argb32), mat_8UC4_rgba));
+    QVERIFY(lenientCompare<float>(Converter<QImage::Format_RGB888, CV_32FC4, MCO_RGBA>::image2Mat(image_rgb888), mat_32FC4_rgbx));
+    QVERIFY(lenientCompare<quint16>(Converter<QImage::Format_Indexed8, CV_16UC1>::image2Mat(image_indexed8), mat_16UC1));
+    //Other formats are handled by image2Mat()
+    QVERIFY(lenientCompare<uchar>(Converter<QImage::Format_ARGB32, CV_8UC3, MCO_RGB>::image2Mat(image_rgb888), mat_8UC3_rgb));
+
+    //cv::Mat ==> QImage
+    typedef Converter<QImage::Format_RGB888, CV_8UC3, MCO_BGR> Rgb888Converter;
+    QImage image;
+    Rgb888Converter::mat2Image(mat_8UC3_bgr, image);
+    QVERIFY(lenientCompare(image, image_rgb888));
+    const uchar *bits = image.constBits();
+    Rgb888Converter::mat2Image(mat_8UC3_bgr, image);
+    QCOMPARE(image.constBits(), bits);
+    QVERIFY(lenientCompare(image, image_rgb888));
+    QVERIFY(lenientCompare(Converter<QImage::Format_ARGB32, CV_32FC4, MCO_BGRA>::mat2Image(mat_32FC4_bgra), image_argb32));
+    //The color table of a reused Indexed8 image must be gray
+    QImage indexed(mat_8UC1.cols, mat_8UC1.rows, QImage::Format_Indexed8);
+    indexed.setColorTable(QVector<QRgb>(256, qRgb(255, 0, 0)));
+    Converter<QImage::Format_Indexed8, CV_8UC1>::mat2Image(mat_8UC1, indexed);
+    QVERIFY(detail::hasGrayColorTable(indexed));
+    QVERIFY(lenientCompare(indexed, image_indexed8));
+#if QT_VERSION >= 0x050C00
+    QVERIFY(lenientCompare(Converter<QImage::Format_RGBA64, CV_16UC4, MCO_ARGB>::mat2Image(mat_16UC4_argb), image_rgba64));
+#endif
+}
+#endif
+
+void CvMatAndImageTest::testConversionPlanImage2Mat_data()
+{
+    testQImage2Mat_data();
+}
+
+void CvMatAndImageTest::testConversionPlanImage2Mat()
+{
+    QFETCH(QImage, image);
+    QFETCH(MatColorOrder, order);
+    QFETCH(int, matType);
+    QFETCH(cv::Mat, expect);
+
+    ConversionPlan plan(image.format(), image.size(), matType, order);
+    QVERIFY(plan.isValid());
+
+    cv::Mat mat;
+    QVERIFY(plan.convert(image, mat));
+    uchar *data = mat.data;
+    QVERIFY(plan.convert(image, mat));
+    QCOMPARE(mat.data, data);
+
+    if (mat.depth() == CV_8U)
+        QVERIFY(lenientCompare<uchar>(mat, expect));
+    else if (mat.depth() == CV_16U)
+        QVERIFY(lenientCompare<quint16>(mat, expect));
+    else if (mat.depth() == CV_32F)
+        QVERIFY(lenientCompare<float>(mat, expect));
+    else
+        QVERIFY(false);
+}
+
+void CvMatAndImageTest::testConversionPlanMat2Image_data()
+{
+    testMat2QImage_data();
+}
+
+void CvMatAndImageTest::testConversionPlanMat2Image()
+{
+    QFETCH(cv::Mat, mat);
+    QFETCH(MatColorOrder, mcOrder);
+    QFETCH(QImage::Format, formatHint);
+    QFETCH(QImage, expect);
+
+    ConversionPlan plan(mat.type(), QSize(mat.cols, mat.rows), mcOrder, formatHint);
+    QVERIFY(plan.isValid());
+
+    QImage image;
+    QVERIFY(plan.convert(mat, image));
+    QVERIFY(lenientCompare(image, expect));
+    QVERIFY(plan.convert(mat, image));
+    QVERIFY(lenientCompare(image, expect));
+}
+
+void CvMatAndImageTest::testConversionPlanPath()
+{
+    const QSize size = image_argb32.size();
+
+    QCOMPARE(ConversionPlan(QImage::Format_ARGB32, size, CV_8UC4, MCO_BGRA).path(), ConversionPlan::CP_Copy);
+    QCOMPARE(ConversionPlan(QImage::Format_ARGB32, size, CV_8UC3, MCO_RGB).path(), ConversionPlan::CP_Swizzle);
+    QCOMPARE(ConversionPlan(QImage::Format_ARGB32, size, CV_32FC4, MCO_BGRA).path(), ConversionPlan::CP_DepthConvert);
+    QCOMPARE(ConversionPlan(QImage::Format_RGB16, size, CV_8UC3).path(), ConversionPlan::CP_Unpack);
+    QCOMPARE(ConversionPlan(QImage::Format_RGB666, size, CV_8UC3).path(), ConversionPlan::CP_QtFallback);
+    QCOMPARE(ConversionPlan(CV_8UC3, size, MCO_RGB, QImage::Format_RGB16).path(), ConversionPlan::CP_QtFallback);
+    QVERIFY(!ConversionPlan(QImage::Format_Invalid, size).isValid());
+
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    ConversionPlan sharedPlan(QImage::Format_ARGB32, size, CV_8UC4, MCO_BGRA, ConversionPlan::ShareData);
+    QCOMPARE(sharedPlan.path(), ConversionPlan::CP_ZeroCopy);
+    cv::Mat mat;
+    QVERIFY(sharedPlan.convert(image_argb32, mat));
+    QCOMPARE((const uchar *)mat.data, image_argb32.constBits());
+#endif
+
+    //Input which doesn't match the plan is rejected.
+    ConversionPlan plan(QImage::Format_ARGB32, size, CV_8UC3);
+    cv::Mat mat2;
+    QVERIFY(!plan.convert(image_indexed8, mat2));
+    QVERIFY(!plan.convert(image_argb32.copy(0, 0, 10, 10), mat2));
+}
+
+void CvMatAndImageTest::testParallelConversion_data()
+{
+    testQImage2Mat_data();
+}
+
+void CvMatAndImageTest::testParallelConversion()
+{
+    QFETCH(QImage, image);
+    QFETCH(MatColorOrder, order);
+    QFETCH(int, matType);
+    QFETCH(cv::Mat, expect);
+
+    //Force the images of the test to be converted in stripes.
+    const int threshold = parallelThreshold();
+    const int maxThreads = maxParallelThreads();
+    setParallelThreshold(1);
+    setMaxParallelThreads(3);
+
+    cv::Mat mat = image2Mat(image, matType, order);
+    QImage convertedImage = mat2Image(mat, order);
+    cv::Mat mat2 = image2Mat(convertedImage, matType, order);
+
+    setParallelThreshold(threshold);
+    setMaxParallelThreads(maxThreads);
+
+    if (mat.depth() == CV_8U) {
+        QVERIFY(lenientCompare<uchar>(mat, expect));
+        QVERIFY(lenientCompare<uchar>(mat2, expect));
+    } else if (mat.depth() == CV_16U) {
+        QVERIFY(lenientCompare<quint16>(mat, expect));
+        QVERIFY(lenientCompare<quint16>(mat2, expect));
+    } else if (mat.depth() == CV_32F) {
+        QVERIFY(lenientCompare<float>(mat, expect));
+        QVERIFY(lenientCompare<float>(mat2, expect));
+    } else {
+        QVERIFY(false);
+    }
+}
+
+void CvMatAndImageTest::testPackedImage2Mat_data()
+{
+    QTest::addColumn<QImage::Format>("format");
+    QTest::addColumn<QImage::Format>("expandedFormat");
+    QTest::addColumn<MatColorOrder>("order");
+    QTest::addColumn<int>("matType");
+
+    QTest::newRow("RGB16 to 8UC3") << QImage::Format_RGB16 << QImage::Format_RGB32 << MCO_BGR << CV_8UC3;
+    QTest::newRow("RGB16 to 8UC4") << QImage::Format_RGB16 << QImage::Format_RGB32 << MCO_ARGB << CV_8UC4;
+    QTest::newRow("RGB16 to 16UC3") << QImage::Format_RGB16 << QImage::Format_RGB32 << MCO_RGB << CV_16UC3;
+    QTest::newRow("RGB16 to 32FC4") << QImage::Format_RGB16 << QImage::Format_RGB32 << MCO_BGRA << CV_32FC4;
+    QTest::newRow("RGB555 to 8UC3") << QImage::Format_RGB555 << QImage::Format_RGB32 << MCO_RGB << CV_8UC3;
+    QTest::newRow("RGB444 to 8UC4") << QImage::Format_RGB444 << QImage::Format_RGB32 << MCO_BGRA << CV_8UC4;
+    QTest::newRow("ARGB4444 to 8UC4") << QImage::Format_ARGB4444_Premultiplied << QImage::Format_ARGB32_Premultiplied << MCO_RGBA << CV_8UC4;
+    QTest::newRow("ARGB4444 to 16UC4") << QImage::Format_ARGB4444_Premultiplied << QImage::Format_ARGB32_Premultiplied << MCO_BGRA << CV_16UC4;
+    QTest::newRow("RGB666 to 8UC3") << QImage::Format_RGB666 << QImage::Format_RGB32 << MCO_BGR << CV_8UC3;
+}
+
+void CvMatAndImageTest::testPackedImage2Mat()
+{
+    QFETCH(QImage::Format, format);
+    QFETCH(QImage::Format, expandedFormat);
+    QFETCH(MatColorOrder, order);
+    QFETCH(int, matType);
+
+    //Odd width, so that both the vectorized loop and the tail get used.
+    QImage image = image_argb32.scaled(QSize(37, 5)).convertToFormat(format);
+    cv::Mat expect = image2Mat(image.convertToFormat(expandedFormat), matType, order);
+
+    cv::Mat mat = image2Mat(image, matType, order);
+    QCOMPARE(mat.type(), expect.type());
+    if (mat.depth() == CV_8U)
+        QVERIFY(lenientCompare<uchar>(mat, expect));
+    else if (mat.depth() == CV_16U)
+        QVERIFY(lenientCompare<quint16>(mat, expect));
+    else
+        QVERIFY(lenientCompare<float>(mat, expect));
+}
+
+void CvMatAndImageTest::testMonoImage_data()
+{
+    QTest::addColumn<QImage::Format>("format");
+
+    QTest::newRow("Mono") << QImage::Format_Mono;
+    QTest::newRow("MonoLSB") << QImage::Format_MonoLSB;
+}
+
+void CvMatAndImageTest::testMonoImage()
+{
+    QFETCH(QImage::Format, format);
+
+    //Odd width, so that both the vectorized loop and the tail get used.
+    QImage image(37, 5, format);
+    for (int row=0; row<image.height(); ++row) {
+        for (int col=0; col<image.width(); ++col)
+            image.setPixel(col, row, (row * 7 + col * 3) % 5 < 2 ? 1 : 0);
+    }
+    QVector<QRgb> colorTable;
+    colorTable.append(qRgb(255, 255, 255));
+    colorTable.append(qRgb(0, 64, 128));
+    image.setColorTable(colorTable);
+
+    //Pixels are converted through the color table.
+    const QImage argbImage = image.convertToFormat(QImage::Format_ARGB32);
+    QVERIFY(lenientCompare<uchar>(image2Mat(image, CV_8UC4), image2Mat(argbImage, CV_8UC4)));
+    QVERIFY(lenientCompare<uchar>(image2Mat(image, CV_8UC3, MCO_RGB), image2Mat(argbImage, CV_8UC3, MCO_RGB)));
+    QVERIFY(lenientCompare<uchar>(image2Mat(image), image2Mat(argbImage, CV_8UC1)));
+    QVERIFY(lenientCompare<float>(image2Mat(image, CV_32FC3), image2Mat(argbImage, CV_32FC3)));
+    QCOMPARE(ConversionPlan(format, image.size()).path(), ConversionPlan::CP_Unpack);
+
+    //Indices are 0 or 1.
+    const cv::Mat indices = image2Mat_indices(image);
+    QVERIFY(lenientCompare<uchar>(indices, image2Mat_shared(image.convertToFormat(QImage::Format_Indexed8))));
+
+    //Gray pixels are packed to the same bits.
+    const cv::Mat gray = indices * 255;
+    const QImage monoImage = mat2Image(gray, MCO_BGR, format);
+    QCOMPARE(monoImage.format(), format);
+    QCOMPARE(monoImage.colorCount(), 2);
+    QCOMPARE(monoImage.color(0), qRgb(0, 0, 0));
+    QVERIFY(lenientCompare<uchar>(image2Mat_indices(monoImage), indices));
+}
+
+void CvMatAndImageTest::testIndexedImage_data()
+{
+    QTest::addColumn<MatColorOrder>("order");
+    QTest::addColumn<int>("matType");
+
+    QTest::newRow("8UC1") << MCO_BGR << CV_8UC1;
+    QTest::newRow("8UC3") << MCO_RGB << CV_8UC3;
+    QTest::newRow("8UC4_bgra") << MCO_BGRA << CV_8UC4;
+    QTest::newRow("8UC4_argb") << MCO_ARGB << CV_8UC4;
+    QTest::newRow("16UC4") << MCO_RGBA << CV_16UC4;
+    QTest::newRow("32FC3") << MCO_BGR << CV_32FC3;
+}
+
+void CvMatAndImageTest::testIndexedImage()
+{
+    QFETCH(MatColorOrder, order);
+    QFETCH(int, matType);
+
+    QVector<QRgb> colorTable;
+    for (int i=0; i<16; ++i)
+        colorTable.append(qRgba(i * 16, 255 - i * 8, (i * 37) % 256, 255 - i));
+    QImage image(37, 5, QImage::Format_Indexed8);
+    image.setColorTable(colorTable);
+    for (int row=0; row<image.height(); ++row) {
+        for (int col=0; col<image.width(); ++col)
+            image.setPixel(col, row, (row * 5 + col) % colorTable.size());
+    }
+
+    //Pixels are converted through the color table.
+    const cv::Mat mat = image2Mat(image, matType, order);
+    const cv::Mat expect = image2Mat(image.convertToFormat(QImage::Format_ARGB32), matType, order);
+    if (mat.depth() == CV_8U)
+        QVERIFY(lenientCompare<uchar>(mat, expect));
+    else if (mat.depth() == CV_16U)
+        QVERIFY(lenientCompare<quint16>(mat, expect));
+    else
+        QVERIFY(lenientCompare<float>(mat, expect));
+
+    //Colors of the color table are mapped to their indices.
+    if (mat.channels() == 4 && mat.depth() == CV_8U) {
+        const QImage indexedImage = mat2Image(mat, colorTable, order);
+        QCOMPARE(indexedImage.format(), QImage::Format_Indexed8);
+        QCOMPARE(indexedImage.colorTable(), colorTable);
+        QVERIFY(lenientCompare<uchar>(image2Mat_indices(indexedImage), image2Mat_indices(image)));
+    }
+}
+
+void CvMatAndImageTest::testLongColorTable()
+{
+    //QImage accepts color tables longer than 256 colors, the others are never used.
+    QVector<QRgb> colorTable;
+    for (int i=0; i<300; ++i)
+        colorTable.append(qRgb(i % 256, 255 - i % 256, 100));
+    QImage image(37, 5, QImage::Format_Indexed8);
+    image.setColorTable(colorTable);
+    for (int row=0; row<image.height(); ++row) {
+        for (int col=0; col<image.width(); ++col)
+            image.setPixel(col, row, (row * 53 + col * 7) % 256);
+    }
+
+    const cv::Mat mat = image2Mat(image, CV_8UC3, MCO_RGB);
+    QVERIFY(mat.at<cv::Vec3b>(2, 5) == cv::Vec3b(141, 114, 100));
+    QVERIFY(lenientCompare<uchar>(mat, image2Mat(image.convertToFormat(QImage::Format_RGB888), CV_8UC3, MCO_RGB)));
+
+    ConversionPlan plan(QImage::Format_Indexed8, image.size(), CV_8UC4, MCO_BGRA);
+    cv::Mat planMat;
+    QVERIFY(plan.convert(image, planMat));
+    QVERIFY(planMat.at<cv::Vec4b>(2, 5) == cv::Vec4b(100, 114, 141, 255));
+}
+
+void CvMatAndImageTest::testSharedColorTable()
+{
+    QVector<QRgb> colorTable;
+    for (int i=0; i<256; ++i)
+        colorTable.append(qRgb(i, 0, 255 - i));
+
+    QImage image = mat2Image_shared(mat_8UC1, colorTable);
+    QCOMPARE(image.format(), QImage::Format_Indexed8);
+    QCOMPARE((const uchar *)image.constBits(), (const uchar *)mat_8UC1.data);
+    QCOMPARE(image.colorTable(), colorTable);
+    QCOMPARE(mat2Image_shared(mat_8UC1).colorTable(), image_indexed8.colorTable());
+
+#if CV_MAJOR_VERSION >= 3
+    cv::Mat falseColor;
+    cv::applyColorMap(mat_8UC1, falseColor, cv::COLORMAP_JET);
+    image = mat2Image_shared(mat_8UC1, colorMapTable(cv::COLORMAP_JET));
+    QVERIFY(lenientCompare<uchar>(image2Mat(image, CV_8UC3), falseColor));
+#endif
+}
+
+void CvMatAndImageTest::testDisplayWindow_data()
+{
+    QTest::addColumn<int>("matType");
+    QTest::addColumn<double>("minValue");
+    QTest::addColumn<double>("maxValue");
+
+    QTest::newRow("8UC1") << CV_8UC1 << 20.0 << 120.0;
+    QTest::newRow("16UC1 12 bits") << CV_16UC1 << 0.0 << 4095.0;
+    QTest::newRow("16UC3") << CV_16UC3 << 1000.0 << 3000.0;
+    QTest::newRow("32FC1") << CV_32FC1 << -2.5 << 7.5;
+}
+
+void CvMatAndImageTest::testDisplayWindow()
+{
+    QFETCH(int, matType);
+    QFETCH(double, minValue);
+    QFETCH(double, maxValue);
+
+    //Values in [minValue, maxValue], odd width for the vectorized loops.
+    cv::Mat mat(7, 37, matType);
+    cv::Mat ramp(mat.rows, mat.cols * mat.channels(), CV_64FC1);
+    for (int row=0; row<ramp.rows; ++row) {
+        for (int col=0; col<ramp.cols; ++col)
+            ramp.at<double>(row, col) = minValue + (maxValue - minValue) * ((row * ramp.cols + col) % 97) / 96.0;
+    }
+    ramp.reshape(mat.channels()).convertTo(mat, matType);
+
+    const DisplayWindow minMax = DisplayWindow::minMax().resolved(mat);
+    QCOMPARE(minMax.mode(), DisplayWindow::DW_Fixed);
+    QCOMPARE(minMax.low(), minValue);
+    QCOMPARE(minMax.high(), maxValue);
+
+    //Same as cv::normalize() followed by mat2Image() of the 8 bits mat.
+    cv::Mat normalized;
+    mat.convertTo(normalized, CV_8U, 255.0 / (maxValue - minValue), -minValue * 255.0 / (maxValue - minValue));
+    QVERIFY(lenientCompare(mat2Image(mat, DisplayWindow::minMax()), mat2Image(normalized)));
+    QVERIFY(lenientCompare(mat2Image(mat, DisplayWindow(minValue, maxValue)), mat2Image(normalized)));
+    const double window = maxValue - minValue;
+    QVERIFY(lenientCompare(mat2Image(mat, DisplayWindow::fromWindowLevel(window, minValue + window / 2)),
+                           mat2Image(normalized)));
+
+    //Outliers are clipped by the percentiles, the histogram has 4096 bins.
+    ramp.at<double>(0, 0) = maxValue + 100 * (maxValue - minValue);
+    ramp.reshape(mat.channels()).convertTo(mat, matType);
+    const double outlier = DisplayWindow::minMax().resolved(mat).high();
+    const DisplayWindow percentile = DisplayWindow::percentile(1, 99).resolved(mat);
+    QVERIFY(percentile.low() >= minValue - 1e-6);
+    QVERIFY(percentile.high() <= maxValue + (outlier - minValue) / 4096 + 1e-6);
+    QVERIFY(percentile.low() < percentile.high());
 }
 
+void CvMatAndImageTest::testFullRange16Bit()
+{
+    //lenientCompare() of images works on ARGB32 pixels, so check the exact values here.
+    QImage white(4, 3, QImage::Format_ARGB32);
+    white.fill(qRgba(255, 255, 255, 255));
+
+    const cv::Mat white16 = image2Mat(white, CV_16UC4, MCO_RGBA);
+    QVERIFY(white16.at<cv::Vec4w>(1, 2) == cv::Vec4w(65535, 65535, 65535, 65535));
+
+#if QT_VERSION >= 0x050D00
+    QImage gray16(4, 3, QImage::Format_Grayscale16);
+    gray16.fill(Qt::white);
+    reinterpret_cast<quint16 *>(gray16.scanLine(0))[0] = 257 * 100;
+    const cv::Mat gray8 = image2Mat(gray16, CV_8UC1);
+    QCOMPARE(int(gray8.at<uchar>(0, 0)), 100);
+    QCOMPARE(int(gray8.at<uchar>(2, 3)), 255);
+    const cv::Mat gray32F = image2Mat(gray16, CV_32FC1);
+    QCOMPARE(gray32F.at<float>(2, 3), 1.0f);
+#endif
+
+#if QT_VERSION >= 0x050C00
+    QImage rgba64(4, 3, QImage::Format_RGBA64);
+    rgba64.fill(QColor(255, 255, 255, 255));
+    const cv::Mat mat = image2Mat(rgba64, CV_16UC4, MCO_RGBA);
+    QVERIFY(mat.at<cv::Vec4w>(1, 2) == cv::Vec4w(65535, 65535, 65535, 65535));
+
+    const cv::Mat mat8 = image2Mat(rgba64, CV_8UC4, MCO_RGBA);
+    QVERIFY(mat8.at<cv::Vec4b>(1, 2) == cv::Vec4b(255, 255, 255, 255));
+    const cv::Mat mat32F = image2Mat(rgba64, CV_32FC4, MCO_RGBA);
+    QCOMPARE(mat32F.at<cv::Vec4f>(1, 2)[0], 1.0f);
+    QCOMPARE(mat32F.at<cv::Vec4f>(1, 2)[3], 1.0f);
+#endif
+}
+
+void CvMatAndImageTest::testConversionStats()
+{
+    const QSize size = image_argb32.size();
+    const qint64 pixels = qint64(size.width()) * size.height();
+
+    //Nothing is counted by default.
+    QVERIFY(!conversionStatsEnabled());
+    resetConversionStats();
+    image2Mat(image_argb32, CV_8UC3, MCO_RGB);
+    QCOMPARE(conversionStats(ConversionPlan::CP_Swizzle).calls, qint64(0));
+
+    setConversionStatsEnabled(true);
+    image2Mat(image_argb32, CV_8UC3, MCO_RGB);
+    image2Mat(image_argb32, CV_8UC3, MCO_RGB);
+    const ConversionStats swizzle = conversionStats(ConversionPlan::CP_Swizzle);
+    QCOMPARE(swizzle.calls, qint64(2));
+    QCOMPARE(swizzle.bytes, 2 * pixels * 3);
+    QCOMPARE(swizzle.allocations, qint64(2));
+    QVERIFY(swizzle.nsecs >= 0);
+
+    //The buffer of dst is reused.
+    ConversionPlan plan(CV_8UC4, size, MCO_BGRA);
+    QImage image;
+    QVERIFY(plan.convert(mat_8UC4_bgra, image));
+    QVERIFY(plan.convert(mat_8UC4_bgra, image));
+    const ConversionStats reused = conversionStats(plan.path());
+    QCOMPARE(reused.calls, qint64(2));
+    QCOMPARE(reused.allocations, qint64(1));
+
+    image2Mat_shared(image_argb32);
+    QCOMPARE(conversionStats(ConversionPlan::CP_ZeroCopy).calls, qint64(1));
+    QCOMPARE(conversionStats(ConversionPlan::CP_ZeroCopy).bytes, qint64(0));
+
+    cv::Mat mat;
+    QVERIFY(!plan.convert(image_argb32, mat));
+    QCOMPARE(conversionStats(ConversionPlan::CP_Invalid).calls, qint64(1));
+
+    setConversionStatsEnabled(false);
+    resetConversionStats();
+    QCOMPARE(conversionStats(ConversionPlan::CP_Swizzle).calls, qint64(0));
+    QCOMPARE(conversionStats(plan.path()).bytes, qint64(0));
+}
+
+void CvMatAndImageTest::testBufferPool()
+{
+    QVERIFY(!bufferPoolEnabled());
+    trimBufferPool();
+    const BufferPoolStats before = bufferPoolStats();
+
+    setBufferPoolEnabled(true);
+    const cv::Mat expect = image2Mat(image_argb32, CV_8UC3, MCO_RGB);
+    for (int i=0; i<4; ++i) {
+        //The buffer of the last mat is reused.
+        cv::Mat mat = image2Mat(image_argb32, CV_8UC3, MCO_RGB);
+        QVERIFY(lenientCompare<uchar>(mat, expect));
+        QImage image = mat2Image(mat_8UC4_bgra, MCO_BGRA);
+        QVERIFY(lenientCompare(image, image_argb32));
+    }
+#if CV_MAJOR_VERSION >= 3
+    //The pool is not left as the allocator of the mats of the caller.
+    cv::Mat dst;
+    image2Mat(image_argb32, dst, CV_8UC3, MCO_RGB);
+    QVERIFY(!dst.allocator);
+    QVERIFY(!expect.allocator);
+#endif
+    setBufferPoolEnabled(false);
+
+    const BufferPoolStats stats = bufferPoolStats();
+#if CV_MAJOR_VERSION >= 3
+    QVERIFY(stats.reuses - before.reuses >= 3);
+#endif
+    QVERIFY(stats.highWaterBytes >= stats.bytesInUse + stats.bytesCached);
+
+    //Cached buffers are freed, the ones in use are kept.
+    trimBufferPool();
+    QCOMPARE(bufferPoolStats().bytesCached, qint64(0));
+    QCOMPARE(bufferPoolStats().bytesInUse, stats.bytesInUse);
+}
+
+void CvMatAndImageTest::testRegionOfInterest()
+{
+    const QRect roi(3, 2, image_argb32.width() - 5, image_argb32.height() - 3);
+    const cv::Rect matRoi(roi.x(), roi.y(), roi.width(), roi.height());
+
+    //Same as the conversion of the copied region.
+    QVERIFY(lenientCompare<uchar>(image2Mat(image_argb32, roi, CV_8UC3, MCO_RGB),
+                                  image2Mat(image_argb32.copy(roi), CV_8UC3, MCO_RGB)));
+    QVERIFY(lenientCompare<float>(image2Mat(image_rgb32, roi, CV_32FC4, MCO_ARGB),
+                                  image2Mat(image_rgb32.copy(roi), CV_32FC4, MCO_ARGB)));
+    const QImage mono = image_argb32.convertToFormat(QImage::Format_Mono);
+    QVERIFY(lenientCompare<uchar>(image2Mat(mono, roi), image2Mat(mono.copy(roi))));
+    QVERIFY(lenientCompare(mat2Image(mat_8UC3_rgb, matRoi, MCO_RGB),
+                           mat2Image(mat_8UC3_rgb(matRoi).clone(), MCO_RGB)));
+
+    //The region is clipped to the image.
+    const QRect outside(image_argb32.width() - 2, 1, 100, 100);
+    QCOMPARE(image2Mat(image_argb32, outside).cols, 2);
+    QVERIFY(image2Mat(image_argb32, QRect(-10, -10, 5, 5)).empty());
+    QVERIFY(mat2Image(mat_8UC3_rgb, cv::Rect(-10, -10, 5, 5), MCO_RGB).isNull());
+
+    const cv::Mat shared = image2Mat_shared(image_argb32, roi);
+    QCOMPARE((const uchar *)shared.data, image_argb32.constScanLine(roi.y()) + roi.x() * 4);
+    QVERIFY(image2Mat_shared(mono, roi).empty());
+}
+
+void CvMatAndImageTest::testResizeConversion()
+{
+    const cv::Size size(image_argb32.width() / 3, image_argb32.height() / 2);
+    const QSize imageSize(size.width, size.height);
+
+    //Same as cv::resize() of the converted pixels.
+    cv::Mat expect;
+    cv::resize(image2Mat(image_argb32, CV_8UC3, MCO_RGB), expect, size, 0, 0, cv::INTER_AREA);
+    QVERIFY(lenientCompare<uchar>(image2Mat(image_argb32, size, RM_Area, CV_8UC3, MCO_RGB), expect));
+    cv::resize(image2Mat(image_indexed8, CV_8UC3), expect, size, 0, 0, cv::INTER_NEAREST);
+    QVERIFY(lenientCompare<uchar>(image2Mat(image_indexed8, size, RM_Nearest, CV_8UC3), expect));
+
+    cv::resize(mat_8UC3_rgb, expect, size, 0, 0, cv::INTER_AREA);
+    QVERIFY(lenientCompare(mat2Image(mat_8UC3_rgb, imageSize, RM_Area, MCO_RGB), mat2Image(expect, MCO_RGB)));
+    cv::resize(mat_16UC4_rgba, expect, size, 0, 0, cv::INTER_NEAREST);
+    QVERIFY(lenientCompare(mat2Image(mat_16UC4_rgba, imageSize, RM_Nearest, MCO_RGBA),
+                           mat2Image(expect, MCO_RGBA)));
+
+    const QImage image = mat2Image(mat_8UC3_rgb, imageSize, RM_Nearest, MCO_RGB, QImage::Format_RGB32);
+    QCOMPARE(image.size(), imageSize);
+    QCOMPARE(image.format(), QImage::Format_RGB32);
+    QVERIFY(mat2Image(mat_8UC3_rgb, QSize(), RM_Area, MCO_RGB).isNull());
+
+    //Only the conversion of the resized pixels is counted.
+    resetConversionStats();
+    setConversionStatsEnabled(true);
+    image2Mat(image_argb32, size, RM_Area, CV_8UC3, MCO_RGB);
+    setConversionStatsEnabled(false);
+    QCOMPARE(conversionStats(ConversionPlan::CP_ZeroCopy).calls, qint64(0));
+    QCOMPARE(conversionStats(ConversionPlan::CP_Swizzle).calls, qint64(1));
+    resetConversionStats();
+}
+
+void CvMatAndImageTest::testChannelsPermutation()
+{
+    //The widths cover the vector loops and the remaining pixels of the rows.
+    for (int width=1; width<=40; ++width) {
+        cv::Mat rgb(2, width, CV_8UC3, cv::Scalar::all(0));
+        for (int col=0; col<width; ++col)
+            rgb.at<cv::Vec3b>(1, col) = cv::Vec3b(uchar(col), uchar(col + 100), uchar(col + 200));
+        const cv::Mat bgr = image2Mat(mat2Image(rgb, MCO_RGB, QImage::Format_RGB888), CV_8UC3, MCO_BGR);
+        for (int col=0; col<width; ++col) {
+            QCOMPARE(bgr.at<cv::Vec3b>(1, col)[0], uchar(col + 200));
+            QCOMPARE(bgr.at<cv::Vec3b>(1, col)[2], uchar(col));
+        }
+
+#if QT_VERSION >= 0x050C00
+        cv::Mat rgba(2, width, CV_16UC4, cv::Scalar::all(0));
+        for (int col=0; col<width; ++col)
+            rgba.at<cv::Vec4w>(1, col) = cv::Vec4w(ushort(col), ushort(col + 1000), ushort(col + 2000), ushort(col + 3000));
+        const cv::Mat bgra = image2Mat(mat2Image(rgba, MCO_RGBA), CV_16UC4, MCO_BGRA);
+        for (int col=0; col<width; ++col) {
+            QCOMPARE(bgra.at<cv::Vec4w>(1, col)[0], ushort(col + 2000));
+            QCOMPARE(bgra.at<cv::Vec4w>(1, col)[2], ushort(col));
+            QCOMPARE(bgra.at<cv::Vec4w>(1, col)[3], ushort(col + 3000));
+        }
+#endif
+    }
+}
+
+void CvMatAndImageTest::testDepthConversion()
+{
+    //The widths cover the vector loops and the remaining pixels of the rows.
+    for (int width=1; width<=40; ++width) {
+        cv::Mat rgb(2, width, CV_8UC3, cv::Scalar::all(0));
+        for (int col=0; col<width; ++col)
+            rgb.at<cv::Vec3b>(1, col) = cv::Vec3b(uchar(col), uchar(col + 100), uchar(col * 6));
+        const QImage image = mat2Image(rgb, MCO_RGB, QImage::Format_RGB888);
+
+        const cv::Mat bgr16 = image2Mat(image, CV_16UC3, MCO_BGR);
+        for (int col=0; col<width; ++col) {
+            QCOMPARE(bgr16.at<cv::Vec3w>(1, col)[0], ushort(col * 6 * 257));
+            QCOMPARE(bgr16.at<cv::Vec3w>(1, col)[2], ushort(col * 257));
+        }
+
+        const cv::Mat rgb32 = image2Mat(image, CV_32FC3, MCO_RGB);
+        for (int col=0; col<width; ++col) {
+            QCOMPARE(rgb32.at<cv::Vec3f>(1, col)[0], col / 255.0f);
+            QCOMPARE(rgb32.at<cv::Vec3f>(1, col)[1], (col + 100) / 255.0f);
+        }
+
+        const cv::Mat gray = image2Mat(image, CV_8UC1);
+        for (int col=0; col<width; ++col) {
+            const float expect = col*0.299f + (col + 100)*0.587f + col*6*0.114f;
+            QVERIFY(qAbs(gray.at<uchar>(1, col) - expect) <= 1.0f);
+        }
+
+        cv::Mat rgb16(2, width, CV_16UC3, cv::Scalar::all(0));
+        for (int col=0; col<width; ++col)
+            rgb16.at<cv::Vec3w>(1, col) = cv::Vec3w(ushort(col * 1600), ushort(col * 1600 + 128), ushort(65535 - col));
+        const QImage image8 = mat2Image(rgb16, MCO_RGB, QImage::Format_RGB888);
+        for (int col=0; col<width; ++col) {
+            const uchar *pixel = image8.constScanLine(1) + col*3;
+            QCOMPARE(pixel[0], uchar((col * 1600 + 128) / 257));
+            QCOMPARE(pixel[1], uchar((col * 1600 + 256) / 257));
+            QCOMPARE(pixel[2], uchar(255));
+        }
+    }
+}
+
+void CvMatAndImageTest::testCpuLevel()
+{
+    setCpuLevel(CPU_Baseline);
+    QCOMPARE(cpuLevel(), CPU_Baseline);
+    const cv::Mat expect = image2Mat(image_argb32, CV_8UC4, MCO_RGBA);
+    const cv::Mat expect3 = image2Mat(image_rgb888, CV_8UC3, MCO_BGR);
+    const cv::Mat expect16 = image2Mat(image_rgb888, CV_16UC4, MCO_BGRA);
+    const cv::Mat expect32 = image2Mat(image_argb32, CV_32FC1);
+
+    //The levels which the CPU doesn't support fall back to a lower one of
+    //the architecture, the levels of other architectures are never selected.
+    QList<CpuLevel> archLevels;
+    archLevels << CPU_Baseline;
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    archLevels << CPU_SSSE3 << CPU_AVX2;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    archLevels << CPU_NEON;
+#endif
+    for (int level=CPU_Baseline; level<=CPU_NEON; ++level) {
+        setCpuLevel(CpuLevel(level));
+        const int selected = archLevels.indexOf(cpuLevel());
+        QVERIFY(selected >= 0);
+        if (archLevels.contains(CpuLevel(level)))
+            QVERIFY(selected <= archLevels.indexOf(CpuLevel(level)));
+        QCOMPARE(cv::norm(image2Mat(image_argb32, CV_8UC4, MCO_RGBA), expect, cv::NORM_INF), 0.0);
+        QCOMPARE(cv::norm(image2Mat(image_rgb888, CV_8UC3, MCO_BGR), expect3, cv::NORM_INF), 0.0);
+        QCOMPARE(cv::norm(image2Mat(image_rgb888, CV_16UC4, MCO_BGRA), expect16, cv::NORM_INF), 0.0);
+        QCOMPARE(cv::norm(image2Mat(image_argb32, CV_32FC1), expect32, cv::NORM_INF), 0.0);
+    }
+
+    setCpuLevel(CPU_Auto);
+}
+
+void CvMatAndImageTest::testPlanes()
+{
+    //The planes are the same as those of cv::split().
+    std::vector<cv::Mat> planes = image2Planes(image_argb32, CV_8UC4, MCO_RGBA);
+    std::vector<cv::Mat> expectPlanes;
+    cv::split(image2Mat(image_argb32, CV_8UC4, MCO_RGBA), expectPlanes);
+    QCOMPARE(planes.size(), expectPlanes.size());
+    for (size_t c=0; c<planes.size(); ++c)
+        QCOMPARE(cv::norm(planes[c], expectPlanes[c], cv::NORM_INF), 0.0);
+
+    //The planes are reused.
+    const uchar *data = planes[0].data;
+    image2Planes(image_argb32, planes, CV_8UC3, MCO_BGR);
+    QCOMPARE(planes.size(), size_t(3));
+    QCOMPARE((const uchar *)planes[0].data, data);
+    const cv::Mat expectMat = image2Mat(image_argb32, CV_8UC3, MCO_BGR);
+    cv::split(expectMat, expectPlanes);
+    for (size_t c=0; c<planes.size(); ++c)
+        QCOMPARE(cv::norm(planes[c], expectPlanes[c], cv::NORM_INF), 0.0);
+
+    //The planes are the same as those of cv::merge().
+    QCOMPARE(planes2Image(planes, MCO_BGR), mat2Image(expectMat, MCO_BGR));
+    QCOMPARE(planes2Image(planes, MCO_BGR, QImage::Format_ARGB32), mat2Image(expectMat, MCO_BGR, QImage::Format_ARGB32));
+
+    //The depth is converted too.
+    const cv::Mat expectMat32F = image2Mat(image_argb32, CV_32FC3, MCO_RGB);
+    image2Planes(image_argb32, planes, CV_32FC3, MCO_RGB);
+    cv::split(expectMat32F, expectPlanes);
+    for (size_t c=0; c<planes.size(); ++c)
+        QCOMPARE(cv::norm(planes[c], expectPlanes[c], cv::NORM_INF), 0.0);
+    QCOMPARE(planes2Image(planes, MCO_RGB, QImage::Format_RGB888),
+             mat2Image(expectMat32F, MCO_RGB, QImage::Format_RGB888));
+}
+
+void CvMatAndImageTest::testAlphaMode()
+{
+    //Straight (B G R A) pixels, the width covers the vector loops and the remaining pixels.
+    cv::Mat straight(3, 37, CV_8UC4);
+    for (int row=0; row<straight.rows; ++row) {
+        for (int col=0; col<straight.cols; ++col)
+            straight.at<cv::Vec4b>(row, col) = cv::Vec4b(uchar(col*7), uchar(row*60 + 50), uchar(255 - col), uchar(col*7 + row));
+    }
+    const QImage straightImage = mat2Image(straight, MCO_BGRA, QImage::Format_ARGB32);
+    const QImage premultipliedImage = straightImage.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    const cv::Mat premultiplied = image2Mat(premultipliedImage, CV_8UC4, MCO_BGRA);
+
+    //The colors are premultiplied as QImage::convertToFormat() does.
+    QImage image = mat2Image(straight, MCO_BGRA, QImage::Format_ARGB32_Premultiplied, AM_Straight);
+    QCOMPARE(image.format(), QImage::Format_ARGB32_Premultiplied);
+    QVERIFY(cv::norm(image2Mat(image, CV_8UC4, MCO_BGRA), premultiplied, cv::NORM_INF) <= 1.0);
+    QVERIFY(cv::norm(image2Mat(straightImage, CV_8UC4, MCO_BGRA, AM_Premultiplied), premultiplied, cv::NORM_INF) <= 1.0);
+
+    //The premultiplied mat is kept as it is when no format is asked.
+    image = mat2Image(premultiplied, MCO_BGRA, QImage::Format_Invalid, AM_Premultiplied);
+    QCOMPARE(image, premultipliedImage);
+
+    //The colors are unpremultiplied as QImage::convertToFormat() does.
+    const cv::Mat expectStraight = image2Mat(premultipliedImage.convertToFormat(QImage::Format_ARGB32), CV_8UC4, MCO_RGBA);
+    QVERIFY(cv::norm(image2Mat(premultipliedImage, CV_8UC4, MCO_RGBA, AM_Straight), expectStraight, cv::NORM_INF) <= 1.0);
+    image = mat2Image(premultiplied, MCO_BGRA, QImage::Format_ARGB32, AM_Premultiplied);
+    QVERIFY(cv::norm(image2Mat(image, CV_8UC4, MCO_RGBA), expectStraight, cv::NORM_INF) <= 1.0);
+
+    //The plan of the alpha mode doesn't share the premultiplied data.
+    ConversionPlan plan(QImage::Format_ARGB32_Premultiplied, premultipliedImage.size(), CV_8UC4, MCO_BGRA,
+                        ConversionPlan::ShareData, AM_Straight);
+    QCOMPARE(plan.path(), ConversionPlan::CP_Swizzle);
+}
+
+#if QT_VERSION >= 0x060000 || defined(Q_COMPILER_RVALUE_REFS)
+void CvMatAndImageTest::testMoveConversion()
+{
+    const cv::Mat expectMat = image2Mat(image_argb32, CV_8UC4, MCO_RGBA);
+
+#if CV_MAJOR_VERSION >= 3
+    //The buffer of the owned image is taken, and reordered in place.
+    QImage image = image_argb32.copy();
+    const uchar *bits = image.constBits();
+    cv::Mat mat = image2Mat(std::move(image), CV_8UC4, MCO_RGBA);
+    QVERIFY(image.isNull());
+    QCOMPARE((const uchar *)mat.data, bits);
+    QVERIFY(lenientCompare<uchar>(mat, expectMat));
+
+    //The buffer shared with other images is not touched.
+    image = image_argb32;
+    mat = image2Mat(std::move(image), CV_8UC4, MCO_RGBA);
+    QVERIFY((const uchar *)mat.data != image_argb32.constBits());
+    QVERIFY(lenientCompare<uchar>(mat, expectMat));
+    QVERIFY(lenientCompare<uchar>(image2Mat(image_argb32, CV_8UC4, MCO_RGBA), expectMat));
+#endif
+
+#if CV_MAJOR_VERSION >= 3 && QT_VERSION >= 0x050000
+    //The buffer of a mat shared by the image is not taken.
+    cv::Mat shared = image2Mat(image_argb32, CV_8UC4, MCO_BGRA);
+    const cv::Mat before = shared.clone();
+    image = mat2Image_shared(shared);
+    mat = image2Mat(std::move(image), CV_8UC4, MCO_RGBA);
+    QVERIFY(mat.data != shared.data);
+    QVERIFY(lenientCompare<uchar>(mat, expectMat));
+    QCOMPARE(cv::norm(shared, before, cv::NORM_INF), 0.0);
+#endif
+
+#if QT_VERSION >= 0x050000
+    //The buffer of the owned mat is taken, and reordered in place.
+    cv::Mat owned = expectMat.clone();
+    const uchar *data = owned.data;
+    QImage result = mat2Image(std::move(owned), MCO_RGBA, QImage::Format_ARGB32);
+    QVERIFY(owned.empty());
+    QCOMPARE(result.constBits(), data);
+    QVERIFY(lenientCompare(result, image_argb32));
+
+    //The buffer shared with other mats is not touched.
+    owned = expectMat;
+    result = mat2Image(std::move(owned), MCO_RGBA, QImage::Format_ARGB32);
+    QVERIFY(result.constBits() != expectMat.data);
+    QVERIFY(lenientCompare(result, image_argb32));
+    QVERIFY(lenientCompare<uchar>(image2Mat(image_argb32, CV_8UC4, MCO_RGBA), expectMat));
+#endif
+}
+#endif
+
+#ifdef QT_CONCURRENT_LIB
+void CvMatAndImageTest::testBatchConversion()
+{
+    QVector<QImage> images;
+    images.append(image_argb32);
+    images.append(image_rgb32);
+    images.append(image_indexed8);
+    QFuture<cv::Mat> mats = image2MatBatch(images, CV_8UC3, MCO_RGB);
+    mats.waitForFinished();
+    QCOMPARE(mats.resultCount(), int(images.size()));
+    for (int i=0; i<images.size(); ++i)
+        QVERIFY(lenientCompare<uchar>(mats.resultAt(i), image2Mat(images[i], CV_8UC3, MCO_RGB)));
+
+    std::vector<cv::Mat> inputs;
+    inputs.push_back(mat_8UC3_rgb);
+    inputs.push_back(mat_16UC3_rgb);
+    inputs.push_back(mat_32FC3_rgb);
+    QFuture<QImage> results = mat2ImageBatch(inputs, MCO_RGB, QImage::Format_RGB32);
+    results.waitForFinished();
+    QCOMPARE(results.resultCount(), int(inputs.size()));
+    for (size_t i=0; i<inputs.size(); ++i)
+        QVERIFY(lenientCompare(results.resultAt(int(i)), mat2Image(inputs[i], MCO_RGB, QImage::Format_RGB32)));
+
+    QCOMPARE(image2MatAsync(image_argb32, CV_8UC4, MCO_BGRA).result().type(), CV_8UC4);
+    QVERIFY(lenientCompare(mat2ImageAsync(mat_8UC3_rgb, MCO_RGB).result(), mat2Image(mat_8UC3_rgb, MCO_RGB)));
+
+    //The conversions not started yet are skipped, the only thread of the pool is busy.
+    QThreadPool *pool = QThreadPool::globalInstance();
+    const int maxThreadCount = pool->maxThreadCount();
+    pool->setMaxThreadCount(1);
+    QSemaphore started;
+    QSemaphore release;
+    QFuture<void> blocker = QtConcurrent::run(blockThread, &started, &release);
+    started.acquire();
+    QFuture<cv::Mat> canceled = image2MatBatch(QVector<QImage>(64, image_argb32));
+    canceled.cancel();
+    release.release();
+    canceled.waitForFinished();
+    blocker.waitForFinished();
+    pool->setMaxThreadCount(maxThreadCount);
+    QVERIFY(canceled.isCanceled());
+    QVERIFY(canceled.resultCount() < 64);
+}
+#endif
+
 QTEST_MAIN(CvMatAndImageTest)
 
 #include "tst_cvmatandimagetest.moc"